@@ -4,6 +4,7 @@
 
 #include "matrix.h"
 #include "neural.h"
+#include "simd_math.h"
 
 // Calculate a linear activation (i.e. no activation).
 //  f(x) = x
@@ -19,12 +20,11 @@ Matrix forward_linear(const Matrix &matrix) {
 // Calculate the backwards pass for the activation.
 // Parameters:
 //  const Matrix& out: the activated output of the current layer.
-//  const Matrix& prev_grad: the gradient from the next layer (towards the Loss).
+//  Matrix grad: the gradient from the next layer (towards the Loss), updated in place.
 // Returns:
 //  Matrix: the gradients of this layer (to be passed to the previous layer).
-Matrix backward_linear(const Matrix &out, const Matrix &prev_grad) {
-  assert_same_size(prev_grad, out);
-  Matrix grad = prev_grad;
+Matrix backward_linear(const Matrix &out, Matrix grad) {
+  assert_same_size(grad, out);
   return grad;
 }
 
@@ -35,31 +35,19 @@ Matrix backward_linear(const Matrix &out, const Matrix &prev_grad) {
 //  A Matrix containing the activated output.
 Matrix forward_logistic(const Matrix &matrix) {
   Matrix activated = matrix;
-  for (long i = 0; i < activated.rows * activated.cols; i++)
-  {
-    double x = activated.begin()[i];
-    double fx = 1.0 / (1.0 + exp(-1.0 * x));
-    activated.begin()[i] = fx;
-  }
+  activate_matrix_inplace(activated, LOGISTIC);
   return activated;
 }
 
 // Calculate the backwards pass for the activation.
 // Parameters:
 //  const Matrix& out: the activated output of the current layer.
-//  const Matrix& prev_grad: the gradient from the next layer (towards the Loss).
+//  Matrix grad: the gradient from the next layer (towards the Loss), updated in place.
 // Returns:
 //  Matrix: the gradients of this layer (to be passed to the previous layer).
-Matrix backward_logistic(const Matrix &out, const Matrix &prev_grad) {
-  assert_same_size(prev_grad, out);
-  Matrix grad = prev_grad;
-  for (long i = 0; i < grad.rows * grad.cols; i++)
-  {
-    double next = grad.begin()[i];
-    double f = out.begin()[i];
-    double fdot = f * (1.0 - f);
-    grad.begin()[i] = next * fdot;
-  }
+Matrix backward_logistic(const Matrix &out, Matrix grad) {
+  assert_same_size(grad, out);
+  backward_activate_inplace(out, grad, LOGISTIC);
   return grad;
 }
 
@@ -70,31 +58,19 @@ Matrix backward_logistic(const Matrix &out, const Matrix &prev_grad) {
 //  A Matrix containing the activated output.
 Matrix forward_tanh(const Matrix &matrix) {
   Matrix activated = matrix;
-  for (long i = 0; i < activated.rows * activated.cols; i++)
-  {
-    double x = activated.begin()[i];
-    double fx = tanh(x);
-    activated.begin()[i] = fx;
-  }
+  activate_matrix_inplace(activated, TANH);
   return activated;
 }
 
 // Calculate the backwards pass for the activation.
 // Parameters:
 //  const Matrix& out: the activated output of the current layer.
-//  const Matrix& prev_grad: the gradient from the next layer (towards the Loss).
+//  Matrix grad: the gradient from the next layer (towards the Loss), updated in place.
 // Returns:
 //  Matrix: the gradients of this layer (to be passed to the previous layer).
-Matrix backward_tanh(const Matrix &out, const Matrix &prev_grad) {
-  assert_same_size(prev_grad, out);
-  Matrix grad = prev_grad;
-  for (long i = 0; i < grad.rows * grad.cols; i++)
-  {
-    double next = grad.begin()[i];
-    double f = out.begin()[i];
-    double fdot = 1 - pow(f, 2);
-    grad.begin()[i] = next * fdot;
-  }
+Matrix backward_tanh(const Matrix &out, Matrix grad) {
+  assert_same_size(grad, out);
+  backward_activate_inplace(out, grad, TANH);
   return grad;
 }
 
@@ -117,12 +93,11 @@ Matrix forward_relu(const Matrix &matrix) {
 // Calculate the backwards pass for the activation.
 // Parameters:
 //  const Matrix& out: the activated output of the current layer.
-//  const Matrix& prev_grad: the gradient from the next layer (towards the Loss).
+//  Matrix grad: the gradient from the next layer (towards the Loss), updated in place.
 // Returns:
 //  Matrix: the gradients of this layer (to be passed to the previous layer).
-Matrix backward_relu(const Matrix &out, const Matrix &prev_grad) {
-  assert_same_size(prev_grad, out);
-  Matrix grad = prev_grad;
+Matrix backward_relu(const Matrix &out, Matrix grad) {
+  assert_same_size(grad, out);
   for (long i = 0; i < grad.rows * grad.cols; i++)
   {
     double next = grad.begin()[i];
@@ -152,12 +127,11 @@ Matrix forward_lrelu(const Matrix &matrix) {
 // Calculate the backwards pass for the activation.
 // Parameters:
 //  const Matrix& out: the activated output of the current layer.
-//  const Matrix& prev_grad: the gradient from the next layer (towards the Loss).
+//  Matrix grad: the gradient from the next layer (towards the Loss), updated in place.
 // Returns:
 //  Matrix: the gradients of this layer (to be passed to the previous layer).
-Matrix backward_lrelu(const Matrix &out, const Matrix &prev_grad) {
-  assert_same_size(prev_grad, out);
-  Matrix grad = prev_grad;
+Matrix backward_lrelu(const Matrix &out, Matrix grad) {
+  assert_same_size(grad, out);
   for (long i = 0; i < grad.rows * grad.cols; i++)
   {
     double next = grad.begin()[i];
@@ -174,23 +148,7 @@ Matrix backward_lrelu(const Matrix &out, const Matrix &prev_grad) {
 // Returns:
 Matrix forward_softmax(const Matrix &matrix) {
   Matrix activated = matrix;
-  for (int i = 0; i < activated.rows; i++)
-  {
-    double sum = 0;
-    for (int j = 0; j < activated.cols; j++)
-    {
-      double x = activated[i][j];
-      double fx = exp(x);
-      sum += fx;
-      activated[i][j] = fx;
-    }
-    for (int j = 0; j < activated.cols; j++)
-    {
-      double x = activated[i][j];
-      double fx = sum == 0 ? 0 : x / sum;
-      activated[i][j] = fx;
-    }
-  }
+  activate_matrix_inplace(activated, SOFTMAX);
   return activated;
 }
 
@@ -216,20 +174,11 @@ Matrix softmax_jacobian(const Matrix &out_row) {
 }
 
 // Computes the backwards pass for the softmax function.
-Matrix backward_softmax(const Matrix &out, const Matrix &prev_grad) {
-  //printf("backward softmax\n");
-  assert_same_size(prev_grad, out);
-  Matrix grad = prev_grad;
-  // Multiply previous gradient with Jacobian.
-  for (int i = 0; i < out.rows; i++) {
-    Matrix jacobian = softmax_jacobian(out.get_row(i));
-    Matrix row_grad = prev_grad.get_row(i);
-    Matrix product = row_grad * jacobian;
-    for (int j = 0; j < out.cols; j++)
-    {
-      grad[i][j] =  product[0][j];
-    }
-  }
+// Multiplying by the Jacobian diag(y) - y^T y reduces to
+// g_j * y_j - y_j * sum_k g_k y_k, see backward_activate_inplace.
+Matrix backward_softmax(const Matrix &out, Matrix grad) {
+  assert_same_size(grad, out);
+  backward_activate_inplace(out, grad, SOFTMAX);
   return grad;
 }
 
@@ -261,21 +210,89 @@ Matrix forward_activate_matrix(const Matrix &matrix, Activation a) {
 //
 // const Matrix& out: an activated layer output
 // Activation a: activation function for a layer
-// Matrix& grad: before activation gradient (initial layer gradient)
+// Matrix grad: before activation gradient (initial layer gradient), taken
+//              by value: move it in and no copy is made on the way down
 // returns: Matrix that is after applying the activation gradien
-Matrix backward_activate_matrix(const Matrix &out, const Matrix &grad, Activation a) {
+Matrix backward_activate_matrix(const Matrix &out, Matrix grad, Activation a) {
   if (a == LINEAR) {
-    return backward_linear(out, grad);
+    return backward_linear(out, move(grad));
   } else if (a == LOGISTIC) {
-    return backward_logistic(out, grad);
+    return backward_logistic(out, move(grad));
   } else if (a == TANH) {
-    return backward_tanh(out, grad);
+    return backward_tanh(out, move(grad));
   } else if (a == RELU) {
-    return backward_relu(out, grad);
+    return backward_relu(out, move(grad));
   } else if (a == LRELU) {
-    return backward_lrelu(out, grad);
+    return backward_lrelu(out, move(grad));
   } else if (a == SOFTMAX) {
-    return backward_softmax(out, grad);
+    return backward_softmax(out, move(grad));
+  } else {
+    assert(false); // Invalid activation.
+  }
+}
+
+// Run an activation function on each element of a matrix in place.
+// Used by the inference path, which keeps no pre-activation copy.
+//
+// Matrix& m: input to the activation function, overwritten with the output
+// Activation a: function to run
+void activate_matrix_inplace(Matrix &m, Activation a) {
+  double *x = m.data;
+  long n = (long) m.rows * m.cols;
+  if (a == LINEAR) {
+    return;
+  } else if (a == LOGISTIC) {
+    sigmoid_inplace(x, n);
+  } else if (a == TANH) {
+    tanh_inplace(x, n);
+  } else if (a == RELU) {
+    for (long i = 0; i < n; i++) x[i] = x[i] > 0.0 ? x[i] : 0.0;
+  } else if (a == LRELU) {
+    for (long i = 0; i < n; i++) x[i] = x[i] > 0.0 ? x[i] : 0.01 * x[i];
+  } else if (a == SOFTMAX) {
+    // shifting by the row maximum keeps exp in range, the result is the same
+    for (int i = 0; i < m.rows; i++) {
+      double *row = m[i];
+      double top = m.cols ? *std::max_element(row, row + m.cols) : 0;
+      for (int j = 0; j < m.cols; j++) row[j] -= top;
+      exp_inplace(row, m.cols);
+      double sum = 0;
+      for (int j = 0; j < m.cols; j++) sum += row[j];
+      for (int j = 0; j < m.cols; j++) row[j] = sum == 0 ? 0 : row[j] / sum;
+    }
+  } else {
+    assert(false); // Invalid activation.
+  }
+}
+
+// Multiply the gradient of an activation into grad in place
+//
+// const Matrix& out: the activated output of the layer
+// Matrix& grad: gradient w.r.t. the output, overwritten with the gradient w.r.t. the input
+// Activation a: activation function of the layer
+void backward_activate_inplace(const Matrix &out, Matrix &grad, Activation a) {
+  assert_same_size(grad, out);
+  double *g = grad.data;
+  const double *f = out.data;
+  long n = (long) grad.rows * grad.cols;
+  if (a == LINEAR) {
+    return;
+  } else if (a == LOGISTIC) {
+    for (long i = 0; i < n; i++) g[i] *= f[i] * (1.0 - f[i]);
+  } else if (a == TANH) {
+    for (long i = 0; i < n; i++) g[i] *= 1.0 - f[i] * f[i];
+  } else if (a == RELU) {
+    for (long i = 0; i < n; i++) g[i] = f[i] < 0.0 ? 0.0 : g[i];
+  } else if (a == LRELU) {
+    for (long i = 0; i < n; i++) g[i] = f[i] < 0.0 ? 0.01 * g[i] : g[i];
+  } else if (a == SOFTMAX) {
+    for (int i = 0; i < grad.rows; i++) {
+      double *gi = grad[i];
+      const double *y = out[i];
+      double dot = 0;
+      for (int j = 0; j < grad.cols; j++) dot += gi[j] * y[j];
+      for (int j = 0; j < grad.cols; j++) gi[j] = y[j] * (gi[j] - dot);
+    }
   } else {
     assert(false); // Invalid activation.
   }
@@ -0,0 +1,346 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+// On-disk layout of a checkpoint:
+//   CheckpointHeader | CheckpointLayer[num_layers] | w/v data
+// Every w and v block is a row-major array of doubles starting on a 64 byte
+// boundary, so it can be used in place from a memory-mapped file.
+static const char CKPT_MAGIC[8] = {'C', 'S', 'E', '5', '7', '6', 'C', 'K'};
+// Version 2 added the layer type and CONV/MAXPOOL geometry; version 1
+// checkpoints (dense layers only) are still read.
+static const uint32_t CKPT_VERSION = 2;
+static const uint64_t CKPT_ALIGN = 64;
+
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t loss;
+  uint32_t num_layers;
+  uint32_t reserved;
+  int64_t iteration;
+};
+
+struct CheckpointLayer {
+  int32_t rows;
+  int32_t cols;
+  int32_t activation;
+  int32_t type;
+  int32_t in_c, in_h, in_w;
+  int32_t out_c, out_h, out_w;
+  int32_t size, stride, pad;
+  int32_t reserved;
+  uint64_t w_offset;
+  uint64_t v_offset;
+};
+
+struct CheckpointLayerV1 {
+  int32_t rows;
+  int32_t cols;
+  int32_t activation;
+  int32_t reserved;
+  uint64_t w_offset;
+  uint64_t v_offset;
+};
+
+static size_t record_size(uint32_t version) {
+  return version == 1 ? sizeof(CheckpointLayerV1) : sizeof(CheckpointLayer);
+}
+
+// Layer record i of a checkpoint of any supported version
+static CheckpointLayer layer_record(const unsigned char *ptr, uint32_t version, uint32_t i) {
+  CheckpointLayer r;
+  const unsigned char *rec = ptr + sizeof(CheckpointHeader) + record_size(version) * i;
+  if (version != 1) {
+    memcpy(&r, rec, sizeof(r));
+    return r;
+  }
+  CheckpointLayerV1 v1;
+  memcpy(&v1, rec, sizeof(v1));
+  memset(&r, 0, sizeof(r));
+  r.rows = v1.rows;
+  r.cols = v1.cols;
+  r.activation = v1.activation;
+  r.type = DENSE;
+  r.w_offset = v1.w_offset;
+  r.v_offset = v1.v_offset;
+  return r;
+}
+
+static uint64_t align_up(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
+// Serialize a model
+// const Model& m: model to save
+// const string& file: output checkpoint
+// long iteration: training iteration the checkpoint was taken at
+// returns: true on success
+bool save_checkpoint(const Model &m, const string &file, long iteration) {
+  CheckpointHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CKPT_MAGIC, sizeof(h.magic));
+  h.version = CKPT_VERSION;
+  h.loss = m.loss;
+  h.num_layers = (uint32_t) m.layers.size();
+  h.iteration = iteration;
+
+  vector<CheckpointLayer> layers(m.layers.size());
+  uint64_t offset = sizeof(h) + sizeof(CheckpointLayer) * layers.size();
+  for (size_t i = 0; i < layers.size(); i++) {
+    const Layer &l = m.layers[i];
+    assert(l.v.rows == 0 || (l.v.rows == l.w.rows && l.v.cols == l.w.cols));
+    uint64_t bytes = sizeof(double) * uint64_t(l.w.rows) * l.w.cols;
+    memset(&layers[i], 0, sizeof(CheckpointLayer));
+    layers[i].rows = l.w.rows;
+    layers[i].cols = l.w.cols;
+    layers[i].activation = l.activation;
+    layers[i].type = l.type;
+    layers[i].in_c = l.in_c;
+    layers[i].in_h = l.in_h;
+    layers[i].in_w = l.in_w;
+    layers[i].out_c = l.out_c;
+    layers[i].out_h = l.out_h;
+    layers[i].out_w = l.out_w;
+    layers[i].size = l.size;
+    layers[i].stride = l.stride;
+    layers[i].pad = l.pad;
+    layers[i].w_offset = offset = align_up(offset, CKPT_ALIGN);
+    layers[i].v_offset = offset = align_up(offset + bytes, CKPT_ALIGN);
+    offset += bytes;
+  }
+
+  string tmp = file + ".tmp";
+  FILE *fn = fopen(tmp.c_str(), "wb");
+  if (fn == nullptr) {
+    printf("Cannot write checkpoint \"%s\"\n", tmp.c_str());
+    return false;
+  }
+
+  uint64_t pos = 0;
+  bool ok = true;
+  auto put = [&](const void *data, uint64_t bytes) {
+    ok = ok && (bytes == 0 || fwrite(data, 1, bytes, fn) == bytes);
+    pos += bytes;
+  };
+  auto pad_to = [&](uint64_t target) {
+    static const char zeros[CKPT_ALIGN] = {0};
+    put(zeros, target - pos);
+  };
+
+  put(&h, sizeof(h));
+  put(layers.data(), sizeof(CheckpointLayer) * layers.size());
+  for (size_t i = 0; i < layers.size(); i++) {
+    const Layer &l = m.layers[i];
+    uint64_t bytes = sizeof(double) * uint64_t(l.w.rows) * l.w.cols;
+    pad_to(layers[i].w_offset);
+    put(l.w.data, bytes);
+    pad_to(layers[i].v_offset);
+    if (l.v.rows) put(l.v.data, bytes);
+    else {
+      vector<double> zeros(size_t(l.w.rows) * l.w.cols, 0.);
+      put(zeros.data(), bytes);
+    }
+  }
+
+  ok = ok && fflush(fn) == 0 && fsync(fileno(fn)) == 0;
+  ok = (fclose(fn) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+    printf("Failed writing checkpoint \"%s\"\n", file.c_str());
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Validate a checkpoint image in memory
+static bool check_checkpoint(const string &file, const unsigned char *ptr, uint64_t size) {
+  const CheckpointHeader &h = *(const CheckpointHeader *) ptr;
+  bool ok = size >= sizeof(h) && memcmp(h.magic, CKPT_MAGIC, sizeof(h.magic)) == 0;
+  if (ok && (h.version < 1 || h.version > CKPT_VERSION)) {
+    printf("Checkpoint \"%s\" has version %u, expected at most %u\n", file.c_str(), h.version, CKPT_VERSION);
+    return false;
+  }
+  ok = ok && sizeof(h) + record_size(h.version) * uint64_t(h.num_layers) <= size;
+  for (uint32_t i = 0; ok && i < h.num_layers; i++) {
+    CheckpointLayer l = layer_record(ptr, h.version, i);
+    uint64_t bytes = sizeof(double) * uint64_t(l.rows) * l.cols;
+    ok = l.rows >= 0 && l.cols >= 0 && l.activation >= LINEAR && l.activation <= SOFTMAX &&
+        l.type >= DENSE && l.type <= MAXPOOL &&
+        l.w_offset % CKPT_ALIGN == 0 && l.v_offset % CKPT_ALIGN == 0 &&
+        l.w_offset + bytes <= size && l.v_offset + bytes <= size;
+  }
+  ok = ok && h.loss <= L1_LOSS;
+  if (!ok) printf("\"%s\" is not a valid checkpoint\n", file.c_str());
+  return ok;
+}
+
+// Map a checkpoint file privately (copy-on-write)
+static void *map_file(const string &file, size_t &size) {
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("Checkpoint \"%s\" missing\n", file.c_str());
+    return nullptr;
+  }
+  struct stat st;
+  void *ptr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    size = st.st_size;
+    ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+  ::close(fd);
+  return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+// Build the Model described by a checkpoint. With copy=false the matrices
+// alias the checkpoint memory.
+static Model model_from(const unsigned char *ptr, bool copy) {
+  const CheckpointHeader &h = *(const CheckpointHeader *) ptr;
+  Model m;
+  m.loss = (LossFunction) h.loss;
+  m.layers.resize(h.num_layers);
+  for (uint32_t i = 0; i < h.num_layers; i++) {
+    CheckpointLayer r = layer_record(ptr, h.version, i);
+    Layer &l = m.layers[i];
+    l.activation = (Activation) r.activation;
+    l.type = (LayerType) r.type;
+    l.in_c = r.in_c;
+    l.in_h = r.in_h;
+    l.in_w = r.in_w;
+    l.out_c = r.out_c;
+    l.out_h = r.out_h;
+    l.out_w = r.out_w;
+    l.size = r.size;
+    l.stride = r.stride;
+    l.pad = r.pad;
+    if (copy) {
+      l.w = Matrix(r.rows, r.cols);
+      l.v = Matrix(r.rows, r.cols);
+      l.grad_w = Matrix(r.rows, r.cols);
+      memcpy(l.w.data, ptr + r.w_offset, sizeof(double) * r.rows * r.cols);
+      memcpy(l.v.data, ptr + r.v_offset, sizeof(double) * r.rows * r.cols);
+    } else {
+      l.w.rows = l.v.rows = r.rows;
+      l.w.cols = l.v.cols = r.cols;
+      l.w.data = (double *) (ptr + r.w_offset);
+      l.v.data = (double *) (ptr + r.v_offset);
+    }
+  }
+  return m;
+}
+
+// Load a checkpoint, copying the weights
+// const string& file: checkpoint
+// Model& m: output model
+// long* iteration: if not null receives the training iteration
+// returns: true on success
+bool load_checkpoint(const string &file, Model &m, long *iteration) {
+  size_t size = 0;
+  void *ptr = map_file(file, size);
+  if (ptr == nullptr) return false;
+  bool ok = check_checkpoint(file, (const unsigned char *) ptr, size);
+  if (ok) {
+    m = model_from((const unsigned char *) ptr, true);
+    if (iteration) *iteration = (long) ((const CheckpointHeader *) ptr)->iteration;
+  }
+  munmap(ptr, size);
+  return ok;
+}
+
+MappedModel::~MappedModel() { close(); }
+
+// Map a checkpoint for evaluation. Nothing is copied.
+// returns: true on success
+bool MappedModel::open(const string &file) {
+  close();
+  void *ptr = map_file(file, map_size);
+  if (ptr == nullptr) return false;
+  if (!check_checkpoint(file, (const unsigned char *) ptr, map_size)) {
+    munmap(ptr, map_size);
+    map_size = 0;
+    return false;
+  }
+  map = ptr;
+  model = model_from((const unsigned char *) ptr, false);
+  return true;
+}
+
+void MappedModel::close() {
+  // The matrices do not own their memory, detach them before they are freed
+  for (auto &l:model.layers) l.w.data = l.v.data = nullptr;
+  model.layers.clear();
+  if (map) munmap(map, map_size);
+  map = nullptr;
+  map_size = 0;
+}
+
+Checkpointer::Checkpointer(const string &file, int every)
+    : file(file), every(every), count(0) {
+  writer = std::thread([this]() { writer_loop(); });
+}
+
+Checkpointer::~Checkpointer() {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    done = true;
+  }
+  cv.notify_one();
+  writer.join();
+}
+
+// Copy the weights of m into the snapshot if the writer is idle
+void Checkpointer::offer(const Model &model, long iteration) {
+  if (every <= 0 || iteration % every) return;
+  std::unique_lock<std::mutex> lock(m, std::try_to_lock);
+  if (!lock.owns_lock() || pending) {
+    skip++;
+    return;
+  }
+
+  snapshot.loss = model.loss;
+  snapshot.layers.resize(model.layers.size());
+  for (size_t i = 0; i < model.layers.size(); i++) {
+    const Layer &from = model.layers[i];
+    Layer &to = snapshot.layers[i];
+    to.activation = from.activation;
+    to.type = from.type;
+    to.in_c = from.in_c;
+    to.in_h = from.in_h;
+    to.in_w = from.in_w;
+    to.out_c = from.out_c;
+    to.out_h = from.out_h;
+    to.out_w = from.out_w;
+    to.size = from.size;
+    to.stride = from.stride;
+    to.pad = from.pad;
+    if (to.w.rows != from.w.rows || to.w.cols != from.w.cols) {
+      to.w = Matrix(from.w.rows, from.w.cols);
+      to.v = Matrix(from.w.rows, from.w.cols);
+    }
+    memcpy(to.w.data, from.w.data, sizeof(double) * from.w.rows * from.w.cols);
+    if (from.v.rows) memcpy(to.v.data, from.v.data, sizeof(double) * from.v.rows * from.v.cols);
+  }
+  snapshot_iter = iteration;
+  pending = true;
+  lock.unlock();
+  cv.notify_one();
+}
+
+void Checkpointer::writer_loop() {
+  std::unique_lock<std::mutex> lock(m);
+  while (true) {
+    cv.wait(lock, [this]() { return pending || done; });
+    if (!pending) break;
+    // the snapshot is only touched by offer() while pending is false,
+    // so it can be written without holding the lock
+    lock.unlock();
+    if (save_checkpoint(snapshot, file, snapshot_iter)) count++;
+    lock.lock();
+    pending = false;
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "matrix.h"
+#include "neural.h"
+
+// Versioned binary checkpoint of a Model (see checkpoint.cpp for the layout):
+// layer topology, activations, loss type, weights and momentum buffers.
+
+// Write atomically: the checkpoint goes to file.tmp, is synced and then
+// renamed over file, so readers never see a partial checkpoint.
+bool save_checkpoint(const Model &m, const string &file, long iteration = 0);
+
+// Load a checkpoint into m, copying the weights. The model can be trained further.
+bool load_checkpoint(const string &file, Model &m, long *iteration = nullptr);
+
+// Zero-copy view of a checkpoint for evaluation jobs: the weight matrices of
+// `model` point straight into the memory-mapped file, so opening costs a
+// few page faults regardless of the model size.
+// The weights are copy-on-write; do NOT train or reassign Layer::w/v of a
+// mapped model. Copy the Model (or use load_checkpoint) to train it.
+struct MappedModel {
+  Model model;
+
+  MappedModel() = default;
+  ~MappedModel();
+  MappedModel(const MappedModel &) = delete;
+  MappedModel &operator=(const MappedModel &) = delete;
+
+  bool open(const string &file);
+  void close();
+
+ private:
+  void *map = nullptr;
+  size_t map_size = 0;
+};
+
+// Periodic checkpointing during Model::train.
+//
+// Every `every` iterations the training thread copies the weights into a
+// snapshot (a memcpy per layer) and hands it to a background writer thread.
+// If the previous checkpoint is still being written the snapshot is skipped,
+// so training never waits on the disk.
+struct Checkpointer {
+  Checkpointer(const string &file, int every);
+  ~Checkpointer();   // writes the last pending snapshot
+  Checkpointer(const Checkpointer &) = delete;
+  Checkpointer &operator=(const Checkpointer &) = delete;
+
+  // called by Model::train after every iteration
+  void offer(const Model &m, long iteration);
+
+  int written() const { return count; }
+  int skipped() const { return skip; }
+
+ private:
+  void writer_loop();
+
+  string file;
+  int every;
+  Model snapshot;
+  long snapshot_iter = 0;
+  bool pending = false;
+  bool done = false;
+  std::atomic<int> count;
+  int skip = 0;
+  std::mutex m;
+  std::condition_variable cv;
+  std::thread writer;
+};
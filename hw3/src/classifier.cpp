@@ -3,6 +3,10 @@
 
 #include "matrix.h"
 #include "neural.h"
+#include "inference.h"
+#include "checkpoint.h"
+#include "conv.h"
+#include "optimizer.h"
 
 bool verbose = false;
 
@@ -29,7 +33,16 @@ void debug_print(const char *name, const Matrix &m, int max_rows = 2, int max_co
 // const Matrix& in: input to layer
 // returns: matrix that is output before the activation layer
 Matrix forward_weights(const Layer &l, const Matrix &in) {
-  Matrix output = in * l.w;
+  if (l.type != DENSE) {
+    Matrix output(in.rows, l.outputs());
+    if (l.type == CONV) conv_forward(l, in, output);
+    else maxpool_forward(l, in, output);
+    return output;
+  }
+
+  Matrix output(in.rows, l.w.cols);
+  if (l.in_sparse.rows == in.rows) sparse_multiply_into(output, l.in_sparse, l.w);
+  else multiply_into(output, in, l.w);
 
   assert(output.rows == in.rows);
   assert(output.cols == l.w.cols);
@@ -64,9 +77,9 @@ Matrix Layer::forward(const Matrix &in) {
 
 
 // const Layer& l: the layer
-// const Matrix& grad_y: partial derivative of loss w.r.t. output of layer
+// Matrix grad_y: partial derivative of loss w.r.t. output of layer
 // returns: Matrix, partial derivative of loss w.r.t. input to (xw)
-Matrix backward_xw(const Layer &l, const Matrix &grad_y) {
+Matrix backward_xw(const Layer &l, Matrix grad_y) {
   
   // TODO (1.4.1): compute dL/d(xw) and return it
   // Hint:
@@ -75,7 +88,7 @@ Matrix backward_xw(const Layer &l, const Matrix &grad_y) {
   //           = dL/dy * df(xw)/d(xw)
   //           = dL/dy * f'(xw)
   // Hint: Use backward_activate_matrix in activations.cpp.
-  Matrix grad_xw = backward_activate_matrix(l.out2, grad_y, l.activation);
+  Matrix grad_xw = backward_activate_matrix(l.out2, move(grad_y), l.activation);
 
   return grad_xw;
 }
@@ -87,6 +100,10 @@ Matrix backward_w(const Layer &l) {
   // TODO (1.4.2): then calculate dL/dw and return it
   // Hint:
   //  dL/dw = d(xw)/dw * dL/d(xw) = x * dL/d(xw)
+  if (l.type == CONV) return conv_backward_w(l, l.in, l.grad_out1);
+  if (l.type == MAXPOOL) return Matrix();
+
+  if (l.in_sparse.rows == l.in.rows) return sparse_transpose_multiply(l.in_sparse, l.grad_out1);
   Matrix grad_w = l.in.transpose() * l.grad_out1;
   
   assert_same_size(grad_w, l.w);
@@ -98,16 +115,18 @@ Matrix backward_w(const Layer &l) {
 Matrix backward_x(const Layer &l) {
   // Get the relevant quantities from the layer (see forward() and backward() function for reference)
   // TODO (1.4.3): finally, calculate dL/dx and return it
+  if (l.type == CONV) return conv_backward_x(l, l.grad_out1);
+  if (l.type == MAXPOOL) return maxpool_backward_x(l, l.in, l.grad_out1);
+
   Matrix grad_x = l.grad_out1* l.w.transpose();
   assert_same_size(grad_x, l.in);
   return grad_x;
 }
 
 // READ THIS FUNCTION
-// BUT DO NOT MODIFY
-Matrix Layer::backward(const Matrix &grad_y) {
+Matrix Layer::backward(Matrix grad_y) {
   Layer &l = *this;
-  grad_out1 = backward_xw(l, grad_y);
+  grad_out1 = backward_xw(l, move(grad_y));
   grad_w = backward_w(l);
   grad_in = backward_x(l);
   return grad_in;
@@ -141,6 +160,15 @@ Layer::Layer(int input, int output, Activation activation)
 
 }
 
+// Layer Constructor, initialized from the generator rng
+Layer::Layer(int input, int output, Activation activation, std::mt19937 &rng)
+    : w(random_matrix(input, output, rng) * sqrt(2. / input)),
+      grad_w(input, output),
+      v(input, output),
+      activation(activation) {
+
+}
+
 // DO NOT MODIFY.
 // Run a model on input X
 // Model& m: model to run
@@ -153,13 +181,12 @@ Matrix Model::forward(Matrix X) {
   return X;
 }
 
-// DO NOT MODIFY.
 // Run a model backward given gradient dL
 // Model& m: model to run
 // Matrix grad: partial derivative of loss w.r.t. model output dL/dy
 void Model::backward(Matrix grad) {
   for (int i = (int) layers.size() - 1; i >= 0; i--) {
-    grad = layers[i].backward(grad);
+    grad = layers[i].backward(move(grad));
   }
 }
 
@@ -198,13 +225,17 @@ double Model::accuracy2(const Data &d, const Matrix &p) {
   return (double) correct / d.y.rows;
 }
 
-// DO NOT MODIFY.
 // Calculate the accuracy of a model on some data d
+// Runs the forward-only InferenceEngine: no training caches, chunked and parallel
 // const Data& d: data to run on
 // returns: accuracy, number correct / total
 double Model::accuracy(const Data &d) {
-  Matrix p = this->forward(d.X);
-  return accuracy2(d, p);
+  return InferenceEngine(*this).accuracy(d);
+}
+
+// Same as above, for a dataset store
+double Model::accuracy(const DataStore &d) {
+  return InferenceEngine(*this).accuracy(d);
 }
 
 // DO NOT MODIFY.
@@ -286,7 +317,68 @@ Matrix Model::loss_derivative(const Matrix &y, const Matrix &p)
   }
 
 
-// DO NOT MODIFY.
+// Run one SGD step on a batch (the weights are updated by the fused SGD of optimizer.h)
+// const Data& batch: batch to train on
+// double rate: learning rate
+// double momentum: momentum
+// double decay: weight decay
+// double* accuracy: if not null receives the batch accuracy
+// returns: the batch loss (before the update)
+double Model::train_batch(const Data &batch, double rate, double momentum, double decay, double *accuracy) {
+  Optimizer opt = sgd_optimizer(rate, momentum, decay);
+  return train_batch(batch, opt, accuracy);
+}
+
+// Same as above, the weights are updated by an Optimizer
+// Same as forward() and backward(), with every layer timed by the profiler
+double Model::train_batch(const Data &batch, Optimizer &opt, double *accuracy) {
+  // A mostly-zero batch feeds a dense first layer through the sparse kernels
+  if (!layers.empty() && layers[0].type == DENSE && sparse_max_density > 0)
+    layers[0].in_sparse = to_sparse(batch.X, sparse_max_density);
+
+  Matrix y = batch.X;
+  for (int i = 0; i < (int) layers.size(); i++) {
+    ProfileScope scope("forward", i);
+    y = layers[i].forward(y);
+  }
+
+  double loss;
+  Matrix dLoss;
+  {
+    ProfileScope scope("loss");
+    loss = this->compute_loss(batch.y, y);
+    if (accuracy) *accuracy = this->accuracy2(batch, y);
+
+    // partial derivative of loss dL/dprob
+    dLoss = this->loss_derivative(batch.y, y) / batch.X.rows;
+  }
+
+  for (int i = (int) layers.size() - 1; i > 0; i--) {
+    ProfileScope scope("backward", i);
+    dLoss = layers[i].backward(move(dLoss));
+  }
+  // Nothing consumes dL/dx of the first layer: only compute its dL/dw
+  if (!layers.empty()) {
+    ProfileScope scope("backward", 0);
+    Layer &l = layers[0];
+    l.grad_out1 = backward_xw(l, move(dLoss));
+    l.grad_w = backward_w(l);
+    l.in_sparse = SparseMatrix();
+  }
+  opt.step(*this);
+  return loss;
+}
+
+// One iteration of Model::train: step, progress print and checkpoint
+static void train_iteration(Model &m, const Data &batch, int iter, Optimizer &opt, Checkpointer *checkpoint) {
+  if (iter % 100 == 5) {
+    double accu = 0;
+    double loss = m.train_batch(batch, opt, &accu);
+    printf("Iteration: %6d: Loss: %12.6lf   Batch Accuracy: %8.3lf \n", iter, loss, accu);
+  } else m.train_batch(batch, opt);
+  if (checkpoint) checkpoint->offer(m, iter + 1);
+}
+
 // Train a model on a dataset using SGD
 // Data& d: dataset to train on
 // int batch_size: batch size for SGD
@@ -294,24 +386,46 @@ Matrix Model::loss_derivative(const Matrix &y, const Matrix &p)
 // double rate: learning rate
 // double momentum: momentum
 // double decay: weight decay
-void Model::train(const Data &data, int batch_size, int iters, double rate, double momentum, double decay) {
-  for (int iter = 0; iter < iters; iter++) {
-    Data batch = data.random_batch(batch_size);
+// Checkpointer* checkpoint: if not null, weights are periodically saved in the background
+void Model::train(const Data &data, int batch_size, int iters, double rate, double momentum, double decay,
+                  Checkpointer *checkpoint) {
+  Optimizer opt = sgd_optimizer(rate, momentum, decay);
+  train(data, batch_size, iters, opt, checkpoint);
+}
 
-    Matrix y = this->forward(batch.X);
+// Same as above, batches are gathered from a memory-mapped dataset store
+void Model::train(const DataStore &data, int batch_size, int iters, double rate, double momentum, double decay,
+                  Checkpointer *checkpoint) {
+  Optimizer opt = sgd_optimizer(rate, momentum, decay);
+  train(data, batch_size, iters, opt, checkpoint);
+}
 
-    double loss = this->compute_loss(batch.y, y);
-    double accu = this->accuracy2(batch, y);
-    
-    if (iter % 100 == 5) printf("Iteration: %6d: Loss: %12.6lf   Batch Accuracy: %8.3lf \n", iter, loss, accu);
-    
-    // partial derivative of loss dL/dprob
-    Matrix dLoss=this->loss_derivative(batch.y, y)/batch_size;
-    
-    this->backward(dLoss);
-    this->update_weights(rate, momentum, decay);
+// Train with any optimizer (see optimizer.h)
+void Model::train(const Data &data, int batch_size, int iters, Optimizer &opt, Checkpointer *checkpoint) {
+  for (int iter = 0; iter < iters; iter++) {
+    ProfileScope scope("iteration");
+    Data batch;
+    {
+      ProfileScope assembly("batch");
+      batch = data.random_batch(batch_size);
+    }
+    train_iteration(*this, batch, iter, opt, checkpoint);
+  }
+}
+
+void Model::train(const DataStore &data, int batch_size, int iters, Optimizer &opt, Checkpointer *checkpoint) {
+  for (int iter = 0; iter < iters; iter++) {
+    ProfileScope scope("iteration");
+    Data batch;
+    {
+      ProfileScope assembly("batch");
+      batch = data.random_batch(batch_size);
+    }
+    train_iteration(*this, batch, iter, opt, checkpoint);
   }
 }
 
 //////////////////////////////// C++ class member functions
-void Layer::update_weights(double rate, double momentum, double decay) { update_layer(*this, rate, momentum, decay); }
+void Layer::update_weights(double rate, double momentum, double decay) {
+  if (type != MAXPOOL) update_layer(*this, rate, momentum, decay);   // pooling has no weights
+}
@@ -0,0 +1,240 @@
+#include <cmath>
+#include <cstring>
+
+#include "conv.h"
+
+// Target size of the im2col buffer of one block of samples
+static const size_t COL_BYTES = 1 << 20;
+
+Layer conv_layer(int c, int h, int w, int filters, int size, int stride, int pad, Activation activation) {
+  assert(size > 0 && stride > 0 && pad >= 0);
+  assert(h + 2 * pad >= size && w + 2 * pad >= size);
+  int k = c * size * size;
+  Layer l(k, filters, activation);
+  l.type = CONV;
+  l.in_c = c;
+  l.in_h = h;
+  l.in_w = w;
+  l.out_c = filters;
+  l.out_h = (h + 2 * pad - size) / stride + 1;
+  l.out_w = (w + 2 * pad - size) / stride + 1;
+  l.size = size;
+  l.stride = stride;
+  l.pad = pad;
+  return l;
+}
+
+Layer maxpool_layer(int c, int h, int w, int size, int stride) {
+  assert(size > 0 && stride > 0 && h >= size && w >= size);
+  Layer l;
+  l.activation = LINEAR;
+  l.type = MAXPOOL;
+  l.in_c = l.out_c = c;
+  l.in_h = h;
+  l.in_w = w;
+  l.out_h = (h - size) / stride + 1;
+  l.out_w = (w - size) / stride + 1;
+  l.size = size;
+  l.stride = stride;
+  return l;
+}
+
+// Samples per im2col block
+static int block_samples(const Layer &l) {
+  size_t per_sample = sizeof(double) * l.w.rows * l.out_h * l.out_w;
+  return (int) max<size_t>(1, COL_BYTES / per_sample);
+}
+
+// Unfold samples [n0, n0+nb) of `in` into col, one row per (c, ky, kx)
+// and one column per (sample, oy, ox). col must have room for nb samples.
+static void im2col(const Layer &l, const Matrix &in, int n0, int nb, Matrix &col) {
+  int P = l.out_h * l.out_w;
+  col.cols = nb * P;
+  for (int c = 0; c < l.in_c; c++)
+    for (int ky = 0; ky < l.size; ky++)
+      for (int kx = 0; kx < l.size; kx++) {
+        double *dst = col[(c * l.size + ky) * l.size + kx];
+        for (int b = 0; b < nb; b++) {
+          const double *src = in[n0 + b] + size_t(c) * l.in_h * l.in_w;
+          for (int oy = 0; oy < l.out_h; oy++, dst += l.out_w) {
+            int iy = oy * l.stride - l.pad + ky;
+            if (iy < 0 || iy >= l.in_h) {
+              memset(dst, 0, sizeof(double) * l.out_w);
+              continue;
+            }
+            const double *row = src + iy * l.in_w;
+            for (int ox = 0; ox < l.out_w; ox++) {
+              int ix = ox * l.stride - l.pad + kx;
+              dst[ox] = ix >= 0 && ix < l.in_w ? row[ix] : 0.;
+            }
+          }
+        }
+      }
+}
+
+// Inverse of im2col, accumulating into samples [n0, n0+nb) of grad_in
+static void col2im(const Layer &l, const Matrix &col, int n0, int nb, Matrix &grad_in) {
+  for (int c = 0; c < l.in_c; c++)
+    for (int ky = 0; ky < l.size; ky++)
+      for (int kx = 0; kx < l.size; kx++) {
+        const double *src = col[(c * l.size + ky) * l.size + kx];
+        for (int b = 0; b < nb; b++) {
+          double *dst = grad_in[n0 + b] + size_t(c) * l.in_h * l.in_w;
+          for (int oy = 0; oy < l.out_h; oy++, src += l.out_w) {
+            int iy = oy * l.stride - l.pad + ky;
+            if (iy < 0 || iy >= l.in_h) continue;
+            double *row = dst + iy * l.in_w;
+            for (int ox = 0; ox < l.out_w; ox++) {
+              int ix = ox * l.stride - l.pad + kx;
+              if (ix >= 0 && ix < l.in_w) row[ix] += src[ox];
+            }
+          }
+        }
+      }
+}
+
+void conv_forward(const Layer &l, const Matrix &in, Matrix &out) {
+  if (l.size == 3 && l.stride == 1 && l.in_c <= 3) conv_forward_direct3x3(l, in, out);
+  else conv_forward_im2col(l, in, out);
+}
+
+void conv_forward_im2col(const Layer &l, const Matrix &in, Matrix &out) {
+  assert(l.type == CONV && in.cols == l.inputs());
+  assert(out.rows == in.rows && out.cols == l.outputs());
+  int P = l.out_h * l.out_w, F = l.out_c;
+  int B = block_samples(l);
+
+  Matrix wt = l.w.transpose();   // F x (c*size*size)
+  Matrix col(l.w.rows, B * P);
+  Matrix y(F, B * P);
+  for (int n0 = 0; n0 < in.rows; n0 += B) {
+    int nb = min(B, in.rows - n0);
+    im2col(l, in, n0, nb, col);
+    y.cols = nb * P;
+    multiply_into(y, wt, col);
+    // y is F x (sample, pixel), the output is sample x (F, pixel)
+    for (int f = 0; f < F; f++)
+      for (int b = 0; b < nb; b++)
+        memcpy(out[n0 + b] + size_t(f) * P, y[f] + size_t(b) * P, sizeof(double) * P);
+  }
+}
+
+void conv_forward_direct3x3(const Layer &l, const Matrix &in, Matrix &out) {
+  assert(l.type == CONV && l.size == 3 && l.stride == 1);
+  assert(in.cols == l.inputs() && out.rows == in.rows && out.cols == l.outputs());
+  int P = l.out_h * l.out_w;
+  // output columns where all three taps of a filter row are inside the input
+  int lo = max(0, l.pad), hi = min(l.out_w, l.in_w + l.pad - 2);
+  for (int n = 0; n < in.rows; n++)
+    for (int f = 0; f < l.out_c; f++) {
+      double *o = out[n] + size_t(f) * P;
+      memset(o, 0, sizeof(double) * P);
+      for (int c = 0; c < l.in_c; c++) {
+        const double *src = in[n] + size_t(c) * l.in_h * l.in_w;
+        for (int ky = 0; ky < 3; ky++) {
+          const double w0 = l.w((c * 3 + ky) * 3, f);
+          const double w1 = l.w((c * 3 + ky) * 3 + 1, f);
+          const double w2 = l.w((c * 3 + ky) * 3 + 2, f);
+          for (int oy = 0; oy < l.out_h; oy++) {
+            int iy = oy - l.pad + ky;
+            if (iy < 0 || iy >= l.in_h) continue;
+            const double *row = src + iy * l.in_w;
+            double *dst = o + oy * l.out_w;
+            for (int ox = lo; ox < hi; ox++)
+              dst[ox] += w0 * row[ox - l.pad] + w1 * row[ox - l.pad + 1] + w2 * row[ox - l.pad + 2];
+            // border columns [0,lo) and [hi,out_w), tap by tap
+            auto border = [&](int ox) {
+              int ix = ox - l.pad;
+              if (ix >= 0 && ix < l.in_w) dst[ox] += w0 * row[ix];
+              if (ix + 1 >= 0 && ix + 1 < l.in_w) dst[ox] += w1 * row[ix + 1];
+              if (ix + 2 >= 0 && ix + 2 < l.in_w) dst[ox] += w2 * row[ix + 2];
+            };
+            for (int ox = 0; ox < min(lo, l.out_w); ox++) border(ox);
+            for (int ox = max(lo, hi); ox < l.out_w; ox++) border(ox);
+          }
+        }
+      }
+    }
+}
+
+Matrix conv_backward_w(const Layer &l, const Matrix &in, const Matrix &grad_out) {
+  assert(grad_out.rows == in.rows && grad_out.cols == l.outputs());
+  int P = l.out_h * l.out_w, F = l.out_c;
+  int B = block_samples(l);
+
+  Matrix grad_w(l.w.rows, l.w.cols);
+  Matrix col(l.w.rows, B * P);
+  Matrix gt(B * P, F);
+  Matrix part(l.w.rows, F);
+  for (int n0 = 0; n0 < in.rows; n0 += B) {
+    int nb = min(B, in.rows - n0);
+    im2col(l, in, n0, nb, col);
+    gt.rows = nb * P;
+    for (int b = 0; b < nb; b++)
+      for (int f = 0; f < F; f++) {
+        const double *g = grad_out[n0 + b] + size_t(f) * P;
+        for (int p = 0; p < P; p++) gt(b * P + p, f) = g[p];
+      }
+    multiply_into(part, col, gt);
+    for (int i = 0; i < grad_w.rows * grad_w.cols; i++) grad_w.data[i] += part.data[i];
+  }
+  return grad_w;
+}
+
+Matrix conv_backward_x(const Layer &l, const Matrix &grad_out) {
+  assert(grad_out.cols == l.outputs());
+  int P = l.out_h * l.out_w, F = l.out_c;
+  int B = block_samples(l);
+
+  Matrix grad_in(grad_out.rows, l.inputs());
+  Matrix g(F, B * P);
+  Matrix col(l.w.rows, B * P);
+  for (int n0 = 0; n0 < grad_out.rows; n0 += B) {
+    int nb = min(B, grad_out.rows - n0);
+    g.cols = col.cols = nb * P;
+    for (int f = 0; f < F; f++)
+      for (int b = 0; b < nb; b++)
+        memcpy(g[f] + size_t(b) * P, grad_out[n0 + b] + size_t(f) * P, sizeof(double) * P);
+    multiply_into(col, l.w, g);
+    col2im(l, col, n0, nb, grad_in);
+  }
+  return grad_in;
+}
+
+void maxpool_forward(const Layer &l, const Matrix &in, Matrix &out) {
+  assert(l.type == MAXPOOL && in.cols == l.inputs());
+  assert(out.rows == in.rows && out.cols == l.outputs());
+  for (int n = 0; n < in.rows; n++)
+    for (int c = 0; c < l.in_c; c++) {
+      const double *src = in[n] + size_t(c) * l.in_h * l.in_w;
+      double *dst = out[n] + size_t(c) * l.out_h * l.out_w;
+      for (int oy = 0; oy < l.out_h; oy++)
+        for (int ox = 0; ox < l.out_w; ox++) {
+          const double *win = src + oy * l.stride * l.in_w + ox * l.stride;
+          double m = win[0];
+          for (int ky = 0; ky < l.size; ky++)
+            for (int kx = 0; kx < l.size; kx++) m = max(m, win[ky * l.in_w + kx]);
+          dst[oy * l.out_w + ox] = m;
+        }
+    }
+}
+
+Matrix maxpool_backward_x(const Layer &l, const Matrix &in, const Matrix &grad_out) {
+  assert(grad_out.rows == in.rows && grad_out.cols == l.outputs());
+  Matrix grad_in(in.rows, in.cols);
+  for (int n = 0; n < in.rows; n++)
+    for (int c = 0; c < l.in_c; c++) {
+      const double *src = in[n] + size_t(c) * l.in_h * l.in_w;
+      const double *g = grad_out[n] + size_t(c) * l.out_h * l.out_w;
+      double *dst = grad_in[n] + size_t(c) * l.in_h * l.in_w;
+      for (int oy = 0; oy < l.out_h; oy++)
+        for (int ox = 0; ox < l.out_w; ox++) {
+          int base = oy * l.stride * l.in_w + ox * l.stride, best = base;
+          for (int ky = 0; ky < l.size; ky++)
+            for (int kx = 0; kx < l.size; kx++)
+              if (src[base + ky * l.in_w + kx] > src[best]) best = base + ky * l.in_w + kx;
+          dst[best] += g[oy * l.out_w + ox];
+        }
+    }
+  return grad_in;
+}
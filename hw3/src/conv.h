@@ -0,0 +1,27 @@
+#pragma once
+
+#include "matrix.h"
+#include "neural.h"
+
+// Convolution and max pooling for CONV and MAXPOOL layers.
+//
+// A batch is a Matrix with one sample per row, each sample stored channel
+// by channel (CHW), so a CONV layer's output feeds the next layer as is.
+// Convolution runs as im2col + GEMM over blocks of samples sized to keep
+// the column buffer in cache; 3x3 stride 1 filters over few channels use a
+// direct kernel, where the GEMM would be too thin to pay for the im2col.
+//
+// The `out` matrices must already be shaped in.rows x l.outputs().
+
+void conv_forward(const Layer &l, const Matrix &in, Matrix &out);
+void conv_forward_im2col(const Layer &l, const Matrix &in, Matrix &out);
+void conv_forward_direct3x3(const Layer &l, const Matrix &in, Matrix &out);
+
+// dL/dw given the layer input and dL/d(out1)
+Matrix conv_backward_w(const Layer &l, const Matrix &in, const Matrix &grad_out);
+// dL/dx given dL/d(out1)
+Matrix conv_backward_x(const Layer &l, const Matrix &grad_out);
+
+void maxpool_forward(const Layer &l, const Matrix &in, Matrix &out);
+// dL/dx: the gradient of every output goes to the (first) maximum of its window
+Matrix maxpool_backward_x(const Layer &l, const Matrix &in, const Matrix &grad_out);
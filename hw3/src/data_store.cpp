@@ -0,0 +1,253 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "matrix.h"
+#include "neural.h"
+#include "utils.h"
+
+// On-disk layout of a preprocessed dataset store:
+//   StoreHeader | N labels (uint8) | padding | N*size_x pixels (uint8)
+// Pixels start on a page boundary so rows can be mapped directly.
+static const char STORE_MAGIC[8] = {'C', 'S', 'E', '5', '7', '6', 'D', 'S'};
+static const uint32_t STORE_VERSION = 1;
+static const uint64_t STORE_ALIGN = 4096;
+
+struct StoreHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t N;
+  int32_t size_x;
+  int32_t size_y;
+  uint64_t label_offset;
+  uint64_t pixel_offset;
+};
+
+static uint64_t align_up(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
+// Write a dataset store atomically (to file.tmp, then rename over file)
+// const string& file: output store
+// int N, size_x, size_y: number of samples, pixels per sample, number of classes
+// const unsigned char* labels: N class indices
+// const unsigned char* pixels: N*size_x raw pixel bytes
+void write_store(const std::string &file, int N, int size_x, int size_y,
+                 const unsigned char *labels, const unsigned char *pixels) {
+  StoreHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, STORE_MAGIC, sizeof(h.magic));
+  h.version = STORE_VERSION;
+  h.N = N;
+  h.size_x = size_x;
+  h.size_y = size_y;
+  h.label_offset = sizeof(StoreHeader);
+  h.pixel_offset = align_up(h.label_offset + (uint64_t) N, STORE_ALIGN);
+
+  std::string tmp = file + ".tmp";
+  FILE *fn = fopen(tmp.c_str(), "wb");
+  if (fn == nullptr) {
+    printf("Cannot write dataset store \"%s\"\n", tmp.c_str());
+    exit(-1);
+  }
+  std::vector<unsigned char> pad(h.pixel_offset - h.label_offset - N, 0);
+  bool ok = fwrite(&h, sizeof(h), 1, fn) == 1;
+  ok = ok && fwrite(labels, 1, N, fn) == size_t(N);
+  ok = ok && (pad.empty() || fwrite(pad.data(), 1, pad.size(), fn) == pad.size());
+  ok = ok && fwrite(pixels, 1, size_t(N) * size_x, fn) == size_t(N) * size_x;
+  ok = (fclose(fn) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+    printf("Failed writing dataset store \"%s\"\n", file.c_str());
+    remove(tmp.c_str());
+    exit(-1);
+  }
+}
+
+// Convert the MNIST idx files into a dataset store
+void convert_mnist(const std::string &image_file, const std::string &label_file, const std::string &store_file) {
+  std::vector<unsigned char> image_data = read_file(image_file);
+  std::vector<unsigned char> label_data = read_file(label_file);
+
+  int N = (int) label_data.size() - 8;
+  assert((int) ((image_data.size() - 16) / (28 * 28)) == N);
+
+  write_store(store_file, N, 28 * 28, 10, &label_data[8], &image_data[16]);
+}
+
+// Convert one or more CIFAR binary batches into a single dataset store.
+// Valid (dataset, labels) combos are the same as for read_cifar.
+void convert_cifar(const std::vector<std::string> &files, int dataset, int labels, const std::string &store_file) {
+  assert((dataset == 10 && labels == 10) ||
+      (dataset == 100 && labels == 20) ||
+      (dataset == 100 && labels == 100));
+
+  int skip = dataset == 10 ? 3073 : 3074;
+  int offset = dataset == 10 ? 1 : 2;
+  int label_offset = offset - 1 - (dataset != labels);
+
+  std::vector<unsigned char> label_bytes;
+  std::vector<unsigned char> pixel_bytes;
+  for (auto &file:files) {
+    std::vector<unsigned char> data = read_file(file);
+    int n = (int) data.size() / skip;
+    for (int q1 = 0; q1 < n; q1++) {
+      const unsigned char *ptr = &data[size_t(q1) * skip];
+      label_bytes.push_back(ptr[label_offset]);
+      pixel_bytes.insert(pixel_bytes.end(), ptr + offset, ptr + offset + 3072);
+    }
+  }
+
+  write_store(store_file, (int) label_bytes.size(), 3072, labels, label_bytes.data(), pixel_bytes.data());
+}
+
+DataStore::~DataStore() { close(); }
+
+DataStore::DataStore(DataStore &&from) { *this = move(from); }
+
+DataStore &DataStore::operator=(DataStore &&from) {
+  if (this == &from)return *this;
+  close();
+  N = from.N;
+  size_x = from.size_x;
+  size_y = from.size_y;
+  labels = from.labels;
+  pixels = from.pixels;
+  map = from.map;
+  map_size = from.map_size;
+  mt = from.mt;
+  from.labels = from.pixels = nullptr;
+  from.map = nullptr;
+  from.map_size = 0;
+  from.N = 0;
+  return *this;
+}
+
+void DataStore::close() {
+  if (map)munmap(map, map_size);
+  map = nullptr;
+  map_size = 0;
+  labels = pixels = nullptr;
+  N = 0;
+}
+
+// Map a dataset store read-only. Nothing is copied: pages are
+// faulted in on first use by gather().
+// returns: false if the file is missing or is not a valid store
+bool DataStore::open(const std::string &file) {
+  close();
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0)return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(StoreHeader)) {
+    ::close(fd);
+    return false;
+  }
+
+  void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (ptr == MAP_FAILED)return false;
+
+  const StoreHeader &h = *(const StoreHeader *) ptr;
+  uint64_t need = h.pixel_offset + uint64_t(h.N) * h.size_x;
+  if (memcmp(h.magic, STORE_MAGIC, sizeof(h.magic)) != 0 || h.version != STORE_VERSION || need > (uint64_t) st.st_size) {
+    printf("\"%s\" is not a valid dataset store (version %u)\n", file.c_str(), STORE_VERSION);
+    munmap(ptr, st.st_size);
+    return false;
+  }
+
+  map = ptr;
+  map_size = st.st_size;
+  N = h.N;
+  size_x = h.size_x;
+  size_y = h.size_y;
+  labels = (const unsigned char *) ptr + h.label_offset;
+  pixels = (const unsigned char *) ptr + h.pixel_offset;
+  return true;
+}
+
+// Gather rows of the store into a float batch, normalizing pixels to [0,1]
+// const int* index: sample indices
+// int n: number of samples
+// returns: Data with n rows
+Data DataStore::gather(const int *index, int n) const {
+  Data res(n, size_x, size_y);
+  const T scale = T(1) / T(255);
+
+  for (int q1 = 0; q1 < n; q1++) {
+    assert(index[q1] >= 0 && index[q1] < N);
+    const unsigned char *src = pixels + size_t(index[q1]) * size_x;
+    double *dst = res.X[q1];
+    for (int q2 = 0; q2 < size_x; q2++)dst[q2] = src[q2] * scale;
+    res.y(q1, labels[index[q1]]) = T(1);
+  }
+
+  return res;
+}
+
+// Gather the contiguous rows [start, start+n)
+Data DataStore::range(int start, int n) const {
+  std::vector<int> index(n);
+  for (int q1 = 0; q1 < n; q1++)index[q1] = start + q1;
+  return gather(index.data(), n);
+}
+
+// Normalize the contiguous rows [start, start+n) into a preallocated
+// n x size_x row-major buffer (no labels)
+void DataStore::range_into(int start, int n, double *X) const {
+  assert(start >= 0 && start + n <= N);
+  const T scale = T(1) / T(255);
+  const unsigned char *src = pixels + size_t(start) * size_x;
+  for (size_t q1 = 0; q1 < size_t(n) * size_x; q1++)X[q1] = src[q1] * scale;
+}
+
+Data DataStore::random_batch(int batch_size) const { return random_batch(batch_size, mt); }
+
+Data DataStore::random_batch(int batch_size, std::mt19937 &rng, int rows) const {
+  assert(rows >= 0 && rows <= N);
+  unsigned n = unsigned(rows > 0 ? rows : N);
+  std::vector<int> index(batch_size);
+  for (auto &e1:index)e1 = int(rng() % n);
+  return gather(index.data(), batch_size);
+}
+
+// Open a dataset store, building it first with convert() if it does not exist yet
+// const string& file: store file
+// convert: called with the store file name to create it
+DataStore open_store(const std::string &file, const std::function<void(const std::string &)> &convert) {
+  DataStore store;
+  if (!store.open(file)) {
+    printf("Building dataset store \"%s\"\n", file.c_str());
+    convert(file);
+    if (!store.open(file)) {
+      printf("Cannot open dataset store \"%s\"\n", file.c_str());
+      exit(-1);
+    }
+  }
+  return store;
+}
+
+// Preprocessed uint8 stores, built once from the original files on first use
+StoreDataset get_mnist_store(void) {
+  return {open_store("mnist/mnist-train.store", [](const string &f) {
+            convert_mnist("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte", f);
+          }),
+          open_store("mnist/mnist-test.store", [](const string &f) {
+            convert_mnist("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte", f);
+          })};
+}
+
+StoreDataset get_cifar10_store(void) {
+  return {open_store("cifar/cifar10-train.store", [](const string &f) {
+            vector<string> files;
+            for (int q1 = 1; q1 <= 5; q1++)
+              files.push_back("cifar/cifar-10-batches-bin/data_batch_" + to_string(q1) + ".bin");
+            convert_cifar(files, 10, 10, f);
+          }),
+          open_store("cifar/cifar10-test.store", [](const string &f) {
+            convert_cifar({"cifar/cifar-10-batches-bin/test_batch.bin"}, 10, 10, f);
+          })};
+}
@@ -0,0 +1,35 @@
+#include <chrono>
+
+#include "matrix.h"
+#include "neural.h"
+#include "inference.h"
+#include "checkpoint.h"
+
+// Evaluate a saved checkpoint on a test set.
+//
+// USAGE: ./evaluate model.ckpt [mnist|cifar10] [threads=0]
+// The checkpoint is memory-mapped (MappedModel), nothing is parsed or copied
+// before the first batch runs.
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("USAGE: %s model.ckpt [mnist|cifar10] [threads]\n", argv[0]);
+    return -1;
+  }
+  string dataset = argc > 2 ? argv[2] : "cifar10";
+  int threads = argc > 3 ? atoi(argv[3]) : 0;
+
+  auto t0 = std::chrono::steady_clock::now();
+  MappedModel mapped;
+  if (!mapped.open(argv[1])) return -1;
+  double load = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  printf("Mapped %s (%d layers) in %.3lf ms\n", argv[1], (int) mapped.model.layers.size(), load * 1000);
+
+  StoreDataset d = dataset == "mnist" ? get_mnist_store() : get_cifar10_store();
+  if (mapped.model.layers.front().inputs() != d.test.size_x) {
+    printf("Checkpoint expects %d inputs, %s has %d\n", mapped.model.layers.front().inputs(), dataset.c_str(), d.test.size_x);
+    return -1;
+  }
+  printf("test accuracy:     %lf\n", InferenceEngine(mapped.model, 256, threads).accuracy(d.test));
+  return 0;
+}
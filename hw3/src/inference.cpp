@@ -0,0 +1,92 @@
+#include <cstring>
+
+#include "conv.h"
+#include "inference.h"
+
+// Run the model over n inputs, chunk by chunk
+// int n: number of input rows
+// int inputs: columns of the input
+// load: copies rows [begin,end) into the chunk buffer
+// consume: receives the model output for rows [begin,end)
+void InferenceEngine::run(int n, int inputs,
+                          const std::function<void(int, int, double *)> &load,
+                          const std::function<void(int, int, const Matrix &, int)> &consume) const {
+  assert(!model.layers.empty());
+  assert(model.layers[0].inputs() == inputs);
+
+  int width = inputs;
+  for (auto &l:model.layers) width = max(width, l.outputs());
+
+  int nthreads = threads > 0 ? threads : max(1u, std::thread::hardware_concurrency());
+  nthreads = max(1, min(nthreads, (n + chunk - 1) / chunk));
+
+  // Per-thread ping-pong buffers, sized for the widest layer. Their
+  // rows/cols are reshaped in place for every layer.
+  vector<Matrix> ping(nthreads), pong(nthreads);
+  for (int t = 0; t < nthreads; t++) {
+    ping[t] = Matrix(chunk, width);
+    pong[t] = Matrix(chunk, width);
+  }
+
+  parallel_chunks(n, chunk, nthreads, [&](int begin, int end, int t) {
+    Matrix *cur = &ping[t], *next = &pong[t];
+    cur->rows = end - begin;
+    cur->cols = inputs;
+    load(begin, end, cur->data);
+
+    for (auto &l:model.layers) {
+      next->rows = cur->rows;
+      next->cols = l.outputs();
+      if (l.type == CONV) conv_forward(l, *cur, *next);
+      else if (l.type == MAXPOOL) maxpool_forward(l, *cur, *next);
+      else multiply_into(*next, *cur, l.w);
+      activate_matrix_inplace(*next, l.activation);
+      swap(cur, next);
+    }
+    consume(begin, end, *cur, t);
+  });
+}
+
+// Run the model on input X
+// returns: predictions, one row per input row
+Matrix InferenceEngine::predict(const Matrix &X) const {
+  Matrix p(X.rows, model.layers.back().outputs());
+  run(X.rows, X.cols,
+      [&](int begin, int end, double *dst) {
+        memcpy(dst, X[begin], sizeof(double) * (end - begin) * X.cols);
+      },
+      [&](int begin, int end, const Matrix &out, int) {
+        memcpy(p[begin], out.data, sizeof(double) * (end - begin) * out.cols);
+      });
+  return p;
+}
+
+// Accuracy of the model on d, number correct / total
+double InferenceEngine::accuracy(const Data &d) const {
+  atomic<int> correct(0);
+  run(d.X.rows, d.X.cols,
+      [&](int begin, int end, double *dst) {
+        memcpy(dst, d.X[begin], sizeof(double) * (end - begin) * d.X.cols);
+      },
+      [&](int begin, int end, const Matrix &out, int) {
+        int c = 0;
+        for (int i = begin; i < end; i++)
+          c += max_index(d.y[i], d.y.cols) == max_index(out[i - begin], out.cols);
+        correct += c;
+      });
+  return d.X.rows ? (double) correct / d.X.rows : 0;
+}
+
+// Accuracy of the model on a dataset store, number correct / total
+double InferenceEngine::accuracy(const DataStore &d) const {
+  atomic<int> correct(0);
+  run(d.N, d.size_x,
+      [&](int begin, int end, double *dst) { d.range_into(begin, end - begin, dst); },
+      [&](int begin, int end, const Matrix &out, int) {
+        int c = 0;
+        for (int i = begin; i < end; i++)
+          c += d.labels[i] == max_index(out[i - begin], out.cols);
+        correct += c;
+      });
+  return d.N ? (double) correct / d.N : 0;
+}
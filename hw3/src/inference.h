@@ -0,0 +1,31 @@
+#pragma once
+
+#include "matrix.h"
+#include "neural.h"
+
+// Forward-only execution of a trained Model.
+//
+// Keeps none of the training caches (Layer::in/out1/out2): the input is
+// streamed in chunks of `chunk` rows through two preallocated ping-pong
+// buffers per thread, activations are applied in place, and chunks run in
+// parallel. Memory is O(threads * chunk * widest layer).
+//
+// The Model must not be modified while an engine is running on it.
+struct InferenceEngine {
+  const Model &model;
+  int chunk;
+  int threads;
+
+  InferenceEngine(const Model &model, int chunk = 256, int threads = 0)
+      : model(model), chunk(chunk), threads(threads) {}
+
+  Matrix predict(const Matrix &X) const;
+  double accuracy(const Data &d) const;
+  double accuracy(const DataStore &d) const;
+
+  // Low level driver: load(begin, end, X) fills the n x inputs chunk,
+  // consume(begin, end, P, thread) receives the n x outputs predictions
+  void run(int n, int inputs,
+           const std::function<void(int, int, double *)> &load,
+           const std::function<void(int, int, const Matrix &, int)> &consume) const;
+};
@@ -92,12 +92,25 @@ void gemm(Matrix& p, const Matrix &a, const Matrix &b)
 Matrix operator*(const Matrix &a, const Matrix &b) {
   double flops=double(a.rows)*double(a.cols)*double(b.cols);
   assert(a.cols == b.rows);
+  ProfileScope scope("gemm", -1, 2 * flops);
   Matrix p(a.rows, b.cols);
   if(flops>(1<<16))gemm_mt<40>(p,a,b);
   else gemm(p,a,b);
   return p;
 }
 
+void multiply_into(Matrix &c, const Matrix &a, const Matrix &b) {
+  double flops=double(a.rows)*double(a.cols)*double(b.cols);
+  assert(a.cols == b.rows);
+  assert(c.rows == a.rows && c.cols == b.cols);
+  ProfileScope scope("gemm", -1, 2 * flops);
+  if(flops>(1<<16))gemm_mt<40>(c,a,b);
+  else {
+    memset(c.data, 0, sizeof(double) * c.rows * c.cols);
+    gemm(c,a,b);
+  }
+}
+
 Matrix operator-(const Matrix &a, const Matrix &b) {
   assert(a.cols == b.cols);
   assert(a.rows == b.rows);
@@ -341,10 +354,16 @@ Matrix in_place_LUP(Matrix &m) {
 
 Matrix random_matrix(int rows, int cols) {
   static std::mt19937 mt;
+  return random_matrix(rows, cols, mt);
+}
+
+// The same from the caller's generator, for threads that initialize
+// concurrently and reproducibly
+Matrix random_matrix(int rows, int cols, std::mt19937 &rng) {
   Matrix m(rows, cols);
   for (int i = 0; i < rows; i++)
     for (int j = 0; j < cols; j++)
-      m(i, j) = (int(mt() % 1001u) - 500) / 500.0;
+      m(i, j) = (int(rng() % 1001u) - 500) / 500.0;
   return m;
 }
 
@@ -7,9 +7,12 @@
 #include <cmath>
 
 #include <algorithm>
+#include <random>
 #include <string>
 #include <vector>
 
+#include "memory_policy.h"
+#include "profiler.h"
 #include "utils.h"
 
 using namespace std;
@@ -23,12 +26,14 @@ struct Matrix {
   // constructor
   Matrix() = default;
   Matrix(int rows, int cols = 1) : rows(rows), cols(cols), data(nullptr) {
-    if (rows * cols)
-      data = (double *) calloc(rows * cols, sizeof(double));
+    if (rows * cols) {
+      data = (double *) memory_policy::allocate(sizeof(double) * rows * cols);
+      profile_alloc(sizeof(double) * rows * cols);
+    }
   }
 
   // destructor
-  ~Matrix() { free(data); }
+  ~Matrix() { memory_policy::release(data); }
 
   // copy constructor
   Matrix(const Matrix &a) : data(nullptr) { *this = a; }
@@ -41,12 +46,13 @@ struct Matrix {
     if (this == &a)return *this;
 
     if (data) {
-      free(data);
+      memory_policy::release(data);
       data = nullptr;
     }
     rows = a.rows;
     cols = a.cols;
-    data = (double *) calloc(rows * cols, sizeof(double));
+    data = (double *) memory_policy::allocate(sizeof(double) * rows * cols);
+    profile_alloc(sizeof(double) * rows * cols);
     memcpy(data, a.data, sizeof(double) * rows * cols);
     return *this;
   }
@@ -55,7 +61,7 @@ struct Matrix {
   Matrix &operator=(Matrix &&a) {
     if (this == &a)return *this;
 
-    if (data)free(data);
+    if (data) memory_policy::release(data);
 
     rows = a.rows;
     cols = a.cols;
@@ -124,6 +130,7 @@ Matrix elementwise_divide(const Matrix &a, const Matrix &b);
 Matrix elementwise_multiply(const Matrix &a, const Matrix &b);
 
 Matrix operator*(const Matrix &a, const Matrix &b); // Actual matrix/matrix matrix/vector product
+void multiply_into(Matrix &c, const Matrix &a, const Matrix &b); // c = a*b into preallocated c
 
 
 Matrix operator*(double scale, const Matrix &a);
@@ -137,6 +144,7 @@ Matrix LUP_solve(const Matrix &L, const Matrix &U, const Matrix &p, const Matrix
 Matrix matrix_invert(const Matrix &m);
 Matrix in_place_LUP(Matrix &m);
 Matrix random_matrix(int rows, int cols);
+Matrix random_matrix(int rows, int cols, std::mt19937 &rng);
 Matrix sle_solve(const Matrix &A, const Matrix &b);
 Matrix solve_system(const Matrix &M, const Matrix &b);
 void test_matrix(void);
@@ -0,0 +1,154 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <atomic>
+#include <new>
+#include <string>
+
+#include "memory_policy.h"
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace memory_policy {
+
+static const size_t HUGE_PAGE = 2 << 20;
+
+static Policy from_env() {
+  Policy p;
+  const char *huge = getenv("CSE576_HUGEPAGES");
+  p.huge_pages = huge && strcmp(huge, "0");
+  if (const char *env = getenv("CSE576_NUMA")) {
+    std::string v = env;
+    if (v == "interleave") p.placement = INTERLEAVE;
+    else if (v != "local")
+      fprintf(stderr, "memory_policy: unknown CSE576_NUMA=\"%s\" (local or interleave)\n", env);
+  }
+  return p;
+}
+
+// The policy packed in one word, bit 0 huge_pages and the placement above
+// it, so allocate() reads it without a lock and never sees half of an update
+static unsigned pack(const Policy &p) { return unsigned(p.huge_pages) | unsigned(p.placement) << 1; }
+static std::atomic<unsigned> current(pack(from_env()));
+
+Policy policy() {
+  unsigned v = current.load(std::memory_order_relaxed);
+  Policy p;
+  p.huge_pages = v & 1;
+  p.placement = Placement(v >> 1);
+  return p;
+}
+
+void set_policy(const Policy &p) { current.store(pack(p), std::memory_order_relaxed); }
+
+const char *placement_name(Placement p) {
+  static const char *names[] = {"local", "interleave"};
+  return p >= LOCAL && p <= INTERLEAVE ? names[p] : "unknown";
+}
+
+// the online nodes as a mask, e.g. "0-1,3" -> 0b1011
+static unsigned long online_nodes() {
+  unsigned long mask = 0;
+  FILE *fn = fopen("/sys/devices/system/node/online", "r");
+  if (!fn) return 1;
+  int a, b;
+  char sep;
+  while (fscanf(fn, "%d", &a) == 1) {
+    b = a;
+    if (fscanf(fn, "%c", &sep) == 1 && sep == '-' && fscanf(fn, "%d", &b) == 1) fscanf(fn, "%c", &sep);
+    for (int q1 = a; q1 <= b && q1 < (int) (8 * sizeof(mask)); q1++) mask |= 1ul << q1;
+  }
+  fclose(fn);
+  return mask ? mask : 1;
+}
+
+static unsigned long node_mask() {
+  static unsigned long mask = online_nodes();
+  return mask;
+}
+
+int numa_nodes() { return __builtin_popcountl(node_mask()); }
+
+bool huge_pages_supported() {
+  static bool supported = []() {
+    char buf[128] = "";
+    FILE *fn = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (!fn) return false;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fn);
+    buf[n] = 0;
+    fclose(fn);
+    return strstr(buf, "[always]") || strstr(buf, "[madvise]");
+  }();
+  return supported;
+}
+
+// Every block is preceded by the length of its mapping, 0 for a calloc
+// block, so release() needs no size: Matrix views shrink rows and cols of a
+// larger buffer in place
+struct Header {
+  size_t mapped;
+  size_t pad;      // 16 bytes keep calloc's alignment
+};
+static Header *header(void *block) { return (Header *) block - 1; }
+
+// Blocks start 0..COLORS-1 steps past a 2 MB boundary (and the header), in
+// turn: blocks at the same offset of their pages (physical offset too, with
+// huge pages) map their rows to the same cache sets, and loops walking
+// several of them in step evict each other. A step is a page and a cache
+// line, so the offsets differ in the L1 (virtual) and L2 (physical) set index.
+static const size_t COLOR_STEP = 4096 + 64;
+static const int COLORS = 15;
+static const size_t FIRST_OFFSET = 64;
+static std::atomic<unsigned> next_color(0);
+
+void *allocate(size_t bytes) {
+#ifdef __linux__
+  // only when the policy has something to do to the pages: a fresh mapping
+  // faults in again on every use, where calloc recycles freed blocks
+  Policy p = bytes >= LARGE_BYTES ? policy() : Policy();
+  if (p.huge_pages || p.placement != LOCAL) {
+    // map a huge page more and cut the pages out of it 2 MB aligned
+    size_t len = (FIRST_OFFSET + COLORS * COLOR_STEP + bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    char *raw = (char *) mmap(nullptr, len + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) throw std::bad_alloc();
+    char *pages = (char *) (((uintptr_t) raw + HUGE_PAGE - 1) & ~(uintptr_t) (HUGE_PAGE - 1));
+    if (pages > raw) munmap(raw, pages - raw);
+    size_t tail = raw + len + HUGE_PAGE - (pages + len);
+    if (tail) munmap(pages + len, tail);
+
+    if (p.huge_pages) madvise(pages, len, MADV_HUGEPAGE);
+    if (p.placement == INTERLEAVE && numa_nodes() > 1) {
+      unsigned long mask = node_mask();
+      syscall(SYS_mbind, pages, len, MPOL_INTERLEAVE, &mask, 8 * sizeof(mask), 0);
+    }
+    char *block = pages + FIRST_OFFSET + next_color++ % COLORS * COLOR_STEP;
+    header(block)->mapped = len;
+    return block;
+  }
+#endif
+  Header *h = (Header *) calloc(sizeof(Header) + bytes, 1);
+  if (!h) throw std::bad_alloc();
+  h->mapped = 0;
+  return h + 1;
+}
+
+void release(void *block) {
+  if (!block) return;
+  Header *h = header(block);
+#ifdef __linux__
+  if (h->mapped) {
+    munmap((void *) ((uintptr_t) block & ~(uintptr_t) (HUGE_PAGE - 1)), h->mapped);
+    return;
+  }
+#endif
+  free(h);
+}
+
+}
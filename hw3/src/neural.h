@@ -1,8 +1,10 @@
 #pragma once
 
 #include "matrix.h"
+#include "sparse.h"
 #include "utils.h"
 
+#include <functional>
 #include <vector>
 
 using namespace std;
@@ -10,6 +12,7 @@ using namespace std;
 
 enum Activation { LINEAR, LOGISTIC, TANH, RELU, LRELU, SOFTMAX };
 enum LossFunction { CROSS_ENTROPY, L2_LOSS, L1_LOSS };
+enum LayerType { DENSE, CONV, MAXPOOL };
 
 struct Layer {
   // Runtime Data terms
@@ -19,6 +22,7 @@ struct Layer {
   // Backpass saved terms
   Matrix grad_out1;
   Matrix grad_in;
+  SparseMatrix in_sparse; // CSR copy of `in` while training on a sparse batch, else empty
 
   // Weight and weight management
   Matrix w;               // Current weights for a layer
@@ -27,20 +31,37 @@ struct Layer {
 
   // Type
   Activation activation;  // Activation the layer uses
+  LayerType type = DENSE;
+
+  // Geometry of CONV and MAXPOOL layers (see conv.h). Every row of the
+  // input and output is one sample stored channel by channel (CHW).
+  int in_c = 0, in_h = 0, in_w = 0;
+  int out_c = 0, out_h = 0, out_w = 0;
+  int size = 0, stride = 1, pad = 0;
 
 
   // Constructors
   Layer() = default;
   Layer(int input, int output, Activation activation);
+  Layer(int input, int output, Activation activation, std::mt19937 &rng);
+
+  int inputs() const { return type == DENSE ? w.rows : in_c * in_h * in_w; }
+  int outputs() const { return type == DENSE ? w.cols : out_c * out_h * out_w; }
 
   // Operations
 
   Matrix forward(const Matrix &in);
-  Matrix backward(const Matrix &dl);
+  Matrix backward(Matrix dl);
 
   void update_weights(double rate, double momentum, double decay);
 };
 
+// Convolution with `filters` size x size filters over a c x h x w input.
+// The weights are a (c*size*size) x filters matrix.
+Layer conv_layer(int c, int h, int w, int filters, int size, int stride, int pad, Activation activation);
+// Max pooling of size x size windows over every channel of a c x h x w input
+Layer maxpool_layer(int c, int h, int w, int size, int stride);
+
 struct Data {
   Matrix X;
   Matrix y;
@@ -55,6 +76,44 @@ struct Data {
 
 struct Dataset { Data train, test; };
 
+// Read-only view of a preprocessed uint8 dataset file (see data_store.cpp).
+// The file is memory-mapped, pixels are normalized to [0,1] only when a
+// batch is gathered.
+struct DataStore {
+  int N = 0;        // number of samples
+  int size_x = 0;   // pixels per sample
+  int size_y = 0;   // number of classes
+  const unsigned char *labels = nullptr;
+  const unsigned char *pixels = nullptr;
+  mutable std::mt19937 mt;
+
+  DataStore() = default;
+  ~DataStore();
+  DataStore(const DataStore &) = delete;
+  DataStore &operator=(const DataStore &) = delete;
+  DataStore(DataStore &&from);
+  DataStore &operator=(DataStore &&from);
+
+  bool open(const std::string &file);
+  void close();
+
+  Data gather(const int *index, int n) const;
+  Data range(int start, int n) const;
+  void range_into(int start, int n, double *X) const;
+  Data random_batch(int batch_size) const;
+  // rows > 0: draw from the first rows samples only
+  Data random_batch(int batch_size, std::mt19937 &rng, int rows = 0) const;
+
+ private:
+  void *map = nullptr;
+  size_t map_size = 0;
+};
+
+struct StoreDataset { DataStore train, test; };
+
+struct Checkpointer;   // checkpoint.h
+struct Optimizer;      // optimizer.h
+
 struct Model {
   std::vector<Layer> layers;
   LossFunction loss;
@@ -68,40 +127,61 @@ struct Model {
   void backward(Matrix grad_loss);
 
   void update_weights(double rate, double momentum, double decay);
-  void train(const Data &data, int batch_size, int iters, double rate, double momentum, double decay);
+  double train_batch(const Data &batch, double rate, double momentum, double decay, double *accuracy = nullptr);
+  double train_batch(const Data &batch, Optimizer &opt, double *accuracy = nullptr);
+  void train(const Data &data, int batch_size, int iters, double rate, double momentum, double decay,
+             Checkpointer *checkpoint = nullptr);
+  void train(const DataStore &data, int batch_size, int iters, double rate, double momentum, double decay,
+             Checkpointer *checkpoint = nullptr);
+  void train(const Data &data, int batch_size, int iters, Optimizer &opt, Checkpointer *checkpoint = nullptr);
+  void train(const DataStore &data, int batch_size, int iters, Optimizer &opt, Checkpointer *checkpoint = nullptr);
 
   double accuracy(const Data &d);   // RUNS FORWARD
+  double accuracy(const DataStore &d);   // RUNS FORWARD
   double accuracy2(const Data &d, const Matrix &p);  // DOES NOT RUN FORWARD
 };
 
 void set_verbose(bool verbose);
 
 Matrix forward_activate_matrix(const Matrix &matrix, Activation a);
-Matrix backward_activate_matrix(const Matrix &out, const Matrix &grad, Activation a);
+void activate_matrix_inplace(Matrix &m, Activation a);
+Matrix backward_activate_matrix(const Matrix &out, Matrix grad, Activation a);
+void backward_activate_inplace(const Matrix &out, Matrix &grad, Activation a);
 
 Matrix forward_weights(const Layer &l, const Matrix &in);
 Matrix forward_activation(const Layer &l, const Matrix &out1);
 
-Matrix backward_xw(const Layer &l, const Matrix &grad_y);
+Matrix backward_xw(const Layer &l, Matrix grad_y);
 Matrix backward_w(const Layer &l);
 Matrix backward_x(const Layer &l);
 
+int max_index(const double *a, int n);
+
 double cross_entropy_loss(const Matrix &y, const Matrix &p);
 double l2_loss(const Matrix &y, const Matrix &p);
 double l1_loss(const Matrix &y, const Matrix &p);
 
 Data read_cifar(const std::string &file, int dataset, int labels);
 Data read_mnist(const std::string &image_file, const std::string &label_file);
+std::vector<unsigned char> read_file(const std::string &file);
+
+void write_store(const std::string &file, int N, int size_x, int size_y,
+                 const unsigned char *labels, const unsigned char *pixels);
+void convert_mnist(const std::string &image_file, const std::string &label_file, const std::string &store_file);
+void convert_cifar(const std::vector<std::string> &files, int dataset, int labels, const std::string &store_file);
+DataStore open_store(const std::string &file, const std::function<void(const std::string &)> &convert);
+StoreDataset get_mnist_store(void);
+StoreDataset get_cifar10_store(void);
 
 Matrix forward_linear(const Matrix &mat);
-Matrix backward_linear(const Matrix &out, const Matrix &prev_grad);
+Matrix backward_linear(const Matrix &out, Matrix grad);
 Matrix forward_logistic(const Matrix &mat);
-Matrix backward_logistic(const Matrix &out, const Matrix &grad);
+Matrix backward_logistic(const Matrix &out, Matrix grad);
 Matrix forward_tanh(const Matrix &mat);
-Matrix backward_tanh(const Matrix &out, const Matrix &grad);
+Matrix backward_tanh(const Matrix &out, Matrix grad);
 Matrix forward_relu(const Matrix &mat);
-Matrix backward_relu(const Matrix &out, const Matrix &grad);
+Matrix backward_relu(const Matrix &out, Matrix grad);
 Matrix forward_lrelu(const Matrix &mat);
-Matrix backward_lrelu(const Matrix &out, const Matrix &grad);
+Matrix backward_lrelu(const Matrix &out, Matrix grad);
 Matrix forward_softmax(const Matrix &mat);
-Matrix backward_softmax(const Matrix &out, const Matrix &prev_grad);
+Matrix backward_softmax(const Matrix &out, Matrix grad);
@@ -0,0 +1,118 @@
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "optimizer.h"
+#include "profiler.h"
+
+// Below this many parameters per thread, starting threads costs more than the update
+static const size_t PARAMS_PER_THREAD = 1 << 16;
+
+Optimizer sgd_optimizer(double rate, double momentum, double decay) {
+  Optimizer o;
+  o.type = SGD;
+  o.rate = rate;
+  o.momentum = momentum;
+  o.decay = decay;
+  return o;
+}
+
+Optimizer adam_optimizer(double rate, double decay, double beta1, double beta2) {
+  Optimizer o;
+  o.type = ADAM;
+  o.rate = rate;
+  o.decay = decay;
+  o.beta1 = beta1;
+  o.beta2 = beta2;
+  return o;
+}
+
+// Collect the parameter segments of m. grad_w is reallocated by every
+// backward pass, so this runs on every step; it is one entry per layer.
+void Optimizer::bind(Model &m) {
+  segments.clear();
+  size_t total = 0;
+  for (int i = 0; i < (int) m.layers.size(); i++) {
+    Layer &l = m.layers[i];
+    size_t n = size_t(l.w.rows) * l.w.cols;
+    if (n == 0) continue;   // MAXPOOL
+    assert_same_size(l.grad_w, l.w);
+    if (l.v.rows != l.w.rows || l.v.cols != l.w.cols) l.v = Matrix(l.w.rows, l.w.cols);
+    segments.push_back({l.w.data, l.grad_w.data, l.v.data, total, n, i});
+    total += n;
+  }
+  if (type == ADAM && m1.size() != total) {
+    m1.assign(total, 0.);
+    m2.assign(total, 0.);
+    t = 0;
+  }
+}
+
+static void sgd_kernel(double *__restrict__ w, const double *__restrict__ g, double *__restrict__ v, size_t n,
+                       double rate, double momentum, double decay) {
+  for (size_t i = 0; i < n; i++) {
+    double d = g[i] - decay * w[i] + momentum * v[i];
+    v[i] = d;
+    w[i] += rate * d;
+  }
+}
+
+static void adam_kernel(double *__restrict__ w, const double *__restrict__ g, double *__restrict__ m,
+                        double *__restrict__ s, size_t n, double c1, double c2,
+                        double b1, double b2, double eps, double decay) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256d vb1 = _mm256_set1_pd(b1), vb1c = _mm256_set1_pd(1 - b1);
+  const __m256d vb2 = _mm256_set1_pd(b2), vb2c = _mm256_set1_pd(1 - b2);
+  const __m256d vc1 = _mm256_set1_pd(c1), vc2 = _mm256_set1_pd(c2);
+  const __m256d veps = _mm256_set1_pd(eps), vdecay = _mm256_set1_pd(decay);
+  for (; i + 4 <= n; i += 4) {
+    __m256d wv = _mm256_loadu_pd(w + i);
+    __m256d gv = _mm256_sub_pd(_mm256_loadu_pd(g + i), _mm256_mul_pd(vdecay, wv));
+    __m256d mv = _mm256_add_pd(_mm256_mul_pd(vb1, _mm256_loadu_pd(m + i)), _mm256_mul_pd(vb1c, gv));
+    __m256d sv = _mm256_add_pd(_mm256_mul_pd(vb2, _mm256_loadu_pd(s + i)),
+                               _mm256_mul_pd(vb2c, _mm256_mul_pd(gv, gv)));
+    _mm256_storeu_pd(m + i, mv);
+    _mm256_storeu_pd(s + i, sv);
+    __m256d den = _mm256_add_pd(_mm256_sqrt_pd(_mm256_mul_pd(sv, vc2)), veps);
+    _mm256_storeu_pd(w + i, _mm256_add_pd(wv, _mm256_div_pd(_mm256_mul_pd(vc1, mv), den)));
+  }
+#endif
+  for (; i < n; i++) {
+    double gi = g[i] - decay * w[i];
+    m[i] = b1 * m[i] + (1 - b1) * gi;
+    s[i] = b2 * s[i] + (1 - b2) * gi * gi;
+    w[i] += c1 * m[i] / (sqrt(s[i] * c2) + eps);
+  }
+}
+
+// Update the flat parameter range [begin, end)
+void Optimizer::update(size_t begin, size_t end) {
+  double c1 = rate / (1 - pow(beta1, double(t)));
+  double c2 = 1 / (1 - pow(beta2, double(t)));
+  for (auto &s:segments) {
+    size_t b = max(begin, s.offset), e = min(end, s.offset + s.n);
+    if (b >= e) continue;
+    size_t k = b - s.offset;
+    ProfileScope scope("update", s.layer);
+    if (type == SGD) sgd_kernel(s.w + k, s.g + k, s.v + k, e - b, rate, momentum, decay);
+    else adam_kernel(s.w + k, s.g + k, &m1[b], &m2[b], e - b, c1, c2, beta1, beta2, eps, decay);
+  }
+}
+
+// One optimization step over all layers of m
+void Optimizer::step(Model &m) {
+  bind(m);
+  t++;
+  size_t total = segments.empty() ? 0 : segments.back().offset + segments.back().n;
+  int nthreads = threads > 0 ? threads : max(1u, std::thread::hardware_concurrency());
+  nthreads = (int) max<size_t>(1, min<size_t>(nthreads, total / PARAMS_PER_THREAD));
+  if (nthreads == 1) {
+    update(0, total);
+    return;
+  }
+  int chunk = (int) ((total + nthreads - 1) / nthreads);
+  parallel_chunks((int) total, chunk, nthreads, [&](int begin, int end, int) { update(begin, end); });
+}
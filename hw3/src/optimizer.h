@@ -0,0 +1,55 @@
+#pragma once
+
+#include "matrix.h"
+#include "neural.h"
+
+// Weight update rules applied in place over all parameters of a Model.
+//
+// Layer::grad_w holds the descent direction (the negative gradient, see
+// Model::loss_derivative). Instead of building matrix temporaries per layer
+// like update_layer, step() views the weights of all layers as one flat
+// parameter vector (a list of segments) and updates every element in a
+// single fused pass, split across threads for large models.
+//
+// SGD:  v = g - decay*w + momentum*v;  w += rate*v       (same as update_layer,
+//                                                          v is Layer::v)
+// ADAM: g = g - decay*w;  m = b1*m + (1-b1)*g;  s = b2*s + (1-b2)*g^2
+//       w += rate * m/(1-b1^t) / (sqrt(s/(1-b2^t)) + eps)
+// The Adam moments live in two contiguous buffers owned by the optimizer,
+// they are not part of checkpoints.
+enum OptimizerType { SGD, ADAM };
+
+struct Optimizer {
+  OptimizerType type = SGD;
+  double rate = .01;
+  double momentum = .9;     // SGD
+  double decay = 0;
+  double beta1 = .9;        // ADAM
+  double beta2 = .999;
+  double eps = 1e-8;
+  int threads = 0;          // 0 = one per core, only used for large models
+
+  // Update the weights of m from its current grad_w
+  void step(Model &m);
+
+  long steps() const { return t; }
+
+ private:
+  struct Segment {
+    double *w;
+    const double *g;
+    double *v;          // SGD velocity (Layer::v)
+    size_t offset;      // in the flat parameter vector
+    size_t n;
+    int layer;          // index in Model::layers, for the profiler
+  };
+  vector<Segment> segments;
+  vector<double> m1, m2;   // ADAM moments, flat
+  long t = 0;
+
+  void bind(Model &m);
+  void update(size_t begin, size_t end);
+};
+
+Optimizer sgd_optimizer(double rate, double momentum, double decay);
+Optimizer adam_optimizer(double rate, double decay = 0, double beta1 = .9, double beta2 = .999);
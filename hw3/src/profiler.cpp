@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "profiler.h"
+
+using namespace std;
+
+atomic<bool> profile_on(false);
+
+struct ProfileEvent {
+  const char *name;
+  int layer;
+  int thread;
+  double start, dur;   // microseconds since profiler_enable
+  double flops;
+  size_t bytes;        // Matrix bytes allocated inside the scope (inclusive)
+  double gemm_us, gemm_flops;   // GEMMs nested in the scope
+};
+
+static mutex events_lock;
+static vector<ProfileEvent> events;
+// steady_clock ticks at profiler_enable/profiler_reset; atomic as workers
+// read it while another thread may restart the clock
+static atomic<chrono::steady_clock::rep> epoch(chrono::steady_clock::now().time_since_epoch().count());
+static atomic<int> thread_count(0);
+
+// Per-thread state: small thread id, innermost open scope and allocation counter
+static thread_local int thread_id = -1;
+static thread_local ProfileScope *current = nullptr;
+static thread_local size_t allocated = 0;
+
+static double now_us() {
+  chrono::steady_clock::duration since(chrono::steady_clock::now().time_since_epoch().count() -
+                                       epoch.load(memory_order_relaxed));
+  return chrono::duration<double, micro>(since).count();
+}
+
+static void restart_clock() { epoch.store(chrono::steady_clock::now().time_since_epoch().count()); }
+
+void profiler_enable(bool on) {
+  if (on && !profile_on.load()) restart_clock();
+  profile_on.store(on);
+}
+
+void profiler_reset() {
+  lock_guard<mutex> lock(events_lock);
+  events.clear();
+  restart_clock();
+}
+
+void profile_alloc_slow(size_t bytes) { allocated += bytes; }
+
+void ProfileScope::begin(const char *name_, int layer_, double flops_) {
+  if (thread_id < 0) thread_id = thread_count++;
+  active = true;
+  name = name_;
+  outer = current;
+  layer = layer_ >= 0 ? layer_ : outer ? outer->layer : -1;
+  current = this;
+  flops = flops_;
+  bytes = allocated;
+  start = now_us();
+}
+
+void ProfileScope::end() {
+  double dur = now_us() - start;
+  current = outer;
+  // a GEMM credits its time and FLOPs to the phase that called it
+  if (flops > 0 && outer) {
+    outer->gemm_us += dur;
+    outer->gemm_flops += flops;
+  }
+  ProfileEvent e = {name, layer, thread_id, start, dur, flops, allocated - bytes, gemm_us, gemm_flops};
+  lock_guard<mutex> lock(events_lock);
+  events.push_back(e);
+}
+
+// Print, per layer, the time of every phase, the GEMM throughput and the
+// Matrix bytes allocated per training iteration
+void profiler_summary(FILE *out) {
+  lock_guard<mutex> lock(events_lock);
+  struct Row {
+    double ms = 0;
+    long count = 0;
+    double gemm_ms = 0, gemm_flops = 0;
+    size_t bytes = 0;
+  };
+  // key: (layer, phase)
+  map<pair<int, string>, Row> rows;
+  double iterations = 0, total_ms = 0;
+  size_t total_bytes = 0;
+
+  for (auto &e:events) {
+    string phase = e.name;
+    if (phase == "iteration") {
+      iterations++;
+      total_ms += e.dur / 1e3;
+      total_bytes += e.bytes;
+      continue;
+    }
+    if (phase == "gemm") continue;
+    Row &r = rows[{e.layer, phase}];
+    r.ms += e.dur / 1e3;
+    r.count++;
+    r.bytes += e.bytes;
+    r.gemm_ms += e.gemm_us / 1e3;
+    r.gemm_flops += e.gemm_flops;
+  }
+
+  double per = iterations > 0 ? iterations : 1;
+  fprintf(out, "%-8s %-10s %8s %12s %7s %10s %12s\n", "layer", "phase", "calls", "ms/iter", "share", "GEMM GF/s",
+          "KB alloc/it");
+  for (auto &kv:rows) {
+    const Row &r = kv.second;
+    string layer = kv.first.first < 0 ? "-" : to_string(kv.first.first);
+    char gflops[32] = "-";
+    if (r.gemm_ms > 0) snprintf(gflops, sizeof(gflops), "%.2f", r.gemm_flops / (r.gemm_ms * 1e6));
+    fprintf(out, "%-8s %-10s %8ld %12.3f %6.1f%% %10s %12.1f\n", layer.c_str(), kv.first.second.c_str(), r.count,
+            r.ms / per, total_ms > 0 ? 100 * r.ms / total_ms : 0., gflops, r.bytes / per / 1024);
+  }
+  fprintf(out, "%-8s %-10s %8.0f %12.3f %6.1f%% %10s %12.1f\n", "all", "iteration", iterations, total_ms / per, 100.,
+          "-", total_bytes / per / 1024);
+}
+
+// Write all events as Chrome trace "complete" events
+bool profiler_write_trace(const string &file) {
+  lock_guard<mutex> lock(events_lock);
+  FILE *fn = fopen(file.c_str(), "w");
+  if (fn == nullptr) {
+    printf("Cannot write trace \"%s\"\n", file.c_str());
+    return false;
+  }
+  fprintf(fn, "{\"traceEvents\":[\n");
+  for (size_t i = 0; i < events.size(); i++) {
+    const ProfileEvent &e = events[i];
+    fprintf(fn, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,"
+                "\"args\":{\"layer\":%d,\"bytes\":%zu",
+            e.name, e.layer < 0 ? "model" : "layer", e.start, e.dur, e.thread, e.layer, e.bytes);
+    if (e.flops > 0) fprintf(fn, ",\"gflops\":%.3f", e.dur > 0 ? e.flops / (e.dur * 1e3) : 0.);
+    fprintf(fn, "}}%s\n", i + 1 < events.size() ? "," : "");
+  }
+  fprintf(fn, "]}\n");
+  return fclose(fn) == 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+// Opt-in training profiler.
+//
+// When enabled, timed scopes record events (forward/backward/update per
+// layer, every GEMM with its FLOP count, batch assembly) and the bytes of
+// Matrix storage allocated inside them. profiler_summary() prints a
+// per-layer table, profiler_write_trace() a Chrome trace (chrome://tracing,
+// Perfetto). Disabled, every hook costs one branch.
+//
+// train.cpp turns it on when CSE576_PROFILE is set to the trace file name.
+
+// Toggled by profiler_enable() while workers may be running; the hooks read
+// it relaxed.
+extern std::atomic<bool> profile_on;
+
+void profiler_enable(bool on);
+void profiler_reset();
+void profiler_summary(FILE *out = stdout);
+bool profiler_write_trace(const std::string &file);
+
+void profile_alloc_slow(size_t bytes);
+inline void profile_alloc(size_t bytes) {
+  if (profile_on.load(std::memory_order_relaxed)) profile_alloc_slow(bytes);
+}
+
+// Time a scope. layer < 0 attributes the event to the enclosing layer scope
+// of the same thread (if any). name must be a string literal (or
+// __FUNCTION__): events keep the pointer.
+struct ProfileScope {
+  ProfileScope(const char *name, int layer = -1, double flops = 0) {
+    if (profile_on.load(std::memory_order_relaxed)) begin(name, layer, flops);
+  }
+  ~ProfileScope() {
+    if (active) end();
+  }
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+ private:
+  void begin(const char *name, int layer, double flops);
+  void end();
+
+  bool active = false;
+  const char *name = nullptr;
+  int layer = -1;
+  ProfileScope *outer = nullptr;   // enclosing scope of this thread
+  double flops = 0;
+  double start = 0;
+  size_t bytes = 0;
+  double gemm_us = 0, gemm_flops = 0;   // of the nested GEMMs
+};
+
+#define COMBINE1(X, Y) X##Y
+#define COMBINE(X, Y) COMBINE1(X,Y)
+
+// Former printf timer; the arguments (print level, label) are ignored and
+// the scope is named after the function
+#define TIME(...) ProfileScope COMBINE(__prof, __LINE__)(__FUNCTION__)
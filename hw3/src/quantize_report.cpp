@@ -0,0 +1,67 @@
+#include <chrono>
+
+#include "matrix.h"
+#include "neural.h"
+#include "inference.h"
+#include "quantized.h"
+
+// Accuracy versus throughput of the int8 model against the float model.
+//
+// USAGE: ./quantize_report [iters=3000] [threads=0]
+// Trains a model per dataset (MNIST, CIFAR-10), quantizes it with a
+// calibration sample of the training set and evaluates both on the test set.
+
+static double seconds_since(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static bool file_present(const string &file) {
+  FILE *fn = fopen(file.c_str(), "rb");
+  if (fn) fclose(fn);
+  return fn != nullptr;
+}
+
+Model report_model(int inputs, int outputs) {
+  return {{
+              Layer(inputs, 128, RELU),
+              Layer(128, 64, RELU),
+              Layer(64, 32, RELU),
+              Layer(32, outputs, SOFTMAX)
+          }, CROSS_ENTROPY};
+}
+
+void report(const string &name, const StoreDataset &d, int iters, int threads) {
+  Model model = report_model(d.train.size_x, d.train.size_y);
+  model.train(d.train, 128, iters, .01, .9, .0);
+
+  Data calibration = d.train.range(0, min(1000, d.train.N));
+  QuantizedModel q = quantize_model(model, calibration.X);
+
+  InferenceEngine engine(model, 256, threads);
+  auto t0 = std::chrono::steady_clock::now();
+  double facc = engine.accuracy(d.test);
+  double ftime = seconds_since(t0);
+
+  t0 = std::chrono::steady_clock::now();
+  double qacc = q.accuracy(d.test, threads);
+  double qtime = seconds_since(t0);
+
+  printf("%-10s %8d %10.4lf %10.4lf %12.0lf %12.0lf %8.2lfx\n", name.c_str(), d.test.N,
+         facc, qacc, d.test.N / ftime, d.test.N / qtime, ftime / qtime);
+}
+
+int main(int argc, char **argv) {
+  int iters = argc > 1 ? atoi(argv[1]) : 3000;
+  int threads = argc > 2 ? atoi(argv[2]) : 0;
+
+  printf("%-10s %8s %10s %10s %12s %12s %9s\n", "dataset", "samples", "fp64 acc", "int8 acc", "fp64 img/s", "int8 img/s", "speedup");
+  if (file_present("mnist/train-images-idx3-ubyte") || file_present("mnist/mnist-train.store"))
+    report("mnist", get_mnist_store(), iters, threads);
+  else printf("%-10s skipped, run ./download_datasets.sh first\n", "mnist");
+
+  if (file_present("cifar/cifar-10-batches-bin/test_batch.bin") || file_present("cifar/cifar10-train.store"))
+    report("cifar10", get_cifar10_store(), iters, threads);
+  else printf("%-10s skipped, run ./download_datasets.sh first\n", "cifar10");
+
+  return 0;
+}
@@ -0,0 +1,292 @@
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "activations.h"
+#include "quantized.h"
+#include "simd_math.h"
+
+static const int QUANT_ALIGN = 32;
+
+static inline uint8_t quantize_u8(double x, float inv_scale) {
+  long q = lround(x * inv_scale);
+  q = q < -127 ? -127 : (q > 127 ? 127 : q);
+  return uint8_t(q + 128);
+}
+
+#if defined(__AVX2__)
+static inline int32_t hsum_epi32(__m256i v) {
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+  return _mm_cvtsi128_si32(s);
+}
+
+// u8 x s8 dot product of 32 bytes accumulated into 8 int32 lanes
+static inline __m256i dot32(__m256i acc, __m256i x, __m256i w) {
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+  return _mm256_dpbusd_epi32(acc, x, w);
+#elif defined(__AVXVNNI__)
+  return _mm256_dpbusd_avx_epi32(acc, x, w);
+#else
+  // pmaddubsw would saturate for 255*127*2, so widen to 16 bits and use pmaddwd
+  __m256i xl = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(x));
+  __m256i xh = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(x, 1));
+  __m256i wl = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(w));
+  __m256i wh = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(w, 1));
+  acc = _mm256_add_epi32(acc, _mm256_madd_epi16(xl, wl));
+  return _mm256_add_epi32(acc, _mm256_madd_epi16(xh, wh));
+#endif
+}
+#endif
+
+#if defined(__AVX2__)
+// Register tile: R input rows x C output channels. Every 32 byte load of a
+// weight row feeds all R rows and every load of an input row all C channels.
+template <int R, int C>
+static inline void tile_u8s8(const uint8_t *x, const int8_t *w, int stride, int32_t *acc, int outputs) {
+  __m256i a[R][C];
+  for (int r = 0; r < R; r++)
+    for (int c = 0; c < C; c++) a[r][c] = _mm256_setzero_si256();
+  for (int k = 0; k < stride; k += 32) {
+    __m256i wv[C];
+    for (int c = 0; c < C; c++) wv[c] = _mm256_loadu_si256((const __m256i *) (w + size_t(c) * stride + k));
+    for (int r = 0; r < R; r++) {
+      __m256i xv = _mm256_loadu_si256((const __m256i *) (x + size_t(r) * stride + k));
+      for (int c = 0; c < C; c++) a[r][c] = dot32(a[r][c], xv, wv[c]);
+    }
+  }
+  for (int r = 0; r < R; r++)
+    for (int c = 0; c < C; c++) acc[size_t(r) * outputs + c] = hsum_epi32(a[r][c]);
+}
+
+// 4x4 needs 16 accumulators plus the loads: only AVX-512 has the 32
+// registers for it, plain AVX2 (16 registers) gets 4x2
+#if defined(__AVX512VL__)
+static const int TILE_C = 4;
+#else
+static const int TILE_C = 2;
+#endif
+static const int TILE_R = 4;
+
+// C output channels of every row; rows in the inner loop so the C weight
+// rows stay in L1 while the chunk streams past them
+template <int C>
+static inline void column_block_u8s8(const uint8_t *x, int rows, const int8_t *w, int stride, int outputs,
+                                     int32_t *acc) {
+  int r = 0;
+  for (; r + TILE_R <= rows; r += TILE_R)
+    tile_u8s8<TILE_R, C>(x + size_t(r) * stride, w, stride, acc + size_t(r) * outputs, outputs);
+  for (; r < rows; r++) tile_u8s8<1, C>(x + size_t(r) * stride, w, stride, acc + size_t(r) * outputs, outputs);
+}
+#endif
+
+void gemm_u8s8(const uint8_t *x, int rows, const int8_t *w, int stride, int outputs, int32_t *acc) {
+  assert(stride % QUANT_ALIGN == 0);
+  int j = 0;
+#if defined(__AVX2__)
+  for (; j + TILE_C <= outputs; j += TILE_C)
+    column_block_u8s8<TILE_C>(x, rows, w + size_t(j) * stride, stride, outputs, acc + j);
+  for (; j < outputs; j++) column_block_u8s8<1>(x, rows, w + size_t(j) * stride, stride, outputs, acc + j);
+#else
+  for (; j < outputs; j++)
+    for (int r = 0; r < rows; r++) {
+      const uint8_t *xr = x + size_t(r) * stride;
+      const int8_t *wj = w + size_t(j) * stride;
+      int32_t a = 0;
+      for (int k = 0; k < stride; k++) a += int32_t(xr[k]) * int32_t(wj[k]);
+      acc[size_t(r) * outputs + j] = a;
+    }
+#endif
+}
+
+void dot_u8s8(const uint8_t *x, const int8_t *w, int stride, int outputs, int32_t *acc) {
+  gemm_u8s8(x, 1, w, stride, outputs, acc);
+}
+
+// Quantize a trained model
+// const Model& m: model with dense layers
+// const Matrix& calibration: sample of training inputs used to pick the
+//                            input scale of every layer
+// returns: the quantized model
+QuantizedModel quantize_model(const Model &m, const Matrix &calibration) {
+  QuantizedModel q;
+  Matrix x = calibration;
+  for (auto &l:m.layers) {
+    if (l.type != DENSE) {
+      printf("quantize_model: only dense layers can be quantized\n");
+      exit(-1);
+    }
+    QuantizedLayer ql;
+    ql.inputs = l.w.rows;
+    ql.outputs = l.w.cols;
+    ql.stride = (ql.inputs + QUANT_ALIGN - 1) / QUANT_ALIGN * QUANT_ALIGN;
+    ql.activation = l.activation;
+    ql.w.assign(size_t(ql.outputs) * ql.stride, 0);
+    ql.w_scale.resize(ql.outputs);
+    ql.w_sum.resize(ql.outputs);
+
+    for (int j = 0; j < ql.outputs; j++) {
+      double wmax = 0;
+      for (int i = 0; i < ql.inputs; i++) wmax = max(wmax, fabs(l.w(i, j)));
+      double scale = wmax > 0 ? wmax / 127 : 1;
+      int32_t sum = 0;
+      for (int i = 0; i < ql.inputs; i++) {
+        int8_t v = (int8_t) lround(l.w(i, j) / scale);
+        ql.w[size_t(j) * ql.stride + i] = v;
+        sum += v;
+      }
+      ql.w_scale[j] = (float) scale;
+      ql.w_sum[j] = sum;
+    }
+
+    double xmax = 0;
+    for (auto &e1:x) xmax = max(xmax, fabs(e1));
+    ql.in_scale = xmax > 0 ? float(xmax / 127) : 1.f;
+
+    x = forward_activate_matrix(x * l.w, l.activation);
+    q.layers.push_back(ql);
+  }
+  return q;
+}
+
+// Run the quantized model over n inputs in chunks of `chunk` rows
+// load(begin, end, X) fills the double input rows of a chunk,
+// consume(begin, end, P, thread) receives the float outputs (row-major)
+void QuantizedModel::run(int n, int chunk, int threads,
+                         const std::function<void(int, int, double *)> &load,
+                         const std::function<void(int, int, const float *, int)> &consume) const {
+  assert(!layers.empty());
+  int width = 0, inputs = layers[0].inputs;
+  for (auto &l:layers) width = max(width, max(l.stride, l.outputs));
+
+  int nthreads = threads > 0 ? threads : max(1u, std::thread::hardware_concurrency());
+  nthreads = max(1, min(nthreads, (n + chunk - 1) / chunk));
+
+  struct Buffers {
+    vector<double> in;
+    vector<uint8_t> ping, pong;   // quantized activations, chunk x width
+    vector<int32_t> acc;
+    vector<float> row, out;
+  };
+  vector<Buffers> buf(nthreads);
+  for (auto &b:buf) {
+    b.in.resize(size_t(chunk) * inputs);
+    // +QUANT_ALIGN so the rows can start on a 32 byte boundary
+    b.ping.resize(size_t(chunk) * width + QUANT_ALIGN);
+    b.pong.resize(size_t(chunk) * width + QUANT_ALIGN);
+    b.acc.resize(size_t(chunk) * width);
+    b.row.resize(width);
+    b.out.resize(size_t(chunk) * layers.back().outputs);
+  }
+  auto aligned = [](vector<uint8_t> &v) {
+    return (uint8_t *) ((uintptr_t(v.data()) + QUANT_ALIGN - 1) & ~uintptr_t(QUANT_ALIGN - 1));
+  };
+
+  parallel_chunks(n, chunk, nthreads, [&](int begin, int end, int t) {
+    Buffers &b = buf[t];
+    int rows = end - begin;
+    uint8_t *cur = aligned(b.ping), *next = aligned(b.pong);
+
+    load(begin, end, b.in.data());
+    const QuantizedLayer &first = layers[0];
+    float inv = 1.f / first.in_scale;
+    for (int r = 0; r < rows; r++) {
+      uint8_t *dst = cur + size_t(r) * first.stride;
+      for (int k = 0; k < first.inputs; k++) dst[k] = quantize_u8(b.in[size_t(r) * inputs + k], inv);
+      memset(dst + first.inputs, 128, first.stride - first.inputs);
+    }
+
+    for (size_t li = 0; li < layers.size(); li++) {
+      const QuantizedLayer &l = layers[li];
+      const QuantizedLayer *nl = li + 1 < layers.size() ? &layers[li + 1] : nullptr;
+      float next_inv = nl ? 1.f / nl->in_scale : 0.f;
+
+      gemm_u8s8(cur, rows, l.w.data(), l.stride, l.outputs, b.acc.data());
+      for (int r = 0; r < rows; r++) {
+        // Fused epilogue: remove the +128 bias, dequantize, activate
+        const int32_t *acc = &b.acc[size_t(r) * l.outputs];
+        float *y = nl ? b.row.data() : &b.out[size_t(r) * l.outputs];
+        for (int j = 0; j < l.outputs; j++)
+          y[j] = float(acc[j] - 128 * l.w_sum[j]) * (l.in_scale * l.w_scale[j]);
+
+        if (l.activation == RELU) {
+          for (int j = 0; j < l.outputs; j++) y[j] = y[j] > 0.f ? y[j] : 0.f;
+        } else if (l.activation == LRELU) {
+          for (int j = 0; j < l.outputs; j++) y[j] = y[j] > 0.f ? y[j] : 0.01f * y[j];
+        } else if (l.activation == LOGISTIC) {
+          sigmoid_inplace(y, l.outputs);
+        } else if (l.activation == TANH) {
+          tanh_inplace(y, l.outputs);
+        } else if (l.activation == SOFTMAX) {
+          float top = *std::max_element(y, y + l.outputs), sum = 0;
+          for (int j = 0; j < l.outputs; j++) y[j] -= top;
+          exp_inplace(y, l.outputs);
+          for (int j = 0; j < l.outputs; j++) sum += y[j];
+          for (int j = 0; j < l.outputs; j++) y[j] = sum == 0 ? 0 : y[j] / sum;
+        }
+
+        // ... and requantize for the next layer
+        if (nl) {
+          uint8_t *dst = next + size_t(r) * nl->stride;
+          for (int j = 0; j < l.outputs; j++) dst[j] = quantize_u8(y[j], next_inv);
+          memset(dst + l.outputs, 128, nl->stride - l.outputs);
+        }
+      }
+      swap(cur, next);
+    }
+    consume(begin, end, b.out.data(), t);
+  });
+}
+
+// Run the quantized model on input X
+// returns: predictions, one row per input row
+Matrix QuantizedModel::predict(const Matrix &X, int threads) const {
+  int outputs = layers.back().outputs;
+  Matrix p(X.rows, outputs);
+  run(X.rows, 256, threads,
+      [&](int begin, int end, double *dst) {
+        memcpy(dst, X[begin], sizeof(double) * (end - begin) * X.cols);
+      },
+      [&](int begin, int end, const float *out, int) {
+        for (size_t i = 0; i < size_t(end - begin) * outputs; i++) p[begin][i] = out[i];
+      });
+  return p;
+}
+
+static int max_index(const float *a, int n) { return int(std::max_element(a, a + n) - a); }
+
+// Accuracy of the quantized model on d, number correct / total
+double QuantizedModel::accuracy(const Data &d, int threads) const {
+  int outputs = layers.back().outputs;
+  atomic<int> correct(0);
+  run(d.X.rows, 256, threads,
+      [&](int begin, int end, double *dst) {
+        memcpy(dst, d.X[begin], sizeof(double) * (end - begin) * d.X.cols);
+      },
+      [&](int begin, int end, const float *out, int) {
+        int c = 0;
+        for (int i = begin; i < end; i++)
+          c += ::max_index(d.y[i], d.y.cols) == max_index(out + size_t(i - begin) * outputs, outputs);
+        correct += c;
+      });
+  return d.X.rows ? (double) correct / d.X.rows : 0;
+}
+
+// Accuracy of the quantized model on a dataset store
+double QuantizedModel::accuracy(const DataStore &d, int threads) const {
+  int outputs = layers.back().outputs;
+  atomic<int> correct(0);
+  run(d.N, 256, threads,
+      [&](int begin, int end, double *dst) { d.range_into(begin, end - begin, dst); },
+      [&](int begin, int end, const float *out, int) {
+        int c = 0;
+        for (int i = begin; i < end; i++)
+          c += d.labels[i] == max_index(out + size_t(i - begin) * outputs, outputs);
+        correct += c;
+      });
+  return d.N ? (double) correct / d.N : 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+#include "matrix.h"
+#include "neural.h"
+
+// Post-training int8 quantization of a dense Model, for fast CPU inference.
+//
+// Weights are quantized symmetrically per output channel (column of
+// Layer::w). Layer inputs are quantized symmetrically with one scale per
+// layer, calibrated on a sample of training data, and stored biased by 128
+// as uint8 so the u8 x s8 -> s32 dot product instructions (VNNI vpdpbusd,
+// or pmaddwd on plain AVX2) can be used; the bias is removed with the
+// per-channel weight sums. Dequantization, activation and requantization
+// for the next layer are fused into the GEMM epilogue.
+struct QuantizedLayer {
+  int inputs = 0;
+  int outputs = 0;
+  int stride = 0;              // inputs padded to a multiple of 32
+  vector<int8_t> w;            // outputs x stride, one row per output channel
+  vector<float> w_scale;       // per output channel
+  vector<int32_t> w_sum;       // per output channel, sum of quantized weights
+  float in_scale = 1.f;        // input quantization step
+  Activation activation = LINEAR;
+};
+
+struct QuantizedModel {
+  vector<QuantizedLayer> layers;
+
+  Matrix predict(const Matrix &X, int threads = 0) const;
+  double accuracy(const Data &d, int threads = 0) const;
+  double accuracy(const DataStore &d, int threads = 0) const;
+
+  // Low level driver, see InferenceEngine::run
+  void run(int n, int chunk, int threads,
+           const std::function<void(int, int, double *)> &load,
+           const std::function<void(int, int, const float *, int)> &consume) const;
+};
+
+QuantizedModel quantize_model(const Model &m, const Matrix &calibration);
+
+// acc[j] = sum_k x[k] * w[j*stride+k] for j in [0,outputs), x is uint8, w is int8
+void dot_u8s8(const uint8_t *x, const int8_t *w, int stride, int outputs, int32_t *acc);
+
+// acc[r*outputs+j] = sum_k x[r*stride+k] * w[j*stride+k] for `rows` input
+// rows, blocked so each weight load is shared by several rows
+void gemm_u8s8(const uint8_t *x, int rows, const int8_t *w, int stride, int outputs, int32_t *acc);
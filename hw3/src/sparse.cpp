@@ -0,0 +1,72 @@
+#include "profiler.h"
+#include "sparse.h"
+
+// With 128-wide layers the CSR kernels beat the tiled GEMM up to ~40%
+// nonzeros (sparse_bench), conversion included
+double sparse_max_density = 0.4;
+
+// Convert a dense matrix to CSR
+// const Matrix& m: matrix to convert
+// double max_density: give up (return an empty matrix) above this fraction of nonzeros
+// returns: CSR copy of m
+SparseMatrix to_sparse(const Matrix &m, double max_density) {
+  SparseMatrix a;
+  size_t n = size_t(m.rows) * m.cols, nnz = 0;
+  for (size_t q1 = 0; q1 < n; q1++) nnz += m.data[q1] != 0;
+  if (n == 0 || nnz > max_density * n) return a;
+
+  a.rows = m.rows;
+  a.cols = m.cols;
+  a.row_ptr.resize(m.rows + 1);
+  a.col.resize(nnz);
+  a.val.resize(nnz);
+  profile_alloc(nnz * (sizeof(int) + sizeof(double)));
+  size_t k = 0;
+  for (int q1 = 0; q1 < m.rows; q1++) {
+    a.row_ptr[q1] = (int) k;
+    const double *row = m.data + size_t(q1) * m.cols;
+    for (int q2 = 0; q2 < m.cols; q2++)
+      if (row[q2] != 0) {
+        a.col[k] = q2;
+        a.val[k++] = row[q2];
+      }
+  }
+  a.row_ptr[m.rows] = (int) k;
+  return a;
+}
+
+Matrix to_dense(const SparseMatrix &a) {
+  Matrix m(a.rows, a.cols);
+  for (int q1 = 0; q1 < a.rows; q1++)
+    for (int k = a.row_ptr[q1]; k < a.row_ptr[q1 + 1]; k++) m(q1, a.col[k]) = a.val[k];
+  return m;
+}
+
+// dst[0..n) += s * src[0..n)
+static inline void axpy(double *__restrict__ dst, const double *__restrict__ src, double s, int n) {
+  for (int q = 0; q < n; q++) dst[q] += s * src[q];
+}
+
+// Row i of c is the combination of the rows of b selected by the nonzeros of row i of a
+void sparse_multiply_into(Matrix &c, const SparseMatrix &a, const Matrix &b) {
+  assert(a.cols == b.rows);
+  assert(c.rows == a.rows && c.cols == b.cols);
+  ProfileScope scope("gemm", -1, 2. * a.nnz() * b.cols);
+  memset(c.data, 0, sizeof(double) * c.rows * c.cols);
+  for (int q1 = 0; q1 < a.rows; q1++) {
+    double *dst = c[q1];
+    for (int k = a.row_ptr[q1]; k < a.row_ptr[q1 + 1]; k++) axpy(dst, b[a.col[k]], a.val[k], b.cols);
+  }
+}
+
+// Every nonzero a(i, j) adds a(i, j) * (row i of b) to row j of the result
+Matrix sparse_transpose_multiply(const SparseMatrix &a, const Matrix &b) {
+  assert(a.rows == b.rows);
+  ProfileScope scope("gemm", -1, 2. * a.nnz() * b.cols);
+  Matrix c(a.cols, b.cols);
+  for (int q1 = 0; q1 < a.rows; q1++) {
+    const double *src = b[q1];
+    for (int k = a.row_ptr[q1]; k < a.row_ptr[q1 + 1]; k++) axpy(c[a.col[k]], src, a.val[k], b.cols);
+  }
+  return c;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "matrix.h"
+
+// Compressed sparse row (CSR) matrices for mostly-zero inputs.
+//
+// About 80% of MNIST pixels are exactly 0. When a model whose first layer
+// is DENSE trains on a batch, the batch density is measured, and below
+// sparse_max_density the layer gets a CSR copy of X (Layer::in_sparse). It
+// then computes X*w and X^T*grad with the sparse kernels below, skipping the
+// zeros; dense inputs keep the dense GEMMs.
+
+// Nonzeros of row i are val[row_ptr[i] .. row_ptr[i+1]), in column order
+struct SparseMatrix {
+  int rows = 0, cols = 0;
+  vector<int> row_ptr;
+  vector<int> col;
+  vector<double> val;
+
+  size_t nnz() const { return val.size(); }
+};
+
+// Largest fraction of nonzeros for which batches get a CSR copy (0 disables)
+extern double sparse_max_density;
+
+// CSR copy of m, or an empty SparseMatrix if more than max_density of m is nonzero
+SparseMatrix to_sparse(const Matrix &m, double max_density = 1);
+Matrix to_dense(const SparseMatrix &a);
+
+// c = a * b, c already shaped a.rows x b.cols
+void sparse_multiply_into(Matrix &c, const SparseMatrix &a, const Matrix &b);
+// a^T * b
+Matrix sparse_transpose_multiply(const SparseMatrix &a, const Matrix &b);
@@ -0,0 +1,97 @@
+#include <chrono>
+
+#include "matrix.h"
+#include "neural.h"
+#include "optimizer.h"
+#include "sparse.h"
+
+// Sparse versus dense first layer on MNIST.
+//
+// USAGE: ./sparse_bench [iters=500] [batch=128]
+// Times the first layer's X*w and X^T*grad on training batches with the CSR
+// and the dense kernels, then whole training iterations with the sparse
+// path enabled and disabled (sparse_max_density = 0). Without the MNIST
+// files it falls back to random inputs with MNIST's density (19%).
+
+static double seconds_since(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static bool file_present(const string &file) {
+  FILE *fn = fopen(file.c_str(), "rb");
+  if (fn) fclose(fn);
+  return fn != nullptr;
+}
+
+// 60000 x 784 inputs with 19% nonzeros in [0,1], 10 classes
+static Data synthetic_mnist() {
+  Data d(60000, 784, 10);
+  std::mt19937 rng(576);
+  for (int q1 = 0; q1 < d.X.rows; q1++) {
+    for (int q2 = 0; q2 < d.X.cols; q2++)
+      if (rng() % 100 < 19) d.X(q1, q2) = (rng() % 255 + 1) / 255.;
+    d.y(q1, rng() % 10) = 1;
+  }
+  return d;
+}
+
+template <class Store>
+static void bench(const Store &train, int iters, int batch) {
+  Model model = {{Layer(784, 128, RELU), Layer(128, 64, RELU), Layer(64, 10, SOFTMAX)}, CROSS_ENTROPY};
+  const Layer &l = model.layers[0];
+
+  // Kernels alone, on the same batches
+  double density = 0, tsd = 0, tdd = 0, tsw = 0, tdw = 0;
+  Matrix out(batch, l.w.cols), grad = random_matrix(batch, l.w.cols);
+  for (int it = 0; it < 50; it++) {
+    Data b = train.random_batch(batch);
+    SparseMatrix s = to_sparse(b.X);
+    density += double(s.nnz()) / (double(b.X.rows) * b.X.cols) / 50;
+    auto t0 = std::chrono::steady_clock::now();
+    sparse_multiply_into(out, s, l.w);
+    tsd += seconds_since(t0);
+    t0 = std::chrono::steady_clock::now();
+    multiply_into(out, b.X, l.w);
+    tdd += seconds_since(t0);
+    t0 = std::chrono::steady_clock::now();
+    Matrix gs = sparse_transpose_multiply(s, grad);
+    tsw += seconds_since(t0);
+    t0 = std::chrono::steady_clock::now();
+    Matrix gd = b.X.transpose() * grad;
+    tdw += seconds_since(t0);
+  }
+  printf("input density %.1f%%\n", 100 * density);
+  printf("%-22s %10s %10s %9s\n", "first layer", "dense ms", "sparse ms", "speedup");
+  printf("%-22s %10.3lf %10.3lf %8.2lfx\n", "forward X*w", tdd * 20, tsd * 20, tdd / tsd);
+  printf("%-22s %10.3lf %10.3lf %8.2lfx\n", "weight grad X^T*g", tdw * 20, tsw * 20, tdw / tsw);
+
+  // Whole training iterations, same initial weights and batches
+  double seconds[2];
+  double defaults = sparse_max_density;
+  for (int sparse = 0; sparse < 2; sparse++) {
+    Model m = model;
+    Optimizer opt = sgd_optimizer(.01, .9, 0);
+    sparse_max_density = sparse ? defaults : 0;
+    train.mt.seed(576);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iters; it++) m.train_batch(train.random_batch(batch), opt);
+    seconds[sparse] = seconds_since(t0);
+  }
+  sparse_max_density = defaults;
+  printf("%-22s %10.3lf %10.3lf %8.2lfx\n", "training iteration", 1e3 * seconds[0] / iters,
+         1e3 * seconds[1] / iters, seconds[0] / seconds[1]);
+}
+
+int main(int argc, char **argv) {
+  int iters = argc > 1 ? atoi(argv[1]) : 500;
+  int batch = argc > 2 ? atoi(argv[2]) : 128;
+
+  if (file_present("mnist/train-images-idx3-ubyte") || file_present("mnist/mnist-train.store")) {
+    printf("MNIST\n");
+    bench(get_mnist_store().train, iters, batch);
+  } else {
+    printf("MNIST not found (run ./download_datasets.sh), using random inputs of the same density\n");
+    bench(synthetic_mnist(), iters, batch);
+  }
+  return 0;
+}
@@ -0,0 +1,148 @@
+#include <chrono>
+#include <cmath>
+#include <mutex>
+
+#include "inference.h"
+#include "profiler.h"
+#include "sweep.h"
+
+vector<double> log_range(double lo, double hi, int n) {
+  vector<double> v(n);
+  for (int q1 = 0; q1 < n; q1++)
+    v[q1] = n == 1 ? lo : lo * pow(hi / lo, double(q1) / (n - 1));
+  return v;
+}
+
+// Enumerate the grid, or draw `random` points of it
+vector<SweepConfig> SweepSpec::configs() const {
+  vector<SweepConfig> res;
+  if (random > 0) {
+    std::mt19937 rng(seed);
+    auto pick = [&](size_t n) { return size_t(rng() % n); };
+    for (int q1 = 0; q1 < random; q1++) {
+      res.push_back({optimizers[pick(optimizers.size())], rates[pick(rates.size())], momenta[pick(momenta.size())],
+                     decays[pick(decays.size())], batches[pick(batches.size())], archs[pick(archs.size())]});
+      if (res.back().optimizer != SGD) res.back().momentum = 0;
+    }
+    return res;
+  }
+  for (auto &a:archs)
+    for (int b:batches)
+      for (OptimizerType o:optimizers)
+        for (double r:rates)
+          for (double m:(o == SGD ? momenta : vector<double>{0.}))
+            for (double d:decays)
+              res.push_back({o, r, m, d, b, a});
+  return res;
+}
+
+static string arch_name(const SweepArch &a) {
+  string s;
+  for (int h:a.hidden) s += (s.empty() ? "" : "-") + to_string(h);
+  if (s.empty()) s = "softmax";
+  else s += a.activation == RELU ? "/relu" : a.activation == LRELU ? "/lrelu" :
+            a.activation == TANH ? "/tanh" : a.activation == LOGISTIC ? "/logistic" : "/linear";
+  return s;
+}
+
+static const char *optimizer_name(OptimizerType o) { return o == ADAM ? "adam" : "sgd"; }
+
+static Model build_model(const SweepArch &a, LossFunction loss, int inputs, int outputs, std::mt19937 &rng) {
+  Model m;
+  m.loss = loss;
+  int prev = inputs;
+  for (int h:a.hidden) {
+    m.layers.push_back(Layer(prev, h, a.activation, rng));
+    prev = h;
+  }
+  m.layers.push_back(Layer(prev, outputs, SOFTMAX, rng));
+  return m;
+}
+
+static void write_row(FILE *fn, const SweepResult &r) {
+  const SweepConfig &c = r.config;
+  fprintf(fn, "%s\t%g\t%g\t%g\t%d\t%s\t%d\t%.6lf\t%.4lf\t%.4lf\t%.4lf\t%.1lf\t%s\n", optimizer_name(c.optimizer),
+          c.rate, c.momentum, c.decay, c.batch, arch_name(c.arch).c_str(), r.iters, r.loss, r.train_accuracy,
+          r.validation_accuracy, r.test_accuracy, r.seconds, r.stopped.empty() ? "-" : r.stopped.c_str());
+  fflush(fn);
+}
+
+// Run a hyperparameter sweep
+// const DataStore& train, test: shared datasets, only read
+// const SweepSpec& spec: search space and early stopping policy
+// int threads: concurrent runs (0 = one per core)
+// const string& table: tab separated results file
+// returns: one result per configuration
+vector<SweepResult> run_sweep(const DataStore &train, const DataStore &test, const SweepSpec &spec,
+                              int threads, const string &table) {
+  vector<SweepConfig> configs = spec.configs();
+  vector<SweepResult> results(configs.size());
+
+  // held out at the end of the training store
+  const int held = spec.validation > 0 ? min(spec.validation, train.N - 1) : 0;
+  Data validation;
+  if (held > 0) validation = train.range(train.N - held, held);
+
+  FILE *fn = nullptr;
+  if (!table.empty()) {
+    fn = fopen(table.c_str(), "w");
+    if (fn == nullptr) {
+      printf("Cannot write sweep table \"%s\"\n", table.c_str());
+      exit(-1);
+    }
+    fprintf(fn, "optimizer\trate\tmomentum\tdecay\tbatch\tarch\titers\tloss\ttrain_acc\tval_acc\ttest_acc\tseconds\tstopped\n");
+  }
+  std::mutex out;
+  std::atomic<int> finished(0);
+
+  parallel_chunks((int) configs.size(), 1, threads, [&](int begin, int, int) {
+    const SweepConfig &c = configs[begin];
+    SweepResult &r = results[begin];
+    r.config = c;
+    auto t0 = std::chrono::steady_clock::now();
+
+    // Built when the run starts and freed when it ends, so memory follows the
+    // concurrent runs, not the configs. Weights and batches come from the
+    // run's own generator: a sweep is reproducible whatever the scheduling.
+    std::mt19937 rng(spec.seed + begin);
+    Model m = build_model(c.arch, spec.loss, train.size_x, train.size_y, rng);
+    Optimizer opt = c.optimizer == SGD ? sgd_optimizer(c.rate, c.momentum, c.decay)
+                                       : adam_optimizer(c.rate, c.decay);
+    opt.threads = 1;
+    for (r.iters = 0; r.iters < spec.iters;) {
+      ProfileScope scope("iteration");
+      Data batch;
+      {
+        ProfileScope assembly("batch");
+        batch = train.random_batch(c.batch, rng, train.N - held);
+      }
+      r.loss = m.train_batch(batch, opt);
+      r.iters++;
+      if (!std::isfinite(r.loss)) {
+        r.stopped = "diverged";
+        break;
+      }
+      if (validation.X.rows && spec.check_every > 0 && r.iters % spec.check_every == 0 && r.iters < spec.iters &&
+          InferenceEngine(m, 256, 1).accuracy(validation) < spec.min_accuracy) {
+        r.stopped = "accuracy@" + to_string(r.iters);
+        break;
+      }
+    }
+
+    // Concurrent runs already fill the cores, evaluate on this thread only
+    InferenceEngine engine(m, 256, 1);
+    r.train_accuracy = engine.accuracy(train);
+    if (validation.X.rows) r.validation_accuracy = engine.accuracy(validation);
+    r.test_accuracy = engine.accuracy(test);
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    std::lock_guard<std::mutex> lock(out);
+    printf("[%d/%d] %s rate %g momentum %g decay %g batch %d %s: validation accuracy %.4lf%s%s\n", ++finished,
+           (int) configs.size(), optimizer_name(c.optimizer), c.rate, c.momentum, c.decay, c.batch,
+           arch_name(c.arch).c_str(), r.validation_accuracy, r.stopped.empty() ? "" : ", stopped: ", r.stopped.c_str());
+    if (fn) write_row(fn, r);
+  });
+
+  if (fn) fclose(fn);
+  return results;
+}
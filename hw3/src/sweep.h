@@ -0,0 +1,70 @@
+#pragma once
+
+#include "matrix.h"
+#include "neural.h"
+#include "optimizer.h"
+
+// Hyperparameter sweeps: many independent Models trained concurrently on a
+// thread pool against one shared, read-only DataStore.
+//
+// Every run initializes its weights and draws its batches with its own
+// mt19937 (DataStore::random_batch with an explicit rng), so the store
+// itself is never written to, and a model exists only while its run does.
+
+// Hidden layer widths and their activation; the output layer is always SOFTMAX
+struct SweepArch {
+  vector<int> hidden;
+  Activation activation;
+};
+
+// One point of the search space
+struct SweepConfig {
+  OptimizerType optimizer;
+  double rate;
+  double momentum;
+  double decay;
+  int batch;
+  SweepArch arch;
+};
+
+struct SweepSpec {
+  vector<OptimizerType> optimizers = {SGD};
+  vector<double> rates = {.01};
+  vector<double> momenta = {.9};   // SGD only
+  vector<double> decays = {0};
+  vector<int> batches = {128};
+  vector<SweepArch> archs = {{{128, 64, 32}, RELU}};
+  LossFunction loss = CROSS_ENTROPY;
+
+  int random = 0;          // 0: full grid, otherwise number of random draws from the grid
+  int iters = 3000;        // SGD iterations per run
+  int check_every = 500;   // early stopping checkpoints
+  double min_accuracy = 0; // stop a run whose validation accuracy is below this at a checkpoint
+  // Validation rows for early stopping: the last `validation` rows of the
+  // training store, held out of the batches (0 = none). Never test rows,
+  // which would prune configs on the data their test accuracy is reported on.
+  int validation = 1000;
+  unsigned seed = 576;
+
+  vector<SweepConfig> configs() const;
+};
+
+struct SweepResult {
+  SweepConfig config;
+  int iters = 0;             // iterations actually run
+  double loss = 0;           // last batch loss
+  double train_accuracy = 0;   // on the whole training store, validation rows too
+  double validation_accuracy = 0;   // on the held out rows, 0 without; rank configs by this
+  double test_accuracy = 0;
+  double seconds = 0;
+  string stopped;            // empty if the run completed, otherwise the reason
+};
+
+// Run every configuration of spec on up to `threads` threads (0 = one per core).
+// Results are appended to the tab separated file `table` (if not empty) as
+// runs finish, and returned in configuration order.
+vector<SweepResult> run_sweep(const DataStore &train, const DataStore &test, const SweepSpec &spec,
+                              int threads = 0, const string &table = "");
+
+// n values spaced evenly on a log scale from lo to hi
+vector<double> log_range(double lo, double hi, int n);
@@ -1,6 +1,16 @@
 #include "matrix.h"
 #include "utils.h"
 #include "activations.h"
+#include "inference.h"
+#include "quantized.h"
+#include "checkpoint.h"
+#include "sweep.h"
+#include "conv.h"
+#include "optimizer.h"
+#include "simd_math.h"
+#include "profiler.h"
+#include "sparse.h"
+#include "memory_policy.h"
 
 #include <string>
 #include <iostream>
@@ -120,6 +130,415 @@ void test_backward_softmax() {
   TEST(matrix_within_eps(gt, output, EPS));
 }
 
+void test_data_store() {
+  const int N = 5, size_x = 7, size_y = 3;
+  unsigned char labels[N], pixels[N * size_x];
+  for (int i = 0; i < N; i++) labels[i] = (unsigned char) (i % size_y);
+  for (int i = 0; i < N * size_x; i++) pixels[i] = (unsigned char) (i * 37);
+
+  write_store("test.store", N, size_x, size_y, labels, pixels);
+  DataStore store;
+  TEST(store.open("test.store"));
+  TEST(store.N == N && store.size_x == size_x && store.size_y == size_y);
+
+  int index[2] = {3, 1};
+  Data batch = store.gather(index, 2);
+  bool same = true;
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < size_x; j++)
+      same &= fabs(batch.X(i, j) - pixels[index[i] * size_x + j] / 255.) < EPS;
+    for (int j = 0; j < size_y; j++)
+      same &= batch.y(i, j) == (j == labels[index[i]]);
+  }
+  TEST(same);
+  store.close();
+  remove("test.store");
+}
+
+void test_inference_engine() {
+  Model m = {{Layer(20, 16, RELU), Layer(16, 8, TANH), Layer(8, 4, SOFTMAX)}, CROSS_ENTROPY};
+  Matrix X = random_matrix(103, 20);
+  Matrix gt = m.forward(X);
+  Matrix output = InferenceEngine(m, 16, 3).predict(X);
+  TEST(matrix_within_eps(gt, output, EPS));
+}
+
+void test_quantized_model() {
+  Model m = {{Layer(50, 40, RELU), Layer(40, 10, SOFTMAX)}, CROSS_ENTROPY};
+  Matrix X = random_matrix(200, 50);
+  QuantizedModel q = quantize_model(m, X);
+
+  // the u8 x s8 kernel is exact
+  const QuantizedLayer &l = q.layers[0];
+  vector<uint8_t> x(l.stride);
+  for (auto &e1:x) e1 = (uint8_t) (myrand() % 256);
+  vector<int32_t> acc(l.outputs);
+  dot_u8s8(x.data(), l.w.data(), l.stride, l.outputs, acc.data());
+  bool exact = true;
+  for (int j = 0; j < l.outputs; j++) {
+    int32_t gt = 0;
+    for (int k = 0; k < l.stride; k++) gt += int32_t(x[k]) * l.w[size_t(j) * l.stride + k];
+    exact &= gt == acc[j];
+  }
+  TEST(exact);
+
+  // ... and so is the blocked GEMM, including the partial row and column tiles
+  const int rows = 7;
+  vector<uint8_t> xs(size_t(rows) * l.stride);
+  for (auto &e1:xs) e1 = (uint8_t) (myrand() % 256);
+  vector<int32_t> accs(size_t(rows) * l.outputs);
+  gemm_u8s8(xs.data(), rows, l.w.data(), l.stride, l.outputs, accs.data());
+  exact = true;
+  for (int r = 0; r < rows; r++) {
+    dot_u8s8(&xs[size_t(r) * l.stride], l.w.data(), l.stride, l.outputs, acc.data());
+    for (int j = 0; j < l.outputs; j++) exact &= acc[j] == accs[size_t(r) * l.outputs + j];
+  }
+  TEST(exact);
+
+  Matrix gt = m.forward(X);
+  Matrix output = q.predict(X, 2);
+  TEST(matrix_within_eps(gt, output, 0.02));
+}
+
+void test_checkpoint() {
+  Model m = {{Layer(20, 16, RELU), Layer(16, 4, SOFTMAX)}, CROSS_ENTROPY};
+  for (auto &l:m.layers) l.v = random_matrix(l.w.rows, l.w.cols);
+  TEST(save_checkpoint(m, "test.ckpt", 42));
+
+  Model loaded;
+  long iteration = 0;
+  TEST(load_checkpoint("test.ckpt", loaded, &iteration));
+  bool same = iteration == 42 && loaded.loss == m.loss && loaded.layers.size() == m.layers.size();
+  for (size_t i = 0; same && i < m.layers.size(); i++) {
+    same &= loaded.layers[i].activation == m.layers[i].activation;
+    same &= matrix_within_eps(loaded.layers[i].w, m.layers[i].w, 0);
+    same &= matrix_within_eps(loaded.layers[i].v, m.layers[i].v, 0);
+  }
+  TEST(same);
+
+  MappedModel mapped;
+  TEST(mapped.open("test.ckpt"));
+  Matrix X = random_matrix(37, 20);
+  TEST(matrix_within_eps(InferenceEngine(mapped.model).predict(X), m.forward(X), EPS));
+  mapped.close();
+
+  {
+    Checkpointer ck("test.ckpt", 10);
+    Data d(64, 20, 4);
+    d.X = random_matrix(64, 20);
+    for (int i = 0; i < 64; i++) d.y(i, i % 4) = 1;
+    m.train(d, 16, 30, 0.01, 0.9, 0, &ck);
+  }
+  TEST(load_checkpoint("test.ckpt", loaded, &iteration));
+  TEST(iteration > 0 && iteration % 10 == 0);
+  remove("test.ckpt");
+}
+
+void test_sweep() {
+  // class = whether the first pixel is bright
+  const int N = 256, size_x = 8, size_y = 2;
+  vector<unsigned char> labels(N), pixels(N * size_x);
+  for (auto &e1:pixels) e1 = (unsigned char) (myrand() % 256);
+  for (int i = 0; i < N; i++) labels[i] = pixels[i * size_x] > 127;
+  write_store("test.store", N, size_x, size_y, labels.data(), pixels.data());
+  DataStore store;
+  TEST(store.open("test.store"));
+
+  // validation rows are held out of the batches: draws from the first row only
+  std::mt19937 rng(1);
+  Data b = store.random_batch(20, rng, 1), first = store.range(0, 1);
+  bool held = true;
+  for (int i = 0; i < 20; i++)
+    for (int j = 0; j < size_x; j++) held &= b.X(i, j) == first.X(0, j);
+  TEST(held);
+
+  SweepSpec spec;
+  spec.optimizers = {SGD, ADAM};
+  spec.rates = {.1, .3};
+  spec.batches = {16, 32};
+  spec.archs = {{{}, LINEAR}, {{8}, RELU}};
+  spec.iters = 200;
+  spec.check_every = 50;
+  spec.validation = 64;
+  vector<SweepResult> results = run_sweep(store, store, spec, 3);
+  TEST(results.size() == 16);
+  bool learned = true;
+  for (auto &r:results)
+    learned &= r.stopped.empty() && r.iters == 200 && r.validation_accuracy > 0.75 && r.test_accuracy > 0.75;
+  TEST(learned);
+  // every run initializes from its own generator: the same on any number of threads
+  vector<SweepResult> serial = run_sweep(store, store, spec, 1);
+  bool same = serial.size() == results.size();
+  for (size_t i = 0; same && i < serial.size(); i++) same = serial[i].loss == results[i].loss;
+  TEST(same);
+
+  // no run can reach this, all stop at the first check
+  spec.min_accuracy = 1.1;
+  spec.random = 3;
+  results = run_sweep(store, store, spec, 2);
+  bool stopped = results.size() == 3;
+  for (auto &r:results) stopped &= r.iters == 50 && r.stopped == "accuracy@50";
+  TEST(stopped);
+
+  store.close();
+  remove("test.store");
+}
+
+// Largest difference between the backpropagated gradients of a layer and
+// central differences of L = sum(out2 .* R)
+double gradient_check(Layer &l, const Matrix &X) {
+  Matrix R = random_matrix(X.rows, l.outputs());
+  auto loss = [&](const Matrix &x) {
+    Matrix y = Layer(l).forward(x);
+    double s = 0;
+    for (int i = 0; i < y.rows * y.cols; i++) s += y.data[i] * R.data[i];
+    return s;
+  };
+  l.forward(X);
+  l.backward(R);
+
+  const double h = 1e-5;
+  double err = 0;
+  Matrix x = X;
+  for (int i = 0; i < x.rows * x.cols; i++) {
+    double x0 = x.data[i];
+    x.data[i] = x0 + h;
+    double lp = loss(x);
+    x.data[i] = x0 - h;
+    double lm = loss(x);
+    x.data[i] = x0;
+    err = max(err, fabs((lp - lm) / (2 * h) - l.grad_in.data[i]));
+  }
+  for (int i = 0; i < l.w.rows * l.w.cols; i++) {
+    double w0 = l.w.data[i];
+    l.w.data[i] = w0 + h;
+    double lp = loss(X);
+    l.w.data[i] = w0 - h;
+    double lm = loss(X);
+    l.w.data[i] = w0;
+    err = max(err, fabs((lp - lm) / (2 * h) - l.grad_w.data[i]));
+  }
+  return err;
+}
+
+void test_conv_layer() {
+  Layer l = conv_layer(3, 9, 7, 5, 3, 1, 1, LINEAR);
+  TEST(l.out_h == 9 && l.out_w == 7 && l.outputs() == 5 * 9 * 7);
+  Matrix X = random_matrix(6, l.inputs());
+  Matrix direct(X.rows, l.outputs()), im2col(X.rows, l.outputs());
+  conv_forward_direct3x3(l, X, direct);
+  conv_forward_im2col(l, X, im2col);
+  TEST(matrix_within_eps(direct, im2col, EPS));
+
+  // matches a naive convolution
+  Layer s = conv_layer(2, 8, 8, 3, 3, 2, 1, LINEAR);
+  Matrix Y = random_matrix(2, s.inputs());
+  Matrix out(2, s.outputs()), naive(2, s.outputs());
+  conv_forward_im2col(s, Y, out);
+  for (int n = 0; n < 2; n++)
+    for (int f = 0; f < s.out_c; f++)
+      for (int oy = 0; oy < s.out_h; oy++)
+        for (int ox = 0; ox < s.out_w; ox++)
+          for (int c = 0; c < s.in_c; c++)
+            for (int ky = 0; ky < 3; ky++)
+              for (int kx = 0; kx < 3; kx++) {
+                int iy = oy * 2 - 1 + ky, ix = ox * 2 - 1 + kx;
+                if (iy >= 0 && iy < 8 && ix >= 0 && ix < 8)
+                  naive(n, (f * s.out_h + oy) * s.out_w + ox) += s.w((c * 3 + ky) * 3 + kx, f) * Y(n, (c * 8 + iy) * 8 + ix);
+              }
+  TEST(matrix_within_eps(out, naive, EPS));
+
+  Layer g = conv_layer(2, 6, 5, 3, 3, 2, 1, TANH);
+  TEST(gradient_check(g, random_matrix(3, g.inputs())) < 1e-6);
+  Layer g4 = conv_layer(4, 5, 5, 2, 2, 1, 0, LOGISTIC);
+  TEST(gradient_check(g4, random_matrix(2, g4.inputs())) < 1e-6);
+}
+
+void test_maxpool_layer() {
+  Layer l = maxpool_layer(2, 6, 6, 2, 2);
+  TEST(l.out_h == 3 && l.out_w == 3);
+  Matrix X = random_matrix(3, l.inputs());
+  TEST(gradient_check(l, X) < 1e-6);
+
+  // a small conv net runs through the InferenceEngine and checkpoints
+  Model m = {{conv_layer(3, 8, 8, 4, 3, 1, 1, RELU), maxpool_layer(4, 8, 8, 2, 2),
+              conv_layer(4, 4, 4, 6, 3, 1, 0, RELU), Layer(6 * 2 * 2, 5, SOFTMAX)}, CROSS_ENTROPY};
+  Matrix Y = random_matrix(21, 3 * 8 * 8);
+  Matrix gt = m.forward(Y);
+  TEST(matrix_within_eps(InferenceEngine(m, 8, 2).predict(Y), gt, EPS));
+  TEST(save_checkpoint(m, "test.ckpt"));
+  Model loaded;
+  TEST(load_checkpoint("test.ckpt", loaded));
+  TEST(matrix_within_eps(loaded.forward(Y), gt, EPS));
+  remove("test.ckpt");
+}
+
+void test_optimizer() {
+  // large enough for the update to be split across threads
+  Model m = {{Layer(512, 400, RELU), maxpool_layer(1, 20, 20, 2, 2), Layer(100, 10, SOFTMAX)}, CROSS_ENTROPY};
+  for (auto &l:m.layers) {
+    l.grad_w = random_matrix(l.w.rows, l.w.cols);
+    l.v = random_matrix(l.w.rows, l.w.cols);
+  }
+
+  // SGD matches update_layer
+  Model ref = m;
+  ref.update_weights(.1, .9, .01);
+  Optimizer sgd = sgd_optimizer(.1, .9, .01);
+  sgd.threads = 3;
+  sgd.step(m);
+  bool same = true;
+  for (size_t i = 0; i < m.layers.size(); i++) {
+    same &= matrix_within_eps(m.layers[i].w, ref.layers[i].w, EPS);
+    same &= matrix_within_eps(m.layers[i].v, ref.layers[i].v, EPS);
+  }
+  TEST(same);
+
+  // two ADAM steps against the textbook formula
+  ref = m;
+  Optimizer adam = adam_optimizer(.01, .001);
+  adam.threads = 3;
+  adam.step(m);
+  adam.step(m);
+  same = adam.steps() == 2;
+  for (size_t i = 0; i < m.layers.size(); i++) {
+    Matrix &w = ref.layers[i].w, &g = ref.layers[i].grad_w;
+    for (int j = 0; j < w.rows * w.cols; j++) {
+      double mo = 0, s = 0;
+      for (int t = 1; t <= 2; t++) {
+        double gi = g.data[j] - .001 * w.data[j];
+        mo = .9 * mo + .1 * gi;
+        s = .999 * s + .001 * gi * gi;
+        w.data[j] += .01 * (mo / (1 - pow(.9, t))) / (sqrt(s / (1 - pow(.999, t))) + 1e-8);
+      }
+    }
+    same &= matrix_within_eps(m.layers[i].w, w, EPS);
+  }
+  TEST(same);
+}
+
+void test_simd_math() {
+  vector<double> x, y;
+  for (double v = -700; v <= 700; v += 0.0137) x.push_back(v);
+  x.push_back(0);
+  x.push_back(-0.);
+  x.push_back(1e-300);
+
+  // exp: relative error within the truncation bound (plus rounding)
+  double bound = simd_math::exp_error_bound(SIMD_MATH_EXP_TERMS) + 1e-15, err = 0;
+  y = x;
+  exp_inplace(y.data(), (long) y.size());
+  for (size_t i = 0; i < x.size(); i++) err = max(err, fabs(y[i] - exp(x[i])) / exp(x[i]));
+  TEST(err < bound);
+
+  // tanh, sigmoid: absolute error
+  err = 0;
+  y = x;
+  tanh_inplace(y.data(), (long) y.size());
+  for (size_t i = 0; i < x.size(); i++) err = max(err, fabs(y[i] - tanh(x[i])));
+  y = x;
+  sigmoid_inplace(y.data(), (long) y.size());
+  for (size_t i = 0; i < x.size(); i++) err = max(err, fabs(y[i] - 1 / (1 + exp(-x[i]))));
+  TEST(err < 1e-15);
+
+  vector<float> xf, yf;
+  for (float v = -80; v <= 80; v += 0.0137f) xf.push_back(v);
+  float errf = 0;
+  yf = xf;
+  exp_inplace(yf.data(), (long) yf.size());
+  for (size_t i = 0; i < xf.size(); i++) errf = max(errf, fabsf(yf[i] - expf(xf[i])) / expf(xf[i]));
+  TEST(errf < simd_math::exp_error_bound(SIMD_MATH_EXPF_TERMS) + 4e-7);
+  errf = 0;
+  yf = xf;
+  tanh_inplace(yf.data(), (long) yf.size());
+  for (size_t i = 0; i < xf.size(); i++) errf = max(errf, fabsf(yf[i] - tanhf(xf[i])));
+  TEST(errf < 1e-6);
+
+  // NaN propagates, out of range saturates
+  double special[5] = {NAN, -1e6, 1e6, 0, 0};
+  exp_inplace(special, 5);
+  TEST(std::isnan(special[0]) && special[1] >= 0 && special[1] < 1e-300 && special[2] > 1e300 && special[3] == 1);
+}
+
+void test_profiler() {
+  Data d(64, 20, 4);
+  d.X = random_matrix(64, 20);
+  for (int i = 0; i < 64; i++) d.y(i, i % 4) = 1;
+  Model m = {{Layer(20, 16, RELU), Layer(16, 4, SOFTMAX)}, CROSS_ENTROPY};
+
+  profiler_reset();
+  profiler_enable(true);
+  Optimizer opt = sgd_optimizer(.01, .9, 0);
+  m.train(d, 32, 3, opt);
+  profiler_enable(false);
+
+  TEST(profiler_write_trace("test_trace.json"));
+  FILE *fn = fopen("test_trace.json", "r");
+  string trace;
+  char buf[4096];
+  for (size_t n; fn && (n = fread(buf, 1, sizeof(buf), fn)) > 0;) trace.append(buf, n);
+  if (fn) fclose(fn);
+  remove("test_trace.json");
+  TEST(trace.find("\"name\":\"forward\"") != string::npos && trace.find("\"name\":\"backward\"") != string::npos &&
+       trace.find("\"name\":\"update\"") != string::npos && trace.find("\"name\":\"batch\"") != string::npos);
+  TEST(trace.find("\"gflops\"") != string::npos);
+
+  // the forward pass of layer 0 allocates at least its 32x16 output
+  size_t pos = trace.find("\"name\":\"forward\"");
+  pos = trace.find("\"bytes\":", pos);
+  TEST(pos != string::npos && atol(trace.c_str() + pos + 8) >= 32 * 16 * sizeof(double));
+
+  FILE *summary = tmpfile();
+  profiler_summary(summary);
+  TEST(ftell(summary) > 0);
+  fclose(summary);
+  profiler_reset();
+}
+
+void test_sparse() {
+  Matrix x = random_matrix(40, 30);
+  for (int i = 0; i < 40 * 30; i++) x.data[i] = i % 4 ? 0 : x.data[i] + 2;
+  SparseMatrix s = to_sparse(x);
+  TEST(s.nnz() == 300 && matrix_within_eps(to_dense(s), x, EPS));
+  TEST(to_sparse(x, .2).rows == 0);
+
+  Matrix w = random_matrix(30, 20), out(40, 20), g = random_matrix(40, 20);
+  sparse_multiply_into(out, s, w);
+  TEST(matrix_within_eps(out, x * w, EPS));
+  TEST(matrix_within_eps(sparse_transpose_multiply(s, g), x.transpose() * g, EPS));
+
+  // training on the CSR copy of a batch gives the same weights
+  Data batch(40, 30, 4);
+  batch.X = x;
+  for (int i = 0; i < 40; i++) batch.y(i, i % 4) = 1;
+  Model dense = {{Layer(30, 16, RELU), Layer(16, 4, SOFTMAX)}, CROSS_ENTROPY};
+  Model sparse = dense;
+  Optimizer o1 = sgd_optimizer(.1, .9, 0), o2 = sgd_optimizer(.1, .9, 0);
+  double density = sparse_max_density;
+  sparse_max_density = 0;
+  dense.train_batch(batch, o1);
+  sparse_max_density = .5;
+  sparse.train_batch(batch, o2);
+  sparse_max_density = density;
+  TEST(matrix_within_eps(dense.layers[0].w, sparse.layers[0].w, EPS) &&
+       matrix_within_eps(dense.layers[1].w, sparse.layers[1].w, EPS) && sparse.layers[0].in_sparse.rows == 0);
+}
+
+void test_memory_policy() {
+  memory_policy::Policy old = memory_policy::policy(), p;
+  p.huge_pages = true;
+  p.placement = memory_policy::INTERLEAVE;
+  memory_policy::set_policy(p);
+  Matrix big(1024, 512), small(10, 10);
+  TEST(big(1023, 511) == 0 && small(9, 9) == 0 && (uintptr_t) big.data % (2 << 20) < (64 << 10));
+  // a view shrunk in place (im2col, inference buffers) still releases its whole block
+  big.rows = 3;
+  small.cols = 1;
+  big = Matrix(4, 4);
+  memory_policy::set_policy(old);
+  TEST(big.rows == 4 && memory_policy::numa_nodes() >= 1);
+}
+
 void run_tests() {
   test_forward_linear();
   test_forward_logistic();
@@ -135,6 +554,19 @@ void run_tests() {
   test_backward_lrelu();
   test_backward_softmax();
 
+  test_data_store();
+  test_inference_engine();
+  test_quantized_model();
+  test_checkpoint();
+  test_sweep();
+  test_conv_layer();
+  test_maxpool_layer();
+  test_optimizer();
+  test_simd_math();
+  test_profiler();
+  test_sparse();
+  test_memory_policy();
+
   printf("%d tests, %d passed, %d failed\n", tests_total, tests_total - tests_fail, tests_fail);
 }
 
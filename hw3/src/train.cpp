@@ -1,5 +1,8 @@
 #include "matrix.h"
 #include "neural.h"
+#include "checkpoint.h"
+#include "profiler.h"
+#include "sweep.h"
 
 Dataset get_mnist(void) {
   return {read_mnist("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte"),
@@ -53,38 +56,66 @@ Model neural_net(int inputs, int outputs) {
           },  L2_LOSS};
 }
 
+// For 32x32x3 CIFAR images
+Model conv_net(int outputs) {
+  return {{
+              conv_layer(3, 32, 32, 16, 3, 1, 1, RELU),
+              maxpool_layer(16, 32, 32, 2, 2),
+              conv_layer(16, 16, 16, 32, 3, 1, 1, RELU),
+              maxpool_layer(32, 16, 16, 2, 2),
+              Layer(32 * 8 * 8, outputs, SOFTMAX)
+          }, CROSS_ENTROPY};
+}
+
 int main(int argc, char **argv) {
   // Set the verbose flag to true to enable debug prints!
   set_verbose(false);
 
+  // CSE576_PROFILE=trace.json ./train: per-layer timing table and Chrome trace
+  const char *trace = getenv("CSE576_PROFILE");
+  if (trace) profiler_enable(true);
+
   printf("Loading dataset\n");
-  // Dataset d = get_mnist();
-  Dataset d = get_cifar10();
+  // StoreDataset d = get_mnist_store();
+  StoreDataset d = get_cifar10_store();
 
   double batch = 128;
   double iters = 3000;
-  double rate = .01;
   double momentum = .9;
   double decay = .0;
   
-  // Model model = softmax_model(d.train.X.cols, d.train.y.cols);
-  //Model model = neural_net(d.train.X.cols,d.train.y.cols);
+  // Model model = softmax_model(d.train.size_x, d.train.size_y);
+  //Model model = neural_net(d.train.size_x,d.train.size_y);
+  // Model model = conv_net(d.train.size_y);
   printf("Training model...\n");
-  // model.train(d.train, batch, iters, rate, momentum, decay);
+  // Checkpointer checkpoint("model.ckpt", 500);   // optional, saved in the background
+  // model.train(d.train, batch, iters, .01, momentum, decay, &checkpoint);
   // printf("evaluating model...\n");
   // printf("training accuracy: %lf\n", model.accuracy(d.train));
   // printf("test accuracy:     %lf\n", model.accuracy(d.test));
 
-  for (double i = 0.1; i > -6; i -= 0.01)
-  {
-    rate = i;
-    printf("rate = %F\n", rate);
-    Model model = neural_net(d.train.X.cols, d.train.y.cols);
-    model.train(d.train, batch, iters, rate, momentum, decay);
-    printf("training accuracy: %lf\n", model.accuracy(d.train));
-    printf("test accuracy:     %lf\n", model.accuracy(d.test));
-  }
-  
+  // Learning rate sweep: the runs train concurrently on the shared dataset
+  SweepSpec spec;
+  spec.rates = log_range(1e-4, 0.3, 24);
+  spec.momenta = {momentum};
+  spec.decays = {decay};
+  spec.batches = {(int) batch};
+  spec.archs = {{{128, 64, 32}, RELU}};
+  spec.loss = L2_LOSS;
+  spec.iters = (int) iters;
+  spec.min_accuracy = 1.5 / d.train.size_y;   // stop runs no better than chance
 
+  vector<SweepResult> results = run_sweep(d.train, d.test, spec, 0, "sweep.tsv");
+  // pick on the held out training rows; the test set only reports the picks
+  sort(results.begin(), results.end(),
+       [](const SweepResult &a, const SweepResult &b) { return a.validation_accuracy > b.validation_accuracy; });
+  for (size_t i = 0; i < results.size() && i < 5; i++)
+    printf("rate = %F   validation accuracy: %lf   test accuracy: %lf\n", results[i].config.rate,
+           results[i].validation_accuracy, results[i].test_accuracy);
+
+  if (trace) {
+    profiler_summary();
+    profiler_write_trace(trace);
+  }
   return 0;
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <vector>
 #include <string>
 #include <chrono>
@@ -23,55 +26,27 @@ constexpr float TEST_EPS=0.005;
 inline bool within_eps(float a, float b) { return a-TEST_EPS<b && b<a+TEST_EPS; }
 
 
-class __ProfileScopeClass {
-  unsigned long long start;
-  const std::string fname;
-  const std::string name;
-  int level;
-  int line;
+// Split [0,n) into chunks of at most `chunk` items and process them on up to
+// `threads` threads (0 = one per core). Chunks are handed out dynamically.
+// body(begin, end, thread_index)
+inline void parallel_chunks(int n, int chunk, int threads, const std::function<void(int, int, int)> &body) {
+  if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::max(1, std::min(threads, (n + chunk - 1) / chunk));
 
-  static unsigned long long get_cpu_time_raw_int(void) {
-    //struct timespec t1;
-    //clock_gettime(CLOCK_REALTIME,&t1);
-    //return (unsigned long long)t1.tv_sec*(unsigned long long)1000000000+(unsigned long long)t1.tv_nsec;
-    long long c1 = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    return c1;
-  }
+  std::atomic<int> next(0);
+  auto worker = [&](int t) {
+    for (int begin = next.fetch_add(chunk); begin < n; begin = next.fetch_add(chunk))
+      body(begin, std::min(n, begin + chunk), t);
+  };
 
- public:
-
-  __ProfileScopeClass(int line, const std::string &fname, int level, const std::string &name = "")
-      : fname(fname), name(name), level(level), line(line) {
-    start = get_cpu_time_raw_int();
-  }
-
-  ~__ProfileScopeClass() {
-    if (level == 1)
-      printf("%30s(%4d) :  %lf ms\n",
-             (name + "@" + fname).c_str(),
-             line,
-             double(get_cpu_time_raw_int() - start) / 1e6);
-    if (level == 2)
-      printf("%30s(%4d) :  %lf us\n",
-             (name + "@" + fname).c_str(),
-             line,
-             double(get_cpu_time_raw_int() - start) / 1e3);
-    if (level == 3)
-      printf("%30s(%4d) :  %lf ns\n",
-             (name + "@" + fname).c_str(),
-             line,
-             double(get_cpu_time_raw_int() - start));
-  }
-
-};
+  std::vector<std::thread> th;
+  for (int t = 1; t < threads; t++) th.emplace_back(worker, t);
+  worker(0);
+  for (auto &e1:th) e1.join();
+}
 
 inline unsigned int myrand() { static std::mt19937 mt; return mt(); }
 
-#define COMBINE1(X, Y) X##Y
-#define COMBINE(X, Y) COMBINE1(X,Y)
-
-#define TIME(...) __ProfileScopeClass COMBINE(__t,__LINE__) (__LINE__,__FUNCTION__,__VA_ARGS__)
-
 #define NOT_IMPLEMENTED() do{static bool done=false;if(!done)fprintf(stderr,"Function \"%s\"  in file \"%s\" line %d not implemented yet!!!\n",__FUNCTION__, __FILE__, __LINE__);done=true;}while(0)
 
 
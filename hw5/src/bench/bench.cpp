@@ -0,0 +1,381 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../buffer_pool.h"
+#include "../image.h"
+#include "../matrix.h"
+#include "../memory_policy.h"
+#include "../perf_counters.h"
+#include "../simd_kernels.h"
+#include "../utils.h"
+
+using namespace std;
+
+// Micro and macro benchmarks of the image library.
+//
+// USAGE: ./bench [--filter substr] [--min-time s] [--reps n] [--json file] [--quick]
+//
+// Every benchmark runs once to warm up, then repeats until it has at least
+// --reps samples and --min-time seconds of samples. The table reports the
+// median time, the 95% confidence interval of the mean and the throughput
+// at the median (MPix/s of input pixels, GFLOP/s, or items/s). Every sample
+// goes to the JSON file (default bench.json), the input of bench_compare.
+//
+// Where the hardware counters can be read (perf_counters.h), the timed runs
+// are counted too: IPC, and LLC misses per input pixel as bytes (64 per
+// miss), which separates the compute bound kernels from the memory bound.
+// Run from hw5/ (the images are read from data/ and pano/).
+
+struct Bench
+  {
+  string name;      // kernel
+  string size;      // parameters, e.g. 1024x768x3
+  double work;      // units of work per run
+  string unit;      // "MPix", "GFLOP", "Kiter", ...
+  function<void()> setup;   // untimed, before every sample (may be empty)
+  function<void()> run;
+  };
+
+struct Result
+  {
+  const Bench* b;
+  vector<double> samples;   // seconds
+  double median,mean,stddev,ci95,min;
+  perf_counters::Sample counts;   // per run, empty without counters
+
+  // bytes from LLC misses per unit of work (per pixel for MPix), 0 if unknown
+  double llc_bytes_per_unit(void) const
+    {
+    if(!counts.has(perf_counters::LLC_MISSES))return 0;
+    return 64.*counts.value[perf_counters::LLC_MISSES]/(b->work*(b->unit=="MPix" ? 1e6 : 1));
+    }
+  };
+
+// Keep a result alive so the work is not optimized away
+static volatile float sink;
+static void consume(const Image& im) { if(im.size())sink=im.data[im.size()/2]; }
+static void consume(const Matrix& m) { if(m.rows && m.cols)sink=(float)m.data[0]; }
+
+static double seconds_since(chrono::steady_clock::time_point t0)
+  {
+  return chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+  }
+
+static string dims(const Image& im) { return to_string(im.w)+"x"+to_string(im.h)+"x"+to_string(im.c); }
+static double mpix(const Image& im) { return double(im.w)*im.h/1e6; }
+
+// Two-sided 95% Student t quantile for n-1 degrees of freedom
+static double t95(int n)
+  {
+  static const double t[]={0,12.706,4.303,3.182,2.776,2.571,2.447,2.365,2.306,2.262,2.228,2.201,2.179,2.160,2.145,2.131,2.120,2.110,2.101,2.093,2.086};
+  int dof=n-1;
+  if(dof<1)return 0;
+  if(dof<=20)return t[dof];
+  return dof<=30 ? 2.042 : dof<=60 ? 2.000 : 1.960;
+  }
+
+Result measure(const Bench& b, int reps, double min_time)
+  {
+  Result r;
+  r.b=&b;
+  if(b.setup)b.setup();
+  b.run();                           // warm up
+  double total=0;
+  perf_counters::Sample counts;
+  while((int)r.samples.size()<reps || (total<min_time && r.samples.size()<1000))
+    {
+    if(b.setup)b.setup();
+    perf_counters::Sample c0=perf_counters::read();
+    auto t0=chrono::steady_clock::now();
+    b.run();
+    double s=seconds_since(t0);
+    counts+=perf_counters::read()-c0;
+    r.samples.push_back(s);
+    total+=s;
+    }
+  vector<double> s=r.samples;
+  sort(s.begin(),s.end());
+  int n=(int)s.size();
+  r.median=n%2 ? s[n/2] : (s[n/2-1]+s[n/2])/2;
+  r.min=s[0];
+  r.mean=total/n;
+  double var=0;
+  for(double x:s)var+=(x-r.mean)*(x-r.mean);
+  r.stddev=n>1 ? sqrt(var/(n-1)) : 0;
+  r.ci95=t95(n)*r.stddev/sqrt(double(n));
+  r.counts=counts;
+  for(uint64_t& v:r.counts.value)v/=n;
+  return r;
+  }
+
+static string cpu_model(void)
+  {
+  ifstream f("/proc/cpuinfo");
+  string line;
+  while(getline(f,line))
+    if(line.compare(0,10,"model name")==0)
+      {
+      size_t p=line.find(':');
+      return p==string::npos ? line : line.substr(p+2);
+      }
+  return "unknown";
+  }
+
+static string host_name(void)
+  {
+  char buf[256]={0};
+  if(gethostname(buf,sizeof(buf)-1))return "unknown";
+  return buf;
+  }
+
+static string json_string(const string& s)
+  {
+  string res="\"";
+  for(char c:s)
+    {
+    if(c=='"' || c=='\\')res+='\\';
+    res+=c;
+    }
+  return res+"\"";
+  }
+
+bool write_json(const string& file, const vector<Result>& results)
+  {
+  FILE* fn=fopen(file.c_str(),"w");
+  if(!fn)
+    {
+    fprintf(stderr,"Cannot write \"%s\"\n",file.c_str());
+    return false;
+    }
+  fprintf(fn,"{\n\"host\": %s,\n\"cpu\": %s,\n\"compiler\": %s,\n\"simd\": %s,\n\"time\": %lld,\n\"results\": [",
+          json_string(host_name()).c_str(),json_string(cpu_model()).c_str(),json_string(__VERSION__).c_str(),
+          json_string(simd::kernels().name).c_str(),(long long)time(nullptr));
+  for(size_t q1=0;q1<results.size();q1++)
+    {
+    const Result& r=results[q1];
+    fprintf(fn,"%s\n{\"name\": %s, \"size\": %s, \"unit\": %s, \"work\": %.9g, \"median\": %.9g, \"mean\": %.9g, "
+               "\"stddev\": %.9g, \"ci95\": %.9g, \"min\": %.9g, \"throughput\": %.9g, ",
+            q1 ? "," : "",json_string(r.b->name).c_str(),json_string(r.b->size).c_str(),json_string(r.b->unit).c_str(),
+            r.b->work,r.median,r.mean,r.stddev,r.ci95,r.min,r.b->work/r.median);
+    if(r.counts.valid)
+      {
+      // per run
+      fprintf(fn,"\"ipc\": %.4f, \"llc_bytes_per_unit\": %.4f, \"counters\": {",r.counts.ipc(),r.llc_bytes_per_unit());
+      const char* sep="";
+      for(int c=0;c<perf_counters::COUNTERS;c++)
+        if(r.counts.has(perf_counters::Counter(c)))
+          {
+          fprintf(fn,"%s\"%s\": %llu",sep,perf_counters::name(perf_counters::Counter(c)),
+                  (unsigned long long)r.counts.value[c]);
+          sep=", ";
+          }
+      fprintf(fn,"}, ");
+      }
+    fprintf(fn,"\"samples\": [");
+    for(size_t q2=0;q2<r.samples.size();q2++)fprintf(fn,"%s%.9g",q2 ? ", " : "",r.samples[q2]);
+    fprintf(fn,"]}");
+    }
+  fprintf(fn,"\n]\n}\n");
+  return fclose(fn)==0;
+  }
+
+// The benchmarks. Inputs are loaded once and captured by the closures.
+vector<Bench> make_benches(bool quick)
+  {
+  vector<Bench> res;
+  auto add=[&](const string& name, const string& size, double work, const string& unit, function<void()> run,
+               function<void()> setup=nullptr){ res.push_back({name,size,work,unit,setup,run}); };
+
+  // Image sizes: dog (small), Rainier (medium), an upscaled Rainier (large)
+  vector<Image> rgb;
+  rgb.push_back(load_image("data/dog.jpg"));
+  rgb.push_back(load_image("pano/rainier/Rainier1.png"));
+  if(!quick)rgb.push_back(bilinear_resize(rgb[1],rgb[1].w*2,rgb[1].h*2));
+
+  for(const Image& im:rgb)
+    {
+    Image gray=rgb_to_grayscale(im);
+    string d=dims(im),dg=dims(gray);
+    double mp=mpix(im);
+
+    // Filtering
+    for(int fs:{3,7})
+      {
+      Image box=make_box_filter(fs);
+      add("convolve_box"+to_string(fs),d,mp,"MPix",[=](){ consume(convolve_image(im,box,true)); });
+      }
+    Image g2=make_gaussian_filter(2);
+    add("convolve_gauss2",dg,mp,"MPix",[=](){ consume(convolve_image(gray,g2,false)); });
+    add("smooth_sigma2",dg,mp,"MPix",[=](){ consume(smooth_image(gray,2)); });
+    add("sobel",dg,mp,"MPix",[=](){ consume(sobel_image(gray).first); });
+
+    // Resizing (throughput in output pixels)
+    add("bilinear_resize_x2",d,4*mp,"MPix",[=](){ consume(bilinear_resize(im,im.w*2,im.h*2)); });
+    add("bilinear_resize_half",d,mp/4,"MPix",[=](){ consume(bilinear_resize(im,im.w/2,im.h/2)); });
+    add("nearest_resize_x2",d,4*mp,"MPix",[=](){ consume(nearest_resize(im,im.w*2,im.h*2)); });
+
+    // Colour conversion
+    add("rgb_to_grayscale",d,mp,"MPix",[=](){ consume(rgb_to_grayscale(im)); });
+    auto hsv=make_shared<Image>();
+    add("rgb_to_hsv",d,mp,"MPix",[=](){ rgb_to_hsv(*hsv); consume(*hsv); },[=](){ *hsv=im; });
+
+    // Harris stages
+    Image S=structure_matrix(gray,2);
+    Image R=cornerness_response(S,0);
+    Image N=nms_image(R,3);
+    add("harris_structure",dg,mp,"MPix",[=](){ consume(structure_matrix(gray,2)); });
+    Gray8 gray8=to_gray8(gray);
+    add("harris_structure_u8",dg,mp,"MPix",[=](){ consume(structure_matrix(gray8,2)); });
+    add("harris_response",dg,mp,"MPix",[=](){ consume(cornerness_response(S,0)); });
+    add("harris_nms3",dg,mp,"MPix",[=](){ consume(nms_image(R,3)); });
+    add("harris_describe",dg,mp,"MPix",[=](){ sink=(float)detect_corners(gray,N,0.4f,5).size(); });
+    add("harris_detector",d,mp,"MPix",[=](){ sink=(float)harris_corner_detector(im,2,0.4f,5,3,0).size(); });
+
+    // FAST-9, in corners found per second
+    double kc=fast9_corners(gray8,FAST_THRESHOLD,3,false).size()/1e3;
+    add("fast9_corners",dg,kc,"Kcorner",[=](){ sink=(float)fast9_corners(gray8,FAST_THRESHOLD,3,false).size(); });
+    add("fast9_harris_corners",dg,fast9_corners(gray8,FAST_THRESHOLD,3,true).size()/1e3,"Kcorner",
+        [=](){ sink=(float)fast9_corners(gray8,FAST_THRESHOLD,3,true).size(); });
+    add("fast9_detector",d,kc,"Kcorner",[=](){ sink=(float)fast_corner_detector(im,FAST_THRESHOLD,5,3,false).size(); });
+    add("dog_detector",d,mp,"MPix",[=](){ sink=(float)dog_detector(im,DOG_THRESHOLD,7).size(); });
+
+    // Descriptors of every FAST corner (no NMS), into one block
+    auto pts=make_shared<vector<Point>>(fast9_corners(gray8,FAST_THRESHOLD,0,false));
+    auto block=make_shared<vector<float>>(pts->size()*descriptor_size(im,7));
+    add("describe_points",d+"/w7",pts->size()/1e3,"Kcorner",[=](){ describe_points(block->data(),im,*pts,7); sink=(*block)[0]; });
+    add("describe_corners",d+"/w7",pts->size()/1e3,"Kcorner",[=](){ sink=(float)describe_corners(im,*pts,7).size(); });
+
+    // Warping
+    add("cylindrical_project",d,mp,"MPix",[=](){ consume(cylindrical_project(im,1200)); });
+    }
+
+  // Matching, RANSAC and stitching on a real pair
+    {
+    Image a=load_image("pano/rainier/Rainier1.png");
+    Image b=load_image("pano/rainier/Rainier2.png");
+    auto ad=make_shared<vector<Descriptor>>(harris_corner_detector(a,2,0.4f,5,3,0));
+    auto bd=make_shared<vector<Descriptor>>(harris_corner_detector(b,2,0.4f,5,3,0));
+    auto m=make_shared<vector<Match>>(match_descriptors(*ad,*bd));
+    string pair=to_string(ad->size())+"x"+to_string(bd->size())+"x"+to_string(ad->empty() ? 0 : (*ad)[0].data.size());
+    // l1 distance: subtract, abs, add per element, both directions
+    double flops=2*3.*ad->size()*bd->size()*(ad->empty() ? 0 : (*ad)[0].data.size())/1e9;
+    add("match_descriptors",pair,flops,"GFLOP",[=](){ sink=(float)match_descriptors(*ad,*bd).size(); });
+
+    int iters=quick ? 500 : 2000;
+    // cutoff above the match count: always runs all iterations
+    add("ransac",to_string(m->size())+"m/"+to_string(iters)+"it",iters/1e3,"Kiter",
+        [=](){ consume(RANSAC(*m,5,iters,(int)m->size()+1)); });
+
+    Matrix H=RANSAC(*m,5,10000,50);
+    add("combine_images",dims(a)+"+"+dims(b),mpix(a)+mpix(b),"MPix",[=](){ consume(combine_images(a,b,H,0.5f)); });
+    }
+
+  // GEMM
+  for(int n:{128,256,512})
+    {
+    if(quick && n>256)continue;
+    Matrix A=random_matrix(n,n),B=random_matrix(n,n);
+    add("gemm",to_string(n)+"x"+to_string(n)+"x"+to_string(n),2.*n*n*n/1e9,"GFLOP",[=](){ consume(A*B); });
+    }
+
+  // Page size: random reads and a linear pass over a large buffer in 4 KB
+  // and in 2 MB pages (memory_policy). Past the reach of the TLB nearly
+  // every random read walks the page table with 4 KB pages.
+  size_t mb=quick ? 64 : 512;
+  for(bool huge:{false,true})
+    {
+    memory_policy::Policy p=memory_policy::policy(),old=p;
+    p.huge_pages=huge;
+    memory_policy::set_policy(p);
+    size_t n=mb<<17;    // doubles
+    auto buf=make_shared<Matrix>((int)n,1);
+    memory_policy::set_policy(old);
+    for(size_t q1=0;q1<n;q1++)buf->data[q1]=(double)q1;
+    string size=to_string(mb)+"MB/"+(huge ? "2m" : "4k")+"pages";
+    const int reads=1<<22;
+    add("memory_gather",size,reads/1e6,"Mread",[=]()
+      {
+      const double* d=buf->data;
+      uint64_t x=1;
+      double s=0;
+      for(int q1=0;q1<reads;q1++)
+        {
+        x=x*6364136223846793005ull+1442695040888963407ull;
+        s+=d[(x>>20)&(n-1)];
+        }
+      sink=(float)s;
+      });
+    add("memory_stream",size,n*sizeof(double)/1e9,"GB",[=]()
+      {
+      const double* d=buf->data;
+      double s0=0,s1=0,s2=0,s3=0;
+      for(size_t q1=0;q1<n;q1+=4){ s0+=d[q1]; s1+=d[q1+1]; s2+=d[q1+2]; s3+=d[q1+3]; }
+      sink=(float)(s0+s1+s2+s3);
+      });
+    }
+
+  return res;
+  }
+
+int main(int argc, char **argv)
+  {
+  string filter,json="bench.json";
+  double min_time=0.3;
+  int reps=5;
+  bool quick=false;
+  for(int q1=1;q1<argc;q1++)
+    {
+    string a=argv[q1];
+    if(a=="--filter" && q1+1<argc)filter=argv[++q1];
+    else if(a=="--min-time" && q1+1<argc)min_time=atof(argv[++q1]);
+    else if(a=="--reps" && q1+1<argc)reps=atoi(argv[++q1]);
+    else if(a=="--json" && q1+1<argc)json=argv[++q1];
+    else if(a=="--quick"){ quick=true; min_time=0.05; reps=3; }
+    else
+      {
+      fprintf(stderr,"usage: %s [--filter substr] [--min-time s] [--reps n] [--json file] [--quick]\n",argv[0]);
+      return -1;
+      }
+    }
+  
+  vector<Bench> benches=make_benches(quick);
+  vector<Result> results;
+  printf("simd kernels: %s\n",simd::kernels().name);
+  if(!memory_policy::huge_pages_supported())
+    fprintf(stderr,"transparent huge pages disabled: the 2m page benchmarks use 4 KB pages\n");
+  if(!perf_counters::available())
+    fprintf(stderr,"hardware counters unavailable, %s: IPC and B/pix left out\n",perf_counters::unavailable_reason());
+  printf("%-22s %-20s %6s %12s %10s %14s %6s %8s\n","kernel","size","runs","median ms","±95% ms","throughput","IPC",
+         "B/pix");
+  for(const Bench& b:benches)
+    {
+    if(!filter.empty() && b.name.find(filter)==string::npos)continue;
+    results.push_back(measure(b,reps,min_time));
+    const Result& r=results.back();
+    char tp[64];
+    snprintf(tp,sizeof(tp),"%.3f %s/s",b.work/r.median,b.unit.c_str());
+    char ipc[16]="-",bpp[16]="-";
+    if(r.counts.ipc()>0)snprintf(ipc,sizeof(ipc),"%.2f",r.counts.ipc());
+    if(b.unit=="MPix" && r.counts.has(perf_counters::LLC_MISSES))snprintf(bpp,sizeof(bpp),"%.2f",r.llc_bytes_per_unit());
+    printf("%-22s %-20s %6zu %12.3lf %10.3lf %14s %6s %8s\n",b.name.c_str(),b.size.c_str(),r.samples.size(),
+           r.median*1e3,r.ci95*1e3,tp,ipc,bpp);
+    fflush(stdout);
+    }
+  buffer_pool::Stats pool=buffer_pool::stats();
+  printf("buffer pool: %.1f%% hit rate (%llu hits, %llu misses), peak %.1f MB cached\n",100*pool.hit_rate(),
+         (unsigned long long)pool.hits,(unsigned long long)pool.misses,pool.peak_cached_bytes/1048576.);
+  if(!write_json(json,results))return -1;
+  printf("results written to %s\n",json.c_str());
+  return 0;
+  }
@@ -0,0 +1,294 @@
+#include <unistd.h>
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace std;
+
+// Performance regression gate: compares a bench JSON run with the stored
+// baseline of this machine.
+//
+// USAGE: ./bench_compare [options] new.json
+//   --baseline-dir dir     per-host baselines, <dir>/<hostname>.json (default bench_baselines)
+//   --baseline file        compare with this file instead
+//   --threshold pct        slowdown flagged as a regression (default 10)
+//   --update               store new.json as the baseline after comparing
+//   --record-if-missing    without a baseline, store new.json and pass
+//
+// A kernel (name and size) regresses when its mean time grew by more than
+// the threshold AND the 95% confidence interval of the change (Welch) is
+// entirely above 0; it improved when symmetrically faster. Anything else is
+// noise. The exit status is 1 if any kernel regressed.
+
+struct Entry
+  {
+  string name,size,unit;
+  vector<double> samples;
+  double median=0;
+  };
+
+// Just enough of a JSON reader for bench output: objects, arrays, strings,
+// numbers. Each object of "results" becomes an Entry.
+struct Reader
+  {
+  string s;
+  size_t p=0;
+  bool ok=true;
+
+  void ws(void) { while(p<s.size() && isspace((unsigned char)s[p]))p++; }
+  bool eat(char c) { ws(); if(p<s.size() && s[p]==c){ p++; return true; } return false; }
+
+  string str(void)
+    {
+    string res;
+    if(!eat('"')){ ok=false; return res; }
+    while(p<s.size() && s[p]!='"')
+      {
+      if(s[p]=='\\' && p+1<s.size())p++;
+      res+=s[p++];
+      }
+    p++;
+    return res;
+    }
+
+  double num(void)
+    {
+    ws();
+    char* end;
+    double v=strtod(s.c_str()+p,&end);
+    if(end==s.c_str()+p)ok=false;
+    p=end-s.c_str();
+    return v;
+    }
+
+  // Skip any value
+  void skip(void)
+    {
+    ws();
+    if(p>=s.size()){ ok=false; return; }
+    if(s[p]=='"')str();
+    else if(s[p]=='{' || s[p]=='[')
+      {
+      char close=s[p]=='{' ? '}' : ']';
+      p++;
+      if(eat(close))return;
+      do
+        {
+        if(close=='}'){ str(); if(!eat(':')){ ok=false; return; } }
+        skip();
+        } while(ok && eat(','));
+      if(!eat(close))ok=false;
+      }
+    else if(isalpha((unsigned char)s[p]))while(p<s.size() && isalpha((unsigned char)s[p]))p++;
+    else num();
+    }
+
+  Entry entry(void)
+    {
+    Entry e;
+    if(!eat('{')){ ok=false; return e; }
+    if(eat('}'))return e;
+    do
+      {
+      string key=str();
+      if(!eat(':')){ ok=false; break; }
+      if(key=="name")e.name=str();
+      else if(key=="size")e.size=str();
+      else if(key=="unit")e.unit=str();
+      else if(key=="median")e.median=num();
+      else if(key=="samples")
+        {
+        if(!eat('[')){ ok=false; break; }
+        if(!eat(']'))
+          {
+          do e.samples.push_back(num()); while(ok && eat(','));
+          if(!eat(']'))ok=false;
+          }
+        }
+      else skip();
+      } while(ok && eat(','));
+    if(!eat('}'))ok=false;
+    return e;
+    }
+
+  // {"...": ..., "results": [ {...}, ... ]}
+  vector<Entry> results(void)
+    {
+    vector<Entry> res;
+    if(!eat('{')){ ok=false; return res; }
+    do
+      {
+      string key=str();
+      if(!eat(':')){ ok=false; break; }
+      if(key!="results"){ skip(); continue; }
+      if(!eat('[')){ ok=false; break; }
+      if(eat(']'))continue;
+      do res.push_back(entry()); while(ok && eat(','));
+      if(!eat(']'))ok=false;
+      } while(ok && eat(','));
+    return res;
+    }
+  };
+
+static bool read_file(const string& file, string& out)
+  {
+  ifstream f(file,ios::binary);
+  if(!f)return false;
+  stringstream ss;
+  ss<<f.rdbuf();
+  out=ss.str();
+  return true;
+  }
+
+bool load_results(const string& file, vector<Entry>& res)
+  {
+  Reader r;
+  if(!read_file(file,r.s))return false;
+  res=r.results();
+  if(!r.ok)fprintf(stderr,"Malformed bench JSON \"%s\" near byte %zu\n",file.c_str(),r.p);
+  return r.ok;
+  }
+
+static bool copy_file(const string& from, const string& to)
+  {
+  string data;
+  if(!read_file(from,data))return false;
+  string tmp=to+".tmp";
+  FILE* fn=fopen(tmp.c_str(),"wb");
+  if(!fn)return false;
+  bool ok=fwrite(data.data(),1,data.size(),fn)==data.size();
+  ok&=fclose(fn)==0;
+  return ok && rename(tmp.c_str(),to.c_str())==0;
+  }
+
+static void mean_var(const vector<double>& x, double& mean, double& var)
+  {
+  mean=var=0;
+  for(double v:x)mean+=v;
+  mean/=x.size();
+  for(double v:x)var+=(v-mean)*(v-mean);
+  var=x.size()>1 ? var/(x.size()-1) : 0;
+  }
+
+// Two-sided 95% Student t quantile
+static double t95(double dof)
+  {
+  static const double t[]={0,12.706,4.303,3.182,2.776,2.571,2.447,2.365,2.306,2.262,2.228,2.201,2.179,2.160,2.145,2.131,2.120,2.110,2.101,2.093,2.086};
+  int d=(int)floor(dof);
+  if(d<1)return t[1];
+  if(d<=20)return t[d];
+  return d<=30 ? 2.042 : d<=60 ? 2.000 : 1.960;
+  }
+
+struct Change
+  {
+  double base,now;     // mean seconds
+  double rel,ci;       // relative change of the mean and its 95% half-width
+  };
+
+// Welch interval of mean(now) - mean(base), relative to mean(base)
+Change compare(const Entry& base, const Entry& now)
+  {
+  Change c;
+  double vb,vn;
+  mean_var(base.samples,c.base,vb);
+  mean_var(now.samples,c.now,vn);
+  double sb=vb/base.samples.size(),sn=vn/now.samples.size();
+  double se=sqrt(sb+sn);
+  double dof=se>0 ? (sb+sn)*(sb+sn)/((base.samples.size()>1 ? sb*sb/(base.samples.size()-1) : 0)+
+                                       (now.samples.size()>1 ? sn*sn/(now.samples.size()-1) : 0)+1e-300) : 1;
+  c.rel=(c.now-c.base)/c.base;
+  c.ci=t95(dof)*se/c.base;
+  return c;
+  }
+
+static string host_name(void)
+  {
+  char buf[256]={0};
+  if(gethostname(buf,sizeof(buf)-1))return "unknown";
+  return buf;
+  }
+
+int main(int argc, char **argv)
+  {
+  string dir="bench_baselines",baseline,now_file;
+  double threshold=10;
+  bool update=false,record_missing=false;
+  for(int q1=1;q1<argc;q1++)
+    {
+    string a=argv[q1];
+    if(a=="--baseline-dir" && q1+1<argc)dir=argv[++q1];
+    else if(a=="--baseline" && q1+1<argc)baseline=argv[++q1];
+    else if(a=="--threshold" && q1+1<argc)threshold=atof(argv[++q1]);
+    else if(a=="--update")update=true;
+    else if(a=="--record-if-missing")record_missing=true;
+    else if(now_file.empty() && a[0]!='-')now_file=a;
+    else
+      {
+      fprintf(stderr,"usage: %s [--baseline-dir dir] [--baseline file] [--threshold pct] [--update] [--record-if-missing] new.json\n",argv[0]);
+      return 2;
+      }
+    }
+  if(now_file.empty())now_file="bench.json";
+  if(baseline.empty())baseline=dir+"/"+host_name()+".json";
+
+  vector<Entry> now,base;
+  if(!load_results(now_file,now))
+    {
+    fprintf(stderr,"Cannot read \"%s\"\n",now_file.c_str());
+    return 2;
+    }
+  auto store=[&]()
+    {
+    mkdir(dir.c_str(),0755);
+    if(!copy_file(now_file,baseline))
+      {
+      fprintf(stderr,"Cannot store baseline \"%s\"\n",baseline.c_str());
+      return false;
+      }
+    printf("baseline stored in %s\n",baseline.c_str());
+    return true;
+    };
+  if(!load_results(baseline,base))
+    {
+    if(record_missing || update)return store() ? 0 : 2;
+    fprintf(stderr,"No baseline \"%s\" (run with --record-if-missing)\n",baseline.c_str());
+    return 2;
+    }
+
+  map<pair<string,string>,const Entry*> index;
+  for(const Entry& e:base)index[{e.name,e.size}]=&e;
+
+  int regressions=0,improvements=0,same=0,missing=0;
+  printf("%-22s %-20s %10s %10s %16s\n","kernel","size","base ms","new ms","change ±95%");
+  for(const Entry& e:now)
+    {
+    auto it=index.find({e.name,e.size});
+    if(it==index.end() || e.samples.empty() || it->second->samples.empty())
+      {
+      missing++;
+      continue;
+      }
+    Change c=compare(*it->second,e);
+    const char* mark="";
+    if(c.rel*100>threshold && c.rel-c.ci>0){ mark="  REGRESSION"; regressions++; }
+    else if(-c.rel*100>threshold && c.rel+c.ci<0){ mark="  faster"; improvements++; }
+    else same++;
+    printf("%-22s %-20s %10.3lf %10.3lf %+7.1lf%% ±%5.1lf%%%s\n",e.name.c_str(),e.size.c_str(),c.base*1e3,c.now*1e3,
+           100*c.rel,100*c.ci,mark);
+    }
+  printf("%d regressed, %d faster, %d unchanged (threshold %.0lf%%)",regressions,improvements,same,threshold);
+  if(missing)printf(", %d not in the baseline",missing);
+  printf("\n");
+
+  if(update && !store())return 2;
+  return regressions ? 1 : 0;
+  }
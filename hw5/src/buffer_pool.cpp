@@ -0,0 +1,191 @@
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "memory_policy.h"
+
+using namespace std;
+
+namespace buffer_pool
+  {
+
+  struct SizeClass
+    {
+    vector<void*> blocks;
+    uint64_t hits=0;
+    uint64_t misses=0;
+    };
+
+  struct Pool
+    {
+    mutex lock;
+    map<size_t,SizeClass> classes;
+    size_t capacity;
+    Stats stats;
+
+    Pool()
+      {
+      const char* env=getenv("CSE576_POOL_MB");
+      capacity=size_t((env ? atof(env) : 256)*1048576);
+      }
+
+    // free cached blocks until at most limit bytes stay; lock held
+    void shrink(size_t limit)
+      {
+      for(auto& e1:classes)
+        while(stats.cached_bytes>limit && !e1.second.blocks.empty())
+          {
+          memory_policy::release(e1.second.blocks.back());
+          e1.second.blocks.pop_back();
+          stats.cached_bytes-=e1.first;
+          stats.cached_blocks--;
+          }
+      }
+    };
+
+  // never destroyed: images of other files release blocks during static destruction
+  static Pool& pool(void)
+    {
+    static Pool* p=new Pool;
+    return *p;
+    }
+
+  size_t size_class(size_t bytes)
+    {
+    if(bytes<MIN_BYTES)return bytes;
+    size_t step=(size_t(1)<<(63-__builtin_clzll(bytes-1)))>>3;
+    return (bytes+step-1)/step*step;
+    }
+
+  void* acquire(size_t bytes, bool zero)
+    {
+    size_t size=size_class(bytes);
+    if(bytes>=MIN_BYTES)
+      {
+      Pool& p=pool();
+      void* block=nullptr;
+        {
+        lock_guard<mutex> guard(p.lock);
+        SizeClass& sc=p.classes[size];
+        if(!sc.blocks.empty())
+          {
+          block=sc.blocks.back();
+          sc.blocks.pop_back();
+          sc.hits++;
+          p.stats.hits++;
+          p.stats.cached_bytes-=size;
+          p.stats.cached_blocks--;
+          }
+        else
+          {
+          sc.misses++;
+          p.stats.misses++;
+          }
+        }
+      if(block)
+        {
+        if(zero)memset(block,0,bytes);
+        return block;
+        }
+      }
+    return memory_policy::allocate(size,zero);
+    }
+
+  void release(void* block, size_t bytes)
+    {
+    if(!block)return;
+    if(bytes>=MIN_BYTES)
+      {
+      size_t size=size_class(bytes);
+      Pool& p=pool();
+      lock_guard<mutex> guard(p.lock);
+      if(p.stats.cached_bytes+size<=p.capacity)
+        {
+        p.classes[size].blocks.push_back(block);
+        p.stats.cached_bytes+=size;
+        p.stats.cached_blocks++;
+        p.stats.peak_cached_bytes=max(p.stats.peak_cached_bytes,p.stats.cached_bytes);
+        return;
+        }
+      p.stats.dropped++;
+      }
+    memory_policy::release(block);
+    }
+
+  void set_capacity(size_t bytes)
+    {
+    Pool& p=pool();
+    lock_guard<mutex> guard(p.lock);
+    p.capacity=bytes;
+    p.shrink(bytes);
+    }
+
+  size_t capacity(void)
+    {
+    Pool& p=pool();
+    lock_guard<mutex> guard(p.lock);
+    return p.capacity;
+    }
+
+  void trim(void)
+    {
+    Pool& p=pool();
+    lock_guard<mutex> guard(p.lock);
+    p.shrink(0);
+    }
+
+  Stats stats(void)
+    {
+    Pool& p=pool();
+    lock_guard<mutex> guard(p.lock);
+    return p.stats;
+    }
+
+  void reset_stats(void)
+    {
+    Pool& p=pool();
+    lock_guard<mutex> guard(p.lock);
+    p.stats.hits=p.stats.misses=p.stats.dropped=0;
+    p.stats.peak_cached_bytes=p.stats.cached_bytes;
+    for(auto& e1:p.classes)e1.second.hits=e1.second.misses=0;
+    }
+
+  void report(FILE* out)
+    {
+    Pool& p=pool();
+    lock_guard<mutex> guard(p.lock);
+    const Stats& s=p.stats;
+    fprintf(out,"buffer pool: %llu hits, %llu misses (%.1f%% hit rate), %llu dropped, %.1f MB cached in %zu blocks "
+            "(peak %.1f MB, capacity %.0f MB)\n",(unsigned long long)s.hits,(unsigned long long)s.misses,
+            100*s.hit_rate(),(unsigned long long)s.dropped,s.cached_bytes/1048576.,s.cached_blocks,
+            s.peak_cached_bytes/1048576.,p.capacity/1048576.);
+    if(p.classes.empty())return;
+    fprintf(out,"%12s %10s %10s %8s %8s\n","class KB","hits","misses","hit %","cached");
+    for(const auto& e1:p.classes)
+      {
+      const SizeClass& sc=e1.second;
+      if(!sc.hits && !sc.misses && sc.blocks.empty())continue;
+      fprintf(out,"%12.1f %10llu %10llu %8.1f %8zu\n",e1.first/1024.,(unsigned long long)sc.hits,
+              (unsigned long long)sc.misses,sc.hits+sc.misses ? 100.*sc.hits/(sc.hits+sc.misses) : 0.,
+              sc.blocks.size());
+      }
+    }
+
+  // Hit rates at exit when CSE576_PROFILE is set
+  struct ExitReport
+    {
+    ~ExitReport()
+      {
+      if(!getenv("CSE576_PROFILE"))return;
+      Stats s=stats();
+      if(s.hits+s.misses)report(stderr);
+      }
+    };
+  static ExitReport exit_report;
+  }
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Recycled memory blocks for image sized buffers.
+//
+// A pipeline allocates the same few frame sizes over and over (gradients,
+// structure matrix, response, canvases). Fresh large blocks come from mmap:
+// a system call, a page fault per 4 KB and zeroing by the kernel, each
+// time. Blocks of at least MIN_BYTES are therefore rounded up to a size
+// class (8 per doubling, less than 12.5% slack) and on release kept in a
+// free list of their class, up to capacity() bytes in all; a later
+// acquire of the same class reuses one. Smaller blocks go to malloc
+// directly, it already recycles them. The blocks themselves come from
+// memory_policy (huge pages, NUMA placement).
+//
+// All functions are thread safe (one mutex, taken only for large blocks).
+// CSE576_POOL_MB sets the capacity (default 256, 0 disables caching), and
+// with CSE576_PROFILE set the hit rates are printed at exit.
+
+namespace buffer_pool
+  {
+
+  static const size_t MIN_BYTES = 64 << 10;
+
+  // A block of at least bytes, zeroed if zero; throws bad_alloc
+  void* acquire(size_t bytes, bool zero);
+  // Return a block of acquire(bytes,..)
+  void release(void* block, size_t bytes);
+
+  // bytes an acquire(bytes) block really has
+  size_t size_class(size_t bytes);
+
+  // Cached bytes kept at most; lowering it frees blocks
+  void set_capacity(size_t bytes);
+  size_t capacity(void);
+  // free every cached block
+  void trim(void);
+
+  struct Stats
+    {
+    uint64_t hits=0;          // acquires served from the pool
+    uint64_t misses=0;        // large acquires that allocated
+    uint64_t dropped=0;       // releases freed because of the capacity
+    size_t cached_bytes=0;
+    size_t cached_blocks=0;
+    size_t peak_cached_bytes=0;
+
+    double hit_rate(void) const { return hits+misses ? double(hits)/(hits+misses) : 0; }
+    };
+
+  Stats stats(void);
+  void reset_stats(void);
+  // totals and hits/misses per size class
+  void report(FILE* out=stderr);
+  }
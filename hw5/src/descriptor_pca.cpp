@@ -0,0 +1,149 @@
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+
+#include <algorithm>
+
+#include "descriptor_pca.h"
+
+using namespace std;
+
+static const char MAGIC[4] = {'P','C','A','1'};
+
+static Matrix offset_of(const Matrix& mean, const Matrix& basis) { return mean * basis; }
+
+DescriptorPCA DescriptorPCA::first(int n) const
+  {
+  DescriptorPCA r;
+  r.dim = dim;
+  r.k = min(max(n, 0), k);
+  r.mean = mean;
+  r.basis = Matrix(dim, r.k);
+  for (int q1 = 0; q1 < dim; q1++)
+    for (int q2 = 0; q2 < r.k; q2++) r.basis(q1, q2) = basis(q1, q2);
+  r.offset = offset_of(r.mean, r.basis);
+  r.variance.assign(variance.begin(), variance.begin() + r.k);
+  return r;
+  }
+
+// The covariance of the samples and its eigenvectors of the k largest
+// eigenvalues.
+DescriptorPCA learn_descriptor_pca(const Matrix& samples, int k)
+  {
+  TIME(1);
+  const int n = samples.rows, dim = samples.cols;
+  assert(n > 1 && dim > 0 && "need samples to learn from");
+  DescriptorPCA pca;
+  pca.dim = dim;
+  pca.k = min(max(k, 1), dim);
+
+  pca.mean = Matrix(1, dim);
+  for (int q1 = 0; q1 < n; q1++)
+    for (int q2 = 0; q2 < dim; q2++) pca.mean(0, q2) += samples(q1, q2);
+  pca.mean = pca.mean / n;
+
+  Matrix centered(n, dim);
+  for (int q1 = 0; q1 < n; q1++)
+    for (int q2 = 0; q2 < dim; q2++) centered(q1, q2) = samples(q1, q2) - pca.mean(0, q2);
+  Matrix cov = (centered.transpose() * centered) / (n - 1);
+
+  Matrix values;
+  Matrix vectors = symmetric_eigen(cov, values);
+  pca.basis = Matrix(dim, pca.k);
+  for (int q1 = 0; q1 < dim; q1++)
+    for (int q2 = 0; q2 < pca.k; q2++) pca.basis(q1, q2) = vectors(q1, q2);
+  for (int q = 0; q < pca.k; q++) pca.variance.push_back(max(values(q), 0.));
+  pca.offset = offset_of(pca.mean, pca.basis);
+  return pca;
+  }
+
+static void write_floats(FILE* fn, const double* p, size_t n)
+  {
+  vector<float> f(p, p + n);
+  fwrite(f.data(), sizeof(float), n, fn);
+  }
+
+static bool read_floats(FILE* fn, double* p, size_t n)
+  {
+  vector<float> f(n);
+  if (fread(f.data(), sizeof(float), n, fn) != n) return false;
+  copy(f.begin(), f.end(), p);
+  return true;
+  }
+
+bool save_descriptor_pca(const DescriptorPCA& pca, const string& filename)
+  {
+  FILE* fn = fopen(filename.c_str(), "wb");
+  if (!fn)
+    {
+    fprintf(stderr, "Cannot write PCA basis \"%s\"\n", filename.c_str());
+    return false;
+    }
+  fwrite(MAGIC, 1, sizeof(MAGIC), fn);
+  fwrite(&pca.dim, sizeof(pca.dim), 1, fn);
+  fwrite(&pca.k, sizeof(pca.k), 1, fn);
+  write_floats(fn, pca.mean.data, pca.dim);
+  write_floats(fn, pca.basis.data, size_t(pca.dim) * pca.k);
+  write_floats(fn, pca.variance.data(), pca.k);
+  bool ok = !ferror(fn);
+  fclose(fn);
+  return ok;
+  }
+
+DescriptorPCA load_descriptor_pca(const string& filename, int k)
+  {
+  DescriptorPCA pca;
+  FILE* fn = fopen(filename.c_str(), "rb");
+  char magic[4];
+  bool ok = fn && fread(magic, 1, 4, fn) == 4 && !memcmp(magic, MAGIC, 4) &&
+            fread(&pca.dim, sizeof(pca.dim), 1, fn) == 1 && fread(&pca.k, sizeof(pca.k), 1, fn) == 1 &&
+            pca.dim > 0 && pca.k > 0 && pca.k <= pca.dim;
+  if (ok)
+    {
+    pca.mean = Matrix(1, pca.dim);
+    pca.basis = Matrix(pca.dim, pca.k);
+    pca.variance.resize(pca.k);
+    ok = read_floats(fn, pca.mean.data, pca.dim) && read_floats(fn, pca.basis.data, size_t(pca.dim) * pca.k) &&
+         read_floats(fn, pca.variance.data(), pca.k);
+    }
+  if (fn) fclose(fn);
+  if (!ok)
+    {
+    fprintf(stderr, "Cannot load PCA basis \"%s\"\n", filename.c_str());
+    return DescriptorPCA();
+    }
+  pca.offset = offset_of(pca.mean, pca.basis);
+  return k > 0 && k < pca.k ? pca.first(k) : pca;
+  }
+
+Matrix descriptor_matrix(const vector<Descriptor>& d)
+  {
+  const int dim = d.empty() ? 0 : (int)d[0].data.size();
+  Matrix X((int)d.size(), dim);
+  for (int q = 0; q < X.rows; q++)
+    {
+    assert((int)d[q].data.size() == dim && "descriptors of different size");
+    copy(d[q].data.begin(), d[q].data.end(), X[q]);
+    }
+  return X;
+  }
+
+// X * basis - mean * basis: the mean comes off after the GEMM, k
+// subtractions a row instead of dim
+Matrix project_descriptors(const Matrix& X, const DescriptorPCA& pca)
+  {
+  TIME(1);
+  assert(X.cols == pca.dim && "descriptors of another size than the basis");
+  Matrix Y = X * pca.basis;
+  for (int q1 = 0; q1 < Y.rows; q1++)
+    for (int q2 = 0; q2 < Y.cols; q2++) Y(q1, q2) -= pca.offset(0, q2);
+  return Y;
+  }
+
+void compress_descriptors(vector<Descriptor>& d, const DescriptorPCA& pca)
+  {
+  TIME(1);
+  if (d.empty() || pca.empty()) return;
+  Matrix Y = project_descriptors(descriptor_matrix(d), pca);
+  for (int q = 0; q < Y.rows; q++) d[q].data.assign(Y[q], Y[q] + Y.cols);
+  }
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "matrix.h"
+
+// PCA compression of patch descriptors.
+//
+// A 7x7 rgb descriptor has 147 floats, but neighbouring pixels of a patch
+// are strongly correlated and most of the variance lies in a few
+// directions. A basis of those directions is learned offline from a corpus
+// of descriptors (descriptor-pca learn, from the pano/ images) and saved as
+// a small binary file; at extraction time compress_descriptors() projects
+// all descriptors of an image onto the first k of them with one GEMM.
+// Matching cost is linear in the dimension, so matching the projections
+// is ~147/k times cheaper. descriptor-pca report prints the match recall
+// per k.
+
+struct DescriptorPCA
+  {
+  int dim=0;          // floats of the descriptors it takes
+  int k=0;            // components
+  Matrix mean;        // 1 x dim
+  Matrix basis;       // dim x k, component j in column j, by variance
+  Matrix offset;      // 1 x k, mean * basis
+  vector<double> variance;   // of every component, descending
+
+  bool empty(void) const { return k==0; }
+  // the first k components only
+  DescriptorPCA first(int k) const;
+  };
+
+// Learn the first k components of the rows of samples (n x dim).
+DescriptorPCA learn_descriptor_pca(const Matrix& samples, int k);
+
+// Binary file: "PCA1", int dim, int k, then floats mean[dim],
+// basis[dim*k] (row major), variance[k]. Host byte order.
+bool save_descriptor_pca(const DescriptorPCA& pca, const string& filename);
+// k>0 keeps the first k components; an empty basis (and a message) on error
+DescriptorPCA load_descriptor_pca(const string& filename, int k=0);
+
+// The descriptors as the rows of a matrix (all the same size).
+Matrix descriptor_matrix(const vector<Descriptor>& d);
+// (X - mean) * basis, n x k: the GEMM and one subtraction per output.
+Matrix project_descriptors(const Matrix& X, const DescriptorPCA& pca);
+// Replace the data of every descriptor by its projection.
+void compress_descriptors(vector<Descriptor>& d, const DescriptorPCA& pca);
@@ -0,0 +1,128 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <cassert>
+
+#include <algorithm>
+
+#include "image.h"
+#include "simd_kernels.h"
+
+using namespace std;
+
+// Difference of Gaussian keypoints (Lowe, SIFT): extrema of
+// L(sigma k) - L(sigma) over space and scale, where L(sigma) is the image
+// blurred by a Gaussian of std dev. sigma.
+//
+// The scale space is built an octave (a doubling of sigma) at a time. Each
+// octave has DOG_INTERVALS+3 levels sigma0 k^i, k = 2^(1/DOG_INTERVALS),
+// every level blurred from the one before by the difference only
+// (Gaussians compose: sqrt(s1^2 - s0^2)), so the kernels stay short. The
+// level at twice the octave's sigma0, subsampled by 2, starts the next
+// octave at sigma0 again. Adjacent levels give DOG_INTERVALS+2 differences,
+// the inner DOG_INTERVALS are searched for 3x3x3 extrema.
+
+static const int DOG_INTERVALS = 3;
+static const float DOG_SIGMA = 1.6f;     // sigma0 of every octave
+static const float INPUT_SIGMA = .5f;    // blur the input is assumed to have
+static const float EDGE_RATIO = 10.f;    // largest ratio of principal curvatures
+static const int MIN_OCTAVE_SIZE = 16;
+
+// Every other pixel of every other row.
+static Image halve(const Image& im)
+  {
+  Image r(im.w / 2, im.h / 2, 1, Image::UNINITIALIZED);
+  float* out = r.data.writable();
+  for (int y = 0; y < r.h; y++)
+  {
+    const float* in = im.RowPtr(2 * y, 0);
+    for (int x = 0; x < r.w; x++) out[size_t(y) * r.w + x] = in[2 * x];
+  }
+  return r;
+  }
+
+// Edges are extrema of the DoG too, but with one large and one small
+// principal curvature: reject points where the ratio of the 2x2 Hessian's
+// eigenvalues is over EDGE_RATIO (tr^2/det test, no eigenvalues needed).
+static bool on_edge(const float* d, int stride)
+  {
+  float dxx = d[1] + d[-1] - 2 * d[0];
+  float dyy = d[stride] + d[-stride] - 2 * d[0];
+  float dxy = (d[stride + 1] - d[stride - 1] - d[-stride + 1] + d[-stride - 1]) / 4;
+  float tr = dxx + dyy, det = dxx * dyy - dxy * dxy;
+  return det <= 0 || tr * tr * EDGE_RATIO >= (EDGE_RATIO + 1) * (EDGE_RATIO + 1) * det;
+  }
+
+// describe_index of a keypoint at its scale: the window's samples are step
+// pixels apart (bilinear), step growing with sigma, so that a feature seen
+// at two scales gives the same samples.
+static Descriptor describe_scaled(const Image& L, int x, int y, int w, float step)
+  {
+  Descriptor d;
+  d.data.reserve(w * w);
+  float cval = L.clamped_pixel(x, y, 0);
+  for (int dy = -w / 2; dy <= w / 2; dy++)
+    for (int dx = -w / 2; dx <= w / 2; dx++)
+      d.data.push_back(L.pixel_bilinear(x + dx * step, y + dy * step, 0) - cval);
+  return d;
+  }
+
+// Detect difference of Gaussian keypoints and extract features at them.
+// const Image& im: input image.
+// float thresh: least |DoG| of a keypoint, gray in [0,1]. Typical: .005-.03
+// int window: descriptor window, in samples.
+// returns: keypoints in image coordinates with their scale, described as
+//          by describe_index on the gray level they were found at, at their
+//          scale (one channel whatever the image has).
+vector<Descriptor> dog_detector(const Image& im, float thresh, int window)
+  {
+  TIME(1);
+  assert((im.c == 1 || im.c == 3) && "only grayscale or rgb supported");
+  const int S = DOG_INTERVALS;
+  const float k = pow(2.f, 1.f / S);
+  Image base = smooth_image(im.c == 3 ? rgb_to_grayscale(im) : im,
+                            sqrt(DOG_SIGMA * DOG_SIGMA - INPUT_SIGMA * INPUT_SIGMA));
+
+  vector<Descriptor> res;
+  const simd::Kernels& kern = simd::kernels();
+  vector<Image> L(S + 3), D(S + 2);
+  for (int o = 0; base.w >= MIN_OCTAVE_SIZE && base.h >= MIN_OCTAVE_SIZE; o++)
+  {
+    // incremental blurs
+    L[0] = base;
+    float sigma = DOG_SIGMA;
+    for (int i = 1; i < S + 3; i++)
+    {
+      float next = sigma * k;
+      L[i] = smooth_image(L[i - 1], sqrt(next * next - sigma * sigma));
+      sigma = next;
+    }
+    for (int i = 0; i < S + 2; i++) D[i] = L[i + 1] - L[i];
+
+    const int w = base.w, h = base.h;
+    vector<int> xs(w);
+    for (int i = 1; i <= S; i++)
+    {
+      const float* a = D[i - 1].data;
+      const float* b = D[i].data;
+      const float* c = D[i + 1].data;
+      for (int y = 1; y < h - 1; y++)
+      {
+        size_t row = size_t(y) * w + 1;
+        int n = kern.dog_extrema(xs.data(), a + row, b + row, c + row, w, w - 2, thresh);
+        for (int q = 0; q < n; q++)
+        {
+          if (on_edge(b + row + xs[q], w)) continue;
+          int x = xs[q] + 1;
+          Descriptor d = describe_scaled(L[i], x, y, window, pow(k, float(i - 1)));
+          d.p = Point(double(x) * (1 << o), double(y) * (1 << o));
+          d.scale = DOG_SIGMA * pow(k, (float)i) * (1 << o);
+          res.push_back(move(d));
+        }
+      }
+    }
+
+    base = halve(L[S]);
+  }
+  return res;
+  }
@@ -0,0 +1,195 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <cassert>
+
+#include <algorithm>
+
+#include "image.h"
+#include "simd_kernels.h"
+
+using namespace std;
+
+// FAST-9 corners (Rosten & Drummond): a pixel is a corner if 9 contiguous
+// pixels of the radius 3 circle around it are all brighter than it plus a
+// threshold, or all darker than it minus the threshold. Most pixels fail
+// already at the four compass points of the circle, the fast9_candidates
+// kernel tests those for a vector of pixels at a time; only the rest get
+// the full test.
+
+// The circle, clockwise from the top
+static const int CIRCLE[16][2] =
+  {
+  {0,-3}, {1,-3}, {2,-2}, {3,-1}, {3,0}, {3,1}, {2,2}, {1,3},
+  {0,3}, {-1,3}, {-2,2}, {-3,1}, {-3,0}, {-3,-1}, {-2,-2}, {-1,-3}
+  };
+
+// The circle pixels at p minus the center, and the first 8 again, so that
+// every 9 arc is contiguous in d.
+// const int* offset: the 16 circle pixels relative to p.
+static void circle_diffs(int* d, const unsigned char* p, const int* offset)
+  {
+  for (int q = 0; q < 16; q++) d[q] = p[offset[q]] - p[0];
+  for (int q = 0; q < 8; q++) d[16 + q] = d[q];
+  }
+
+// The segment test at threshold t: a run of 9 set bits in the circular 16
+// bit masks of the brighter and of the darker circle pixels.
+static bool fast9_test(const int* d, int t)
+  {
+  unsigned bright = 0, dark = 0;
+  for (int q = 0; q < 16; q++)
+  {
+    bright |= unsigned(d[q] > t) << q;
+    dark |= unsigned(d[q] < -t) << q;
+  }
+  for (unsigned m : {bright, dark})
+  {
+    unsigned x = m | m << 16;    // unrolled once: runs across bit 15
+    unsigned r = x & x >> 1;     // bit q set: runs of 2, 4, 8, 9 from q
+    r &= r >> 2;
+    r &= r >> 4;
+    if (r & x >> 8) return true;
+  }
+  return false;
+  }
+
+// FAST score of a pixel: the largest t that some 9 arc of the circle
+// exceeds the center by (bright) or falls short of it by (dark) everywhere;
+// the pixel passes the segment test at threshold t if its score is greater.
+static int fast9_score(const int* d)
+  {
+  int best = 0;
+  for (int q1 = 0; q1 < 16; q1++)
+  {
+    int lo = d[q1], hi = d[q1];
+    for (int q2 = q1 + 1; q2 < q1 + 9; q2++)
+    {
+      lo = min(lo, d[q2]);
+      hi = max(hi, d[q2]);
+    }
+    best = max(best, max(lo, -hi));
+  }
+  return best;
+  }
+
+// Harris response det(S)/tr(S) of the Sobel gradients in the 5x5 window
+// around (x,y), in integers up to the division; x,y at least 3 pixels from
+// the border.
+static float harris_at(const Gray8& im, int x, int y)
+  {
+  long long sxx = 0, syy = 0, sxy = 0;
+  for (int j = y - 2; j <= y + 2; j++)
+  {
+    const unsigned char* a = im.row(j - 1);
+    const unsigned char* b = im.row(j);
+    const unsigned char* c = im.row(j + 1);
+    for (int i = x - 2; i <= x + 2; i++)
+    {
+      int gx = (a[i + 1] - a[i - 1]) + 2 * (b[i + 1] - b[i - 1]) + (c[i + 1] - c[i - 1]);
+      int gy = (c[i - 1] + 2 * c[i] + c[i + 1]) - (a[i - 1] + 2 * a[i] + a[i + 1]);
+      sxx += gx * gx;
+      syy += gy * gy;
+      sxy += gx * gy;
+    }
+  }
+  double tr = double(sxx + syy);
+  return tr > 0 ? float((double(sxx) * syy - double(sxy) * sxy) / tr) : 0.f;
+  }
+
+// Find FAST-9 corners in an 8-bit frame.
+// const Gray8& im: the frame.
+// int thresh: gray levels the arc must differ from the center by. Typical: 10-40
+// int nms: distance to look for corners of higher score. Typical: 3
+// bool harris_score: rank corners in NMS by their Harris response instead
+// of the FAST score.
+// returns: corners, row by row; none within 3 pixels of the border.
+vector<Point> fast9_corners(const Gray8& im, int thresh, int nms, bool harris_score)
+  {
+  TIME(1);
+  vector<Point> res;
+  if (im.w < 7 || im.h < 7) return res;
+  thresh = min(max(thresh, 0), 255);
+
+  int offset[16];
+  for (int q = 0; q < 16; q++) offset[q] = CIRCLE[q][1] * im.w + CIRCLE[q][0];
+
+  // the candidates of the kernel get the full segment test, corners a score
+  struct Corner
+    {
+    int x, y;
+    float score;
+    };
+  vector<Corner> c;
+  vector<int> first(im.h + 1);   // corners of row y: [first[y], first[y+1])
+  vector<int> xs(im.w);
+  const simd::Kernels& k = simd::kernels();
+  for (int y = 0; y < im.h; y++)
+  {
+    first[y] = (int)c.size();
+    if (y < 3 || y >= im.h - 3) continue;
+    const unsigned char* p = im.row(y) + 3;
+    int n = k.fast9_candidates(xs.data(), p, im.w, im.w - 6, thresh);
+    for (int q = 0; q < n; q++)
+    {
+      int d[16 + 8];
+      circle_diffs(d, p + xs[q], offset);
+      if (!fast9_test(d, thresh)) continue;
+      int x = xs[q] + 3;
+      c.push_back({x, y, harris_score ? harris_at(im, x, y) : (float)fast9_score(d)});
+    }
+  }
+  first[im.h] = (int)c.size();
+
+  // NMS over the corners only, as nms_image: a greater score within nms
+  // pixels suppresses. The corners of a row come in x order, so a cursor per
+  // neighbouring row only moves forward.
+  nms = max(nms, 0);
+  vector<int> cursor(2 * nms + 1);
+  for (int y = 3; y < im.h - 3; y++)
+  {
+    int y0 = max(y - nms, 0), y1 = min(y + nms, im.h - 1);
+    for (int j = y0; j <= y1; j++) cursor[j - y0] = first[j];
+    for (int q = first[y]; q < first[y + 1]; q++)
+    {
+      const Corner& e = c[q];
+      bool keep = true;
+      for (int j = y0; j <= y1 && keep; j++)
+      {
+        int& n = cursor[j - y0];
+        while (n < first[j + 1] && c[n].x < e.x - nms) n++;
+        for (int m = n; m < first[j + 1] && c[m].x <= e.x + nms; m++)
+          if (c[m].score > e.score) { keep = false; break; }
+      }
+      if (keep) res.push_back(Point(e.x, e.y));
+    }
+  }
+  return res;
+  }
+
+// Perform FAST-9 corner detection and extract features from the corners.
+// const Image& im: input image.
+// int thresh: FAST threshold in gray levels (of 255).
+// int window: descriptor window, as for harris_corner_detector.
+// int nms: distance to look for local-maxes in score.
+// bool harris_score: NMS by Harris response instead of FAST score.
+// returns: vector of descriptors of the corners in the image.
+vector<Descriptor> fast_corner_detector(const Image& im, int thresh, int window, int nms, bool harris_score)
+  {
+  TIME(1);
+  return describe_corners(im, fast9_corners(to_gray8(im), thresh, nms, harris_score), window);
+  }
+
+// Corners and descriptors of an image with the chosen detector.
+// Detector detector: HARRIS uses sigma, thresh and corner_method, the FAST
+// detectors FAST_THRESHOLD, DOG DOG_THRESHOLD (and no nms).
+vector<Descriptor> detect_features(const Image& im, Detector detector, float sigma, float thresh, int window, int nms, int corner_method)
+  {
+  switch (detector)
+  {
+    case FAST9: return fast_corner_detector(im, FAST_THRESHOLD, window, nms, false);
+    case FAST9_HARRIS: return fast_corner_detector(im, FAST_THRESHOLD, window, nms, true);
+    case DOG: return dog_detector(im, DOG_THRESHOLD, window);
+    default: return harris_corner_detector(im, sigma, thresh, window, nms, corner_method);
+  }
+  }
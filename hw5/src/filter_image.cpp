@@ -4,6 +4,8 @@
 #include <math.h>
 #include <assert.h>
 #include "image.h"
+#include "simd_math.h"
+#include "simd_kernels.h"
 
 #define M_PI 3.14159265358979323846
 
@@ -70,6 +72,7 @@ Image make_box_filter(int w)
 // returns the convolved image
 Image convolve_image(const Image &im, const Image &filter, bool preserve)
 {
+  TIME(1);
   assert(filter.c == 1);
   Image ret;
   // This is the case when we need to use the function clamped_pixel(x,y,c).
@@ -82,39 +85,64 @@ Image convolve_image(const Image &im, const Image &filter, bool preserve)
 
   int x, y, c, i, j;
   float old_pixel, new_pixel;
-  for (c = 0; c < im.c; c++)
+  const simd::Kernels &k = simd::kernels();
+  if (filter.w % 2 && filter.h % 2)
   {
-    for (x = 0; x < im.w; x++)
+    // Every output row is a sum of shifted source rows (row axpy); only the
+    // columns within filter.w/2 of the left and right border are clamped
+    int rw = filter.w / 2, rh = filter.h / 2;
+    for (c = 0; c < im.c; c++)
     {
       for (y = 0; y < im.h; y++)
       {
-        for (i = 0 - (filter.w / 2); i <= (filter.w / 2); i++)
+        float *out = ret.data.writable() + ret.pixel_address(0, y, c);
+        for (j = -rh; j <= rh; j++)
         {
-          for (j = 0 - (filter.h / 2); j <= (filter.h / 2); j++)
+          const float *src = im.data + im.pixel_address(0, min(max(y + j, 0), im.h - 1), c);
+          for (i = -rw; i <= rw; i++)
           {
-            old_pixel = im.clamped_pixel(x + i, y + j, c);
-            new_pixel = old_pixel * filter.clamped_pixel(i + filter.w / 2, j + filter.h / 2, 0);
-            ret.set_pixel(x, y, c, ret.clamped_pixel(x, y, c) + new_pixel);
+            float f = filter(i + rw, j + rh, 0);
+            int x0 = max(0, -i), x1 = min(im.w, im.w - i); // x + i inside the row
+            if (x1 > x0)
+              k.axpy(out + x0, src + x0 + i, f, x1 - x0);
+            for (x = 0; x < min(x0, im.w); x++)
+              out[x] += f * src[0];
+            for (x = max(x1, 0); x < im.w; x++)
+              out[x] += f * src[im.w - 1];
           }
         }
       }
     }
   }
-
-  if (!preserve)
+  else
   {
-    Image new_ret;
-    new_ret = Image(ret.w, ret.h, 1);
-    for (c = 0; c < ret.c; c++)
+    // even sizes: the filter is clamped too
+    for (c = 0; c < im.c; c++)
     {
-      for (x = 0; x < ret.w; x++)
+      for (x = 0; x < im.w; x++)
       {
-        for (y = 0; y < ret.h; y++)
+        for (y = 0; y < im.h; y++)
         {
-          new_ret.set_pixel(x, y, 0, new_ret.clamped_pixel(x, y, 0) + ret.clamped_pixel(x, y, c));
+          for (i = 0 - (filter.w / 2); i <= (filter.w / 2); i++)
+          {
+            for (j = 0 - (filter.h / 2); j <= (filter.h / 2); j++)
+            {
+              old_pixel = im.clamped_pixel(x + i, y + j, c);
+              new_pixel = old_pixel * filter.clamped_pixel(i + filter.w / 2, j + filter.h / 2, 0);
+              ret.set_pixel(x, y, c, ret.clamped_pixel(x, y, c) + new_pixel);
+            }
+          }
         }
       }
     }
+  }
+
+  if (!preserve)
+  {
+    Image new_ret;
+    new_ret = Image(ret.w, ret.h, 1);
+    for (c = 0; c < ret.c; c++)
+      k.axpy(new_ret.data.writable(), ret.data + ret.pixel_address(0, 0, c), 1.f, ret.w * ret.h);
 
     return new_ret;
   }
@@ -189,19 +217,22 @@ Image make_gaussian_filter(float sigma)
   ret = Image(w, w, 1);
 
   int x, y, x2, y2;
-  float pixel, exponent;
+  float norm = 1.0 / (2.0 * M_PI * sigma * sigma);
 
-  for (x = 0; x < w; x++)
+  // exponents first, then one vectorized exp over the whole kernel
+  float *px = ret.data.writable();
+  for (y = 0; y < w; y++)
   {
-    x2 = x - w / 2;
-    for (y = 0; y < w; y++)
+    y2 = y - w / 2;
+    for (x = 0; x < w; x++)
     {
-      y2 = y - w / 2;
-      exponent = -1.0 * ((pow(x2, 2) + pow(y2, 2)) / (2.0 * pow(sigma, 2)));
-      pixel = (1.0 / (2.0 * M_PI * pow(sigma, 2))) * exp(exponent);
-      ret.set_pixel(x, y, 0, pixel);
+      x2 = x - w / 2;
+      px[y * w + x] = -(float)(x2 * x2 + y2 * y2) / (2.0f * sigma * sigma);
     }
   }
+  exp_inplace(px, (long)w * w);
+  for (int i = 0; i < w * w; i++)
+    px[i] *= norm;
 
   l1_normalize(ret);
 
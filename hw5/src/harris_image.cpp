@@ -4,12 +4,45 @@
 #include <cmath>
 #include <cassert>
 
+#include <algorithm>
+#include <thread>
+
 #include "image.h"
+#include "simd_kernels.h"
+#include "simd_math.h"
 //#include "matrix.h"
 
 using namespace std;
 
 
+// Samples per side of a descriptor window: w rounded up to odd.
+static int window_side(int w) { return 2 * (w / 2) + 1; }
+
+// Write the descriptor of (x,y) to out: per channel the rows of the window
+// minus the central value, window_side(w)^2 floats each. A window inside
+// the image is copied row by row, the others clamp at the border.
+static void describe_into(float* out, const Image& im, int x, int y, int w)
+  {
+  const int r = w / 2, n = window_side(w);
+  const bool inside = x - r >= 0 && y - r >= 0 && x + r < im.w && y + r < im.h;
+  const simd::Kernels& k = simd::kernels();
+  for (int c = 0; c < im.c; c++, out += n * n)
+  {
+    if (inside)
+    {
+      const float* p = im.RowPtr(y, c) + x;
+      k.extract_patch(out, p - r * im.w - r, im.w, n, n, *p);
+      continue;
+    }
+    // This subtracts the central value from neighbors
+    // to compensate some for exposure/lighting changes.
+    float cval = im.clamped_pixel(x, y, c);
+    for (int dy = -r; dy <= r; dy++)
+      for (int dx = -r; dx <= r; dx++)
+        out[(dy + r) * n + dx + r] = im.clamped_pixel(x + dx, y + dy, c) - cval;
+  }
+  }
+
 // Create a feature descriptor for an index in an image.
 // const Image& im: source image.
 // int x,y: coordinates for the pixel we want to describe.
@@ -18,20 +51,66 @@ Descriptor describe_index(const Image& im, int x, int y, int w)
   {
   Descriptor d;
   d.p={(double)x,(double)y};
-  d.data.reserve(w*w*im.c);
-  
-  // If you want you can experiment with other descriptors
-  // This subtracts the central value from neighbors
-  // to compensate some for exposure/lighting changes.
-  for(int c=0;c<im.c;c++)
+  const int n = window_side(w);
+  d.data.resize(n*n*im.c);
+  describe_into(d.data.data(), im, x, y, w);
+  return d;
+  }
+
+// Run body(q1,q2) over [0,n) in contiguous slices, one thread each, with
+// at least min_per_thread items a slice.
+template <class F>
+static void parallel_slices(int n, int min_per_thread, F body)
+  {
+  int threads = (int)min<unsigned>(max(1u, thread::hardware_concurrency()), max(1, n / min_per_thread));
+  vector<thread> th;
+  for (int t = 1; t < threads; t++) th.emplace_back(body, int((long long)n * t / threads), int((long long)n * (t + 1) / threads));
+  body(0, int((long long)n / threads));
+  for (auto& e1 : th) e1.join();
+  }
+
+// corners a thread describes at least
+static const int DESCRIBE_SLICE = 1024;
+
+// Describe many points at once into one block.
+// float* out: p.size() rows of descriptor_size(im, window) floats, row q the
+//             data of describe_index(im, p[q].x, p[q].y, window).
+// const Image& im: source image.
+// const vector<Point>& p: the points.
+void describe_points(float* out, const Image& im, const vector<Point>& p, int window)
+  {
+  TIME(1);
+  const size_t dim = descriptor_size(im, window);
+  parallel_slices((int)p.size(), DESCRIBE_SLICE, [&](int q1, int q2)
     {
-    float cval = im.clamped_pixel(x,y,c);
-    for(int dx=-w/2;dx<=w/2;dx++)for(int dy=-w/2;dy<=w/2;dy++)
-      d.data.push_back(im.clamped_pixel(x+dx,y+dy,c)-cval);
+    for (int q = q1; q < q2; q++) describe_into(out + q * dim, im, (int)p[q].x, (int)p[q].y, window);
+    });
+  }
+
+// describe_index of every point, as one batch.
+vector<Descriptor> describe_corners(const Image& im, const vector<Point>& p, int window)
+  {
+  TIME(1);
+  const size_t dim = descriptor_size(im, window);
+  vector<Descriptor> d(p.size());
+  parallel_slices((int)p.size(), DESCRIBE_SLICE, [&](int q1, int q2)
+    {
+    for (int q = q1; q < q2; q++)
+    {
+      d[q].p = p[q];
+      d[q].data.resize(dim);
+      describe_into(d[q].data.data(), im, (int)p[q].x, (int)p[q].y, window);
     }
+    });
   return d;
   }
 
+// Floats of a descriptor of im with the given window.
+size_t descriptor_size(const Image& im, int window)
+  {
+  return size_t(window_side(window)) * window_side(window) * im.c;
+  }
+
 // Marks the spot of a point in an image.
 // Image& im: image to mark.
 // Point p: spot to mark in the image.
@@ -77,16 +156,18 @@ Image make_1d_gaussian(float sigma)
 
   ret = Image(w, 1, 1);
 
-  float pixel;
+  float norm = 1.0 / (sqrt(2 * M_PI) * (sigma));
   int x2;
+  float* k = ret.data.writable();
 
   for (int i = 0; i < w; i++)
   {
       x2 = w / 2 - i;
-      pixel = 1.0 / (sqrt(2 * M_PI) * (sigma));
-      pixel = pixel * exp((-pow(x2, 2)) / (2 * powf(sigma, 2)));
-      ret.set_pixel(i, 0, 0, pixel);
+      k[i] = -(float)(x2 * x2) / (2 * sigma * sigma);
   }
+  exp_inplace(k, w);
+  for (int i = 0; i < w; i++)
+      k[i] *= norm;
   
   // Image lin(1,1); // set to proper dimension
   // lin.data[0]=1;
@@ -102,6 +183,7 @@ Image make_1d_gaussian(float sigma)
 // returns: smoothed Image.
 Image smooth_image(const Image& im, float sigma)
   {
+  TIME(1);
   // TODO: use two convolutions with 1d gaussian filter.
   // Hint: to make the filter from vertical to horizontal or vice versa
   // use "swap(filter.h,filter.w)"
@@ -126,30 +208,85 @@ Image structure_matrix(const Image& im2, float sigma)
   TIME(1);
   // only grayscale or rgb
   assert((im2.c==1 || im2.c==3) && "only grayscale or rgb supported");
-  Image im;
-  // convert to grayscale if necessary
-  if(im2.c==1)im=im2;
-  else im=rgb_to_grayscale(im2);
+  // convert to grayscale if necessary (a grayscale input is used as is, not copied)
+  Image gray;
+  if(im2.c==3)gray=rgb_to_grayscale(im2);
+  const Image& im=im2.c==1 ? im2 : gray;
   
-  Image S(im.w, im.h, 3);
+  Image S(im.w, im.h, 3, Image::UNINITIALIZED);
 
   Image Ix, Iy;
   Ix = convolve_image(im, make_gx_filter(), 0);
   Iy = convolve_image(im, make_gy_filter(), 0);
 
-  for (int i = 0; i < im.w; i++)
+  // plain pointers: one copy-on-write check per image, not per pixel
+  float* s = S.data.writable();
+  const float* ix = Ix.data;
+  const float* iy = Iy.data;
+  const int n = im.w * im.h;
+  for (int q = 0; q < n; q++)
   {
-    for (int j = 0; j < im.h; j++)
-    {
-      S(i, j, 0) = Ix(i, j, 0) * Ix(i, j, 0);
-      S(i, j, 1) = Iy(i, j, 0) * Iy(i, j, 0);
-      S(i, j, 2) = Ix(i, j, 0) * Iy(i, j, 0);
-    }
+    s[q] = ix[q] * ix[q];
+    s[q + n] = iy[q] * iy[q];
+    s[q + 2 * n] = ix[q] * iy[q];
+  }
+
+  return smooth_image(S, sigma);
   }
 
+
+// Integer front end of structure_matrix for 8-bit frames: the Sobel
+// gradients in int16 and their products in int32 (see the sobel_tensor_u8
+// kernel) are exact, and are converted to float, in the units of the float
+// path (gray in [0,1]), only for the Gaussian weighting.
+// const Gray8& im: the input frame.
+// float sigma: std dev. to use for weighted sum.
+// returns: structure matrix, as structure_matrix of the same frame as floats.
+Image structure_matrix(const Gray8& im, float sigma)
+  {
+  TIME(1);
+  Image S(im.w, im.h, 3, Image::UNINITIALIZED);
+  if(!im.w || !im.h)return S;
+  
+  // rows padded with their edge pixels: the clamped border of convolve_image
+  int pw = im.w + 2;
+  vector<unsigned char> padded(size_t(pw) * im.h);
+  for (int y = 0; y < im.h; y++)
+  {
+    unsigned char* p = &padded[size_t(y) * pw];
+    memcpy(p + 1, im.row(y), im.w);
+    p[0] = p[1];
+    p[pw - 1] = p[pw - 2];
+  }
+  
+  const simd::Kernels& k = simd::kernels();
+  const float scale = 1.f / (255 * 255);
+  for (int y = 0; y < im.h; y++)
+  {
+    const unsigned char* above = &padded[size_t(max(y - 1, 0)) * pw];
+    const unsigned char* at = &padded[size_t(y) * pw];
+    const unsigned char* below = &padded[size_t(min(y + 1, im.h - 1)) * pw];
+    k.sobel_tensor_u8(S.RowPtr(y, 0), S.RowPtr(y, 1), S.RowPtr(y, 2), above, at, below, im.w, scale);
+  }
+  
   return smooth_image(S, sigma);
   }
 
+// An Image as an 8-bit grayscale frame (rgb is converted to gray first).
+Gray8 to_gray8(const Image& im2)
+  {
+  assert((im2.c==1 || im2.c==3) && "only grayscale or rgb supported");
+  Image gray;
+  if(im2.c==3)gray=rgb_to_grayscale(im2);
+  const Image& im=im2.c==1 ? im2 : gray;
+  
+  Gray8 res(im.w, im.h);
+  const float* src = im.data;
+  for (size_t q = 0; q < res.data.size(); q++)
+    res.data[q] = (unsigned char)(min(max(src[q], 0.f), 1.f) * 255 + .5f);
+  return res;
+  }
+
 
 // HW5 1.2
 // Estimate the cornerness of each pixel given a structure matrix S.
@@ -157,7 +294,8 @@ Image structure_matrix(const Image& im2, float sigma)
 // returns: a response map of cornerness calculations.
 Image cornerness_response(const Image& S, int method)
   {
-  Image R(S.w, S.h);
+  TIME(1);
+  Image R(S.w, S.h, 1, Image::UNINITIALIZED);
   // TODO: fill in R, "cornerness" for each pixel using the structure matrix.
   // We'll use formulation det(S) - alpha * trace(S)^2, alpha = .06.
   // E(S) = det(S) / trace(S)
@@ -171,15 +309,18 @@ Image cornerness_response(const Image& S, int method)
     //method = 0 (det(S)/tr(S))
 
     float det, tr;
-    for (int i = 0; i < S.w; i++)
+    // in memory order: the pixels do not depend on each other
+    float* r = R.data.writable();
+    const float* sxx = S.RowPtr(0, 0);
+    const float* syy = S.RowPtr(0, 1);
+    const float* sxy = S.RowPtr(0, 2);
+    const int n = S.w * S.h;
+    for (int q = 0; q < n; q++)
     {
-      for (int j = 0; j < S.h; j++)
-      {
-        det = (S(i, j, 0) * S(i, j, 1)) - (S(i, j, 2) * S(i, j, 2));
-        tr = S(i, j, 0) + S(i, j, 1);
-        R(i, j, 0) = det / tr;
-        //R(i, j, 0) = det - 0.06 * tr * tr; // comment says I should use this?
-      }
+      det = (sxx[q] * syy[q]) - (sxy[q] * sxy[q]);
+      tr = sxx[q] + syy[q];
+      r[q] = det / tr;
+      //R(i, j, 0) = det - 0.06 * tr * tr; // comment says I should use this?
     }
   }
   
@@ -196,6 +337,7 @@ Image nms_image(const Image& im, int w)
   {
   //TIME(1);
   Image r=im;
+  float* out=r.data.writable();   // detach from im once
   // TODO: perform NMS on the response map.
   // for every pixel in the image:
   //     for neighbors within w:
@@ -217,7 +359,7 @@ Image nms_image(const Image& im, int w)
           if ((i + ii >= 0) && (j + jj >= 0) && (i + ii < im.w) && (j + jj < im.h))
           {
             float neighbor = im(i + ii, j + jj, 0);
-            if (neighbor > val) r(i, j, 0) = -9999;
+            if (neighbor > val) out[i + j * im.w] = -9999;
           }
           
         }
@@ -237,7 +379,8 @@ Image nms_image(const Image& im, int w)
 // returns: vector of descriptors of the corners in the image.
 vector<Descriptor> detect_corners(const Image& im, const Image& nms, float thresh, int window)
   {
-  vector<Descriptor> d;
+  TIME(1);
+  vector<Point> p;
   //TODO: count number of responses over threshold (corners)
   //TODO: and fill in vector<Descriptor> with descriptors of corners, use describe_index.
   
@@ -247,12 +390,13 @@ vector<Descriptor> detect_corners(const Image& im, const Image& nms, float thres
     {
       if (nms(i, j, 0) >= thresh)
       {
-        d.push_back(describe_index(im, i, j, window));
+        p.push_back(Point(i, j));
       }
     }
   }
   
-  return d;
+  // all at once: describe_index of each
+  return describe_corners(im, p, window);
   }
 
 
@@ -264,6 +408,7 @@ vector<Descriptor> detect_corners(const Image& im, const Image& nms, float thres
 // returns: vector of descriptors of the corners in the image.
 vector<Descriptor> harris_corner_detector(const Image& im, float sigma, float thresh, int window, int nms, int corner_method)
   {
+  TIME(1);
   // Calculate structure matrix
   Image S = structure_matrix(im, sigma);
   
@@ -281,8 +426,9 @@ vector<Descriptor> harris_corner_detector(const Image& im, float sigma, float th
 // float sigma: std. dev for harris.
 // float thresh: threshold for cornerness.
 // int nms: distance to look for local-maxes in response map.
-Image detect_and_draw_corners(const Image& im, float sigma, float thresh, int window, int nms, int corner_method)
+// Detector detector: HARRIS, FAST9, FAST9_HARRIS or DOG (see detect_features).
+Image detect_and_draw_corners(const Image& im, float sigma, float thresh, int window, int nms, int corner_method, Detector detector)
   {
-  vector<Descriptor> d = harris_corner_detector(im, sigma, thresh, window, nms, corner_method);
+  vector<Descriptor> d = detect_features(im, detector, sigma, thresh, window, nms, corner_method);
   return mark_corners(im, d);
   }
@@ -5,78 +5,229 @@
 #include <cmath>
 
 #include <algorithm>
+#include <atomic>
+#include <new>
 #include <string>
 #include <vector>
 #include <stdexcept>
 
 using namespace std;
 
+#include "buffer_pool.h"
 #include "utils.h"
 #include "matrix.h"
 
-// DO NOT CHANGE THIS FILE
+// Pixel storage shared by the copies of an Image (copy on write).
+//
+// Copying a buffer shares its block and bumps an atomic reference count,
+// so copies are O(1) and may be released from any thread. Write access is
+// writable(): a shared block is first copied, the other images keep their
+// pixels. Reading (the implicit conversion to const float*) never copies.
+// As with other implicitly shared containers, a float* or float& taken
+// from an image is private to it only until the image is next copied: take
+// pointers after making copies, not before. That is why there is no
+// implicit conversion to float*: every pointer that can write is asked for
+// by name (writable(), RowPtr, view(), pixel()) and can be audited. Large
+// blocks are recycled through buffer_pool.
+class PixelBuffer
+  {
+  struct Header
+    {
+    atomic<int> refs;
+    size_t count;
+    };
+  static const size_t HEADER=16;     // keeps malloc's 16 byte alignment for the pixels
+  
+  float* px=nullptr;
+  // px is known to be private to this buffer. Read only with write access
+  // (exclusive, so a plain read); cleared by copies made from this buffer,
+  // which may run concurrently, so with an atomic store. A plain bool keeps
+  // the check of every pixel write a cheap load the compiler can hoist.
+  mutable bool unique=false;
+  
+  Header* header(void) const { return (Header*)((char*)px-HEADER); }
+  
+  // count floats after a header with one reference
+  static float* allocate(size_t count, bool zero)
+    {
+    static_assert(sizeof(Header)<=HEADER,"header too large");
+    size_t bytes=HEADER+sizeof(float)*count;
+    char* block=(char*)buffer_pool::acquire(bytes,zero);
+    profiler::on_alloc(sizeof(float)*count);
+    Header* h=new(block) Header;
+    h->refs.store(1,memory_order_relaxed);
+    h->count=count;
+    return (float*)(block+HEADER);
+    }
+  
+  void release(void)
+    {
+    if(!px)return;
+    Header* h=header();
+    if(h->refs.fetch_sub(1,memory_order_acq_rel)==1)
+      {
+      profiler::on_free(sizeof(float)*h->count);
+      size_t bytes=HEADER+sizeof(float)*h->count;
+      h->~Header();
+      buffer_pool::release(h,bytes);
+      }
+    px=nullptr;
+    unique=false;
+    }
+  
+  // Copy a shared block, or find that the other sharers are gone. Out of
+  // line: pixel loops keep only the test of unique.
+  __attribute__((noinline,cold)) void make_unique(void)
+    {
+    if(!px)return;
+    if(header()->refs.load(memory_order_acquire)>1)
+      {
+      size_t count=header()->count;
+      float* own=allocate(count,false);
+      memcpy(own,px,sizeof(float)*count);
+      profiler::on_copy(sizeof(float)*count);
+      release();
+      px=own;
+      }
+    unique=true;
+    }
+  
+ public:
+  PixelBuffer() = default;
+  explicit PixelBuffer(size_t count, bool zero=true) : px(count ? allocate(count,zero) : nullptr), unique(count>0) {}
+  PixelBuffer(const PixelBuffer& from) : px(from.px)
+    {
+    if(!px)return;
+    header()->refs.fetch_add(1,memory_order_relaxed);
+    __atomic_store_n(&from.unique,false,__ATOMIC_RELAXED);
+    }
+  PixelBuffer(PixelBuffer&& from) : px(from.px), unique(from.unique) { from.px=nullptr; from.unique=false; }
+  ~PixelBuffer() { release(); }
+  
+  // by value: copy and move assignment in one, safe for self assignment
+  PixelBuffer& operator=(PixelBuffer from)
+    {
+    swap(px,from.px);
+    swap(unique,from.unique);
+    return *this;
+    }
+  
+  // write access: private pixels, until the buffer is next copied
+  float* writable(void) { if(__builtin_expect(!unique,0))make_unique(); return px; }
+  // read access: possibly shared pixels
+  operator const float*() const { return px; }
+  const float* get(void) const { return px; }
+  
+  // another buffer uses the same pixels
+  bool shared(void) const { return px && header()->refs.load(memory_order_acquire)>1; }
+  };
+
+// A rectangle of planar pixels owned by someone else: row y of channel ch
+// starts at data+ch*plane+y*stride. Views are cheap to pass by value and
+// to narrow with sub(); kernels read and write them through row pointers.
+// A view of an Image is a pointer into its pixels: it lives no longer than
+// the image, and (see PixelBuffer) no longer than the next copy of it.
+template <class T>
+struct BasicImageView
+  {
+  T* data=nullptr;     // pixel (0,0) of channel 0
+  int w=0;
+  int h=0;
+  int c=0;
+  int stride=0;        // floats from one row to the next
+  size_t plane=0;      // floats from one channel to the next
+  
+  BasicImageView() = default;
+  BasicImageView(T* data, int w, int h, int c, int stride, size_t plane) :
+    data(data), w(w), h(h), c(c), stride(stride), plane(plane) {}
+  // ImageView converts to ConstImageView
+  template <class U>
+  BasicImageView(const BasicImageView<U>& v) : BasicImageView(v.data,v.w,v.h,v.c,v.stride,v.plane) {}
+  
+  T* row(int y, int ch) const { return data+ch*plane+size_t(y)*stride; }
+  
+  T& operator()(int x, int y, int ch) const
+    {
+    assert(ch<c && ch>=0 && x<w && x>=0 && y<h && y>=0 && "access out of bounds");
+    return row(y,ch)[x];
+    }
+  
+  // the w x h rectangle at (x,y) of this view
+  BasicImageView sub(int x, int y, int w, int h) const
+    {
+    assert(x>=0 && y>=0 && w>=0 && h>=0 && x+w<=this->w && y+h<=this->h && "view out of bounds");
+    return BasicImageView(data+size_t(y)*stride+x,w,h,c,stride,plane);
+    }
+  
+  // rows and channels follow each other without gaps
+  bool contiguous(void) const { return stride==w && plane==size_t(w)*h; }
+  };
+
+typedef BasicImageView<float> ImageView;
+typedef BasicImageView<const float> ConstImageView;
+
+// Copy src into dst (same size): one memcpy per row, or one in all when
+// both are whole images
+inline void copy_pixels(const ImageView& dst, const ConstImageView& src)
+  {
+  assert(dst.w==src.w && dst.h==src.h && dst.c==src.c && "copy_pixels: different sizes");
+  if(dst.contiguous() && src.contiguous())
+    {
+    if(src.w && src.h && src.c)memcpy(dst.data,src.data,sizeof(float)*src.w*src.h*src.c);
+    return;
+    }
+  for(int ch=0;ch<src.c;ch++)for(int y=0;y<src.h;y++)memcpy(dst.row(y,ch),src.row(y,ch),sizeof(float)*src.w);
+  }
 
 struct Image
   {
   int w=0;
   int h=0;
   int c=0;
-  float* data=nullptr;
+  PixelBuffer data;
+  
+  // tag of the constructor that leaves the pixels undefined
+  enum Uninitialized { UNINITIALIZED };
   
   // constructor
   Image() = default;
   
-  Image(int w, int h, int c=1) : w(w), h(h), c(c), data(nullptr) 
+  Image(int w, int h, int c=1) : w(w), h(h), c(c), data(size_t(w)*h*c)
     {
     assert(c>=0 && w>=0 && h>=0 && "Invalid image sizes");
-    
-    if(w*h*c)
-      data=(float*)calloc(w*h*c,sizeof(float));
-    
     }
   
-  // destructor
-  ~Image() { free(data); }
+  // for outputs that write every pixel: no zeroing of a recycled block
+  Image(int w, int h, int c, Uninitialized) : w(w), h(h), c(c), data(size_t(w)*h*c,false)
+    {
+    assert(c>=0 && w>=0 && h>=0 && "Invalid image sizes");
+    }
+  
+  // copies share the pixels until one of them writes (see PixelBuffer)
+  Image(const Image& from) = default;
   
-  // copy constructor
-  Image(const Image& from) : data(nullptr) { *this=from; }
+  // copy of the pixels of a view (crop)
+  explicit Image(const ConstImageView& v) : w(v.w), h(v.h), c(v.c), data(size_t(w)*h*c,false)
+    {
+    copy_pixels(view(),v);
+    }
   
   // move constructor
-  Image(Image&& from)  : data(nullptr) { *this=move(from); }
+  Image(Image&& from) : w(from.w), h(from.h), c(from.c), data(move(from.data)) { from.w=from.h=from.c=0; }
   
   // copy assignment
-  Image& operator=(const Image& from)
-    {
-    if(this==&from)return *this;
-    
-    if(data){free(data);data=nullptr;}
-    w=h=c=0;
-    // allocating data for the new image
-    data=(float*)calloc(from.w*from.h*from.c,sizeof(float));
-    
-    // TODO: populate the remaining fields in 'to' and copy the data
-    // You might want to check how 'memcpy' function works
-    
-    w=from.w;
-    h=from.h;
-    c=from.c;
-    memcpy(data,from.data,sizeof(float)*w*h*c);
-    return *this;
-    }
+  Image& operator=(const Image& from) = default;
   
   // move assignment
   Image& operator=(Image&& from)
     {
     if(this==&from)return *this;
     
-    if(data)free(data);
-    
     w=from.w;
     h=from.h;
     c=from.c;
-    data=from.data;
+    data=move(from.data);
     
-    from.data=nullptr;
     from.w=from.h=from.c=0;
     
     return *this;
@@ -92,13 +243,13 @@ struct Image
   float& operator()(int x, int y, int ch)
     {
     assert(ch<c && ch>=0 && x<w && x>=0 && y<h && y>=0 && "access out of bounds");
-    return data[pixel_address(x,y,ch)];
+    return data.writable()[pixel_address(x,y,ch)];
     }
   
   float& operator()(int x, int y)
     {
     assert(c==1 && x<w && x>=0 && y<h && y>=0 && "access out of bounds");
-    return data[pixel_address(x,y,0)];
+    return data.writable()[pixel_address(x,y,0)];
     }
   
   const float& operator()(int x, int y, int ch) const 
@@ -147,7 +298,14 @@ struct Image
     }
   
   const float* RowPtr(int row, int channel) const { return data+channel*w*h+row*w; }
-        float* RowPtr(int row, int channel)       { return data+channel*w*h+row*w; }
+        float* RowPtr(int row, int channel)       { return data.writable()+channel*w*h+row*w; }
+  
+  // views of the whole image or of a rectangle; writing through the
+  // non-const ones is writing to the image
+  ImageView      view(void)       { return ImageView(data.writable(),w,h,c,w,size_t(w)*h); }
+  ConstImageView view(void) const { return ConstImageView(data,w,h,c,w,size_t(w)*h); }
+  ImageView      view(int x, int y, int vw, int vh)       { return view().sub(x,y,vw,vh); }
+  ConstImageView view(int x, int y, int vw, int vh) const { return view().sub(x,y,vw,vh); }
   
   bool contains(float x, float y) const { return x>-0.5f && x<w-0.5f && y>-0.5f && y<h-0.5f; }
   
@@ -171,7 +329,8 @@ struct Image
   
   int size(void) const { return w*h*c; }
   
-  void clear(void) const { memset(data,0,sizeof(float)*c*w*h); }
+  // zero pixels; a shared image gets a fresh buffer instead of a copy
+  void clear(void) { data=PixelBuffer(size_t(w)*h*c); }
   
   // member functions for inexact access
   
@@ -213,6 +372,22 @@ struct Image
 
 
 
+// An 8-bit grayscale frame (a camera's Y plane, or to_gray8 of an Image),
+// the input of the integer Harris front end: structure_matrix(Gray8,...)
+// computes gradients and tensor products in integers, exactly.
+struct Gray8
+  {
+  int w=0;
+  int h=0;
+  vector<unsigned char> data;   // row major
+  
+  Gray8() {}
+  Gray8(int w, int h) : w(w), h(h), data(size_t(w)*h) {}
+  
+        unsigned char* row(int y)       { return data.data()+size_t(y)*w; }
+  const unsigned char* row(int y) const { return data.data()+size_t(y)*w; }
+  };
+
 // A 2d point.
 // float x, y: the coordinates of the point.
 struct Point 
@@ -225,10 +400,13 @@ struct Point
 
 // A descriptor for a point in an image.
 // point p: x,y coordinates of the image pixel.
+// float scale: std dev. of the Gaussian the point was found at, in pixels
+// of the image (scale space detectors; 1 for single scale ones).
 // vector<float> data: the descriptor for the pixel.
 struct Descriptor
   {
   Point p;
+  float scale=1.f;
   vector<float> data;
   
   Descriptor(){}
@@ -311,19 +489,47 @@ Image operator+(const Image& a, const Image& b);
 
 
 // Harris and panorama
+
+// Corner detector of harris_corner_detector's callers:
+//   HARRIS        harris_corner_detector (sigma, thresh, corner_method)
+//   FAST9         FAST-9 segment test on the 8-bit gray frame at threshold
+//                 FAST_THRESHOLD, NMS by the FAST score
+//   FAST9_HARRIS  the same corners, NMS by their Harris response
+//   DOG           difference of Gaussian extrema in scale space above
+//                 DOG_THRESHOLD, scale tagged, described at their scale
+// All describe the corners with describe_index(window); the single scale
+// ones suppress non-maxima within nms pixels.
+enum Detector { HARRIS, FAST9, FAST9_HARRIS, DOG };
+// gray levels (of 255) the 9 circle pixels must differ from the center by
+static const int FAST_THRESHOLD = 30;
+// least |DoG| of a keypoint, gray in [0,1]
+static const float DOG_THRESHOLD = 0.02f;
+
 Image structure_matrix(const Image& im, float sigma);
+Image structure_matrix(const Gray8& im, float sigma);
+Gray8 to_gray8(const Image& im);
 Image cornerness_response(const Image& S, int method);
 Image nms_image(const Image& im, int w);
+Descriptor describe_index(const Image& im, int x, int y, int w);
+size_t descriptor_size(const Image& im, int window);
+void describe_points(float* out, const Image& im, const vector<Point>& p, int window);
+vector<Descriptor> describe_corners(const Image& im, const vector<Point>& p, int window);
 vector<Descriptor> detect_corners(const Image& im, const Image& nms, float thresh, int window);
 vector<Descriptor> harris_corner_detector(const Image& im, float sigma, float thresh, int window, int nms, int corner_method);
-Image detect_and_draw_corners(const Image& im, float sigma, float thresh, int window, int nms, int corner_method);
+vector<Point> fast9_corners(const Gray8& im, int thresh, int nms, bool harris_score);
+vector<Descriptor> fast_corner_detector(const Image& im, int thresh, int window, int nms, bool harris_score);
+vector<Descriptor> dog_detector(const Image& im, float thresh, int window);
+vector<Descriptor> detect_features(const Image& im, Detector detector, float sigma, float thresh, int window, int nms, int corner_method);
+Image detect_and_draw_corners(const Image& im, float sigma, float thresh, int window, int nms, int corner_method, Detector detector=HARRIS);
 Image mark_corners(const Image& im, const vector<Descriptor>& d);
 
-// Panorama
+// Panorama (pca: compress the descriptors before matching, descriptor_pca.h)
+struct DescriptorPCA;
 Image both_images(const Image& a, const Image& b);
 Image draw_matches(const Image& a, const Image& b, const vector<Match>& matches, const vector<Match>&  inliers);
 Image draw_inliers(const Image& a, const Image& b, const Matrix& H, const vector<Match>& m, float thresh);
-Image find_and_draw_matches(const Image& a, const Image& b, float sigma, float thresh, int window, int nms, int corner_method);
+Image find_and_draw_matches(const Image& a, const Image& b, float sigma, float thresh, int window, int nms, int corner_method, Detector detector=HARRIS,
+                            const DescriptorPCA* pca=nullptr);
 float l1_distance(const vector<float>& a,const vector<float>& b);
 vector<Match> match_descriptors(const vector<Descriptor>& a,const vector<Descriptor>& b);
 Point project_point(const Matrix& H, const Point& p);
@@ -333,6 +539,8 @@ void randomize_matches(vector<Match>& m);
 Matrix compute_homography_ba(const vector<Match>& matches);
 Matrix RANSAC(vector<Match> m, float thresh, int k, int cutoff);
 Image combine_images(const Image& a, const Image& b, const Matrix& Hba, float acoeff);
-Image panorama_image(const Image& a, const Image& b, float sigma, int corner_method, float thresh, int window, int nms, float inlier_thresh, int iters, int cutoff, float acoeff);
+Image trim_image(const Image& a);
+Image panorama_image(const Image& a, const Image& b, float sigma, int corner_method, float thresh, int window, int nms, float inlier_thresh, int iters, int cutoff, float acoeff, Detector detector=HARRIS,
+                     const DescriptorPCA* pca=nullptr);
 Image cylindrical_project(const Image& im, float f);
 Image spherical_project(const Image& im, float f);
@@ -59,7 +59,7 @@ Image load_image_stb(const string& filename, int channels)
         {
         int dst_index = i + w*j + w*h*k;
         int src_index = k + c*i + c*w*j;
-        im.data[dst_index] = (float)data[src_index]/255.f;
+        im.data.writable()[dst_index] = (float)data[src_index]/255.f;
         }
   //We don't like alpha channels, #YOLO
   if(im.c == 4) im.c = 3;
@@ -88,7 +88,7 @@ void Image::load_binary(const string& filename)
   fread(&h,sizeof(h),1,fn);
   fread(&c,sizeof(c),1,fn);
   Image im(w,h,c);
-  fread(im.data,sizeof(float),im.size(),fn);
+  fread(im.data.writable(),sizeof(float),im.size(),fn);
   fclose(fn);
   *this=im;
   }
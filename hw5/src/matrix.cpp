@@ -12,6 +12,7 @@
 using namespace std;
 
 #include "matrix.h"
+#include "simd_kernels.h"
 
 Matrix operator-(const Matrix &a) {
   Matrix p(a.rows, a.cols);
@@ -46,7 +47,9 @@ Matrix elementwise_multiply(const Matrix &a, const Matrix &b) {
 template <int TILE>
 void do_tile(Matrix& c, const Matrix &a, const Matrix &b, int row, int col)
   {
+  static_assert(TILE==simd::GEMM_TILE,"the tile kernel has a fixed stride");
   using M=double[TILE][TILE];
+  const simd::Kernels& k=simd::kernels();
   
   M C={{0.}};
   
@@ -63,9 +66,7 @@ void do_tile(Matrix& c, const Matrix &a, const Matrix &b, int row, int col)
     for(int q1=0;q1<ax;q1++)for(int q2=0;q2<m ;q2++)A[q2][q1]=a(row+q1,mid+q2);
     for(int q1=0;q1<m ;q1++)for(int q2=0;q2<by;q2++)B[q1][q2]=b(mid+q1,col+q2);
     
-    for(int q3=0;q3<m;q3++)
-      for(int q1=0;q1<ax;q1++)for(int q2=0;q2<by;q2++)
-        C[q1][q2]+=A[q3][q1]*B[q3][q2];
+    k.gemm_tile(&C[0][0],&A[0][0],&B[0][0],m,ax,by);
     
     }
   
@@ -95,7 +96,7 @@ Matrix operator*(const Matrix &a, const Matrix &b) {
   double flops=double(a.rows)*double(a.cols)*double(b.cols);
   assert(a.cols == b.rows);
   Matrix p(a.rows, b.cols);
-  if(flops>(1<<16))gemm_mt<40>(p,a,b);
+  if(flops>(1<<16))gemm_mt<simd::GEMM_TILE>(p,a,b);
   else gemm(p,a,b);
   return p;
 }
@@ -330,6 +331,63 @@ Matrix in_place_LUP(Matrix &m) {
   return pivot;
 }
 
+// Eigen decomposition of a symmetric matrix, by cyclic Jacobi rotations:
+// every sweep zeroes each off-diagonal element in turn, until they are at
+// rounding level.
+// values: set to the eigenvalues (rows x 1), descending.
+// returns: the eigenvectors as columns, in the order of values.
+Matrix symmetric_eigen(const Matrix &A, Matrix &values) {
+  assert(A.rows == A.cols && "Matrix not square\n");
+  const int n = A.rows;
+  Matrix a = A;
+  Matrix v = Matrix::identity(n, n);
+
+  double norm = 0;
+  for (double e : a) norm += e * e;
+
+  for (int sweep = 0; sweep < 64; sweep++) {
+    double off = 0;
+    for (int p = 0; p < n; p++)
+      for (int q = p + 1; q < n; q++) off += a(p, q) * a(p, q);
+    if (off <= 1e-30 * norm) break;
+
+    for (int p = 0; p < n; p++)
+      for (int q = p + 1; q < n; q++) {
+        if (a(p, q) == 0) continue;
+        // rotation by the angle that zeroes a(p,q)
+        double theta = (a(q, q) - a(p, p)) / (2 * a(p, q));
+        double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+        double c = 1 / sqrt(t * t + 1), s = t * c;
+        for (int k = 0; k < n; k++) {
+          double akp = a(k, p), akq = a(k, q);
+          a(k, p) = c * akp - s * akq;
+          a(k, q) = s * akp + c * akq;
+        }
+        for (int k = 0; k < n; k++) {
+          double apk = a(p, k), aqk = a(q, k);
+          a(p, k) = c * apk - s * aqk;
+          a(q, k) = s * apk + c * aqk;
+        }
+        for (int k = 0; k < n; k++) {
+          double vkp = v(k, p), vkq = v(k, q);
+          v(k, p) = c * vkp - s * vkq;
+          v(k, q) = s * vkp + c * vkq;
+        }
+      }
+  }
+
+  vector<int> order(n);
+  for (int i = 0; i < n; i++) order[i] = i;
+  sort(order.begin(), order.end(), [&](int i, int j) { return a(i, i) > a(j, j); });
+  values = Matrix(n, 1);
+  Matrix vectors(n, n);
+  for (int j = 0; j < n; j++) {
+    values(j) = a(order[j], order[j]);
+    for (int i = 0; i < n; i++) vectors(i, j) = v(i, order[j]);
+  }
+  return vectors;
+}
+
 Matrix random_matrix(int rows, int cols) {
   static std::mt19937 mt;
   Matrix m(rows, cols);
@@ -371,8 +429,8 @@ void test_matrix() {
     Matrix C1(a,c);
     Matrix C2(a,c);
     
-    {TIME(1); gemm_mt<40>(C1,A,B);}
-    {TIME(1); gemm_mt<32>(C2,A,B);}
+    {TIME(1); gemm_mt<simd::GEMM_TILE>(C1,A,B);}
+    {TIME(1); gemm(C2,A,B);}
     
     //A.print();
     //B.print();
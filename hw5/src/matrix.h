@@ -10,6 +10,7 @@
 #include <string>
 #include <vector>
 
+#include "memory_policy.h"
 #include "utils.h"
 
 using namespace std;
@@ -23,12 +24,17 @@ struct Matrix {
   // constructor
   Matrix() = default;
   Matrix(int rows, int cols = 1) : rows(rows), cols(cols), data(nullptr) {
-    if (rows * cols)
-      data = (double *) calloc(rows * cols, sizeof(double));
+    if (rows * cols) {
+      data = (double *) memory_policy::allocate(sizeof(double) * rows * cols, true);
+      profiler::on_alloc(sizeof(double) * rows * cols);
+    }
   }
 
   // destructor
-  ~Matrix() { free(data); }
+  ~Matrix() {
+    if (data) profiler::on_free(sizeof(double) * rows * cols);
+    memory_policy::release(data);
+  }
 
   // copy constructor
   Matrix(const Matrix &a) : data(nullptr) { *this = a; }
@@ -41,12 +47,15 @@ struct Matrix {
     if (this == &a)return *this;
 
     if (data) {
-      free(data);
+      profiler::on_free(sizeof(double) * rows * cols);
+      memory_policy::release(data);
       data = nullptr;
     }
     rows = a.rows;
     cols = a.cols;
-    data = (double *) calloc(rows * cols, sizeof(double));
+    data = (double *) memory_policy::allocate(sizeof(double) * rows * cols, true);
+    profiler::on_alloc(sizeof(double) * rows * cols);
+    profiler::on_copy(sizeof(double) * rows * cols);
     memcpy(data, a.data, sizeof(double) * rows * cols);
     return *this;
   }
@@ -55,7 +64,10 @@ struct Matrix {
   Matrix &operator=(Matrix &&a) {
     if (this == &a)return *this;
 
-    if (data)free(data);
+    if (data) {
+      profiler::on_free(sizeof(double) * rows * cols);
+      memory_policy::release(data);
+    }
 
     rows = a.rows;
     cols = a.cols;
@@ -135,6 +147,7 @@ Matrix in_place_LUP(Matrix &m);
 Matrix random_matrix(int rows, int cols);
 Matrix sle_solve(const Matrix &A, const Matrix &b);
 Matrix solve_system(const Matrix &M, const Matrix &b);
+Matrix symmetric_eigen(const Matrix &A, Matrix &values);
 void test_matrix(void);
 
 inline void assert_same_size(const Matrix &a, const Matrix &b) {
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+
+// Page level placement of large buffers (Image pixels through buffer_pool,
+// Matrix data).
+//
+// Under a policy other than the default (LOCAL, no huge pages), blocks of
+// at least LARGE_BYTES are mapped directly, in whole 2 MB aligned pages (the
+// block itself starts a few KB in, so that blocks do not all share cache
+// sets), and the policy acts on the pages:
+//   huge_pages   madvise(MADV_HUGEPAGE): transparent huge pages, one TLB
+//                entry per 2 MB instead of per 4 KB (needs THP "madvise" or
+//                "always" in /sys/kernel/mm/transparent_hugepage/enabled)
+//   INTERLEAVE   pages spread round robin over the NUMA nodes (mbind), for
+//                data every thread reads, like a whole dataset
+// LOCAL leaves placement to the kernel: the node of whichever thread first
+// writes a page. That is first touch by the workers themselves, as long as
+// nothing writes a fresh block before the loop that fills it: mapped pages
+// are zero without being touched. Smaller blocks, and all blocks under the
+// default policy, come from malloc, which keeps recycling freed blocks.
+//
+// CSE576_HUGEPAGES=1 and CSE576_NUMA=local|interleave set the
+// policy at start; on one node (or without Linux) the NUMA part does nothing.
+
+namespace memory_policy
+  {
+
+  static const size_t LARGE_BYTES = 2 << 20;
+
+  enum Placement { LOCAL, INTERLEAVE };
+
+  struct Policy
+    {
+    bool huge_pages=false;
+    Placement placement=LOCAL;
+    };
+
+  Policy policy(void);
+  // applies to blocks allocated afterwards
+  void set_policy(const Policy& p);
+
+  // bytes, zeroed if zero (mapped blocks always are); throws bad_alloc
+  void* allocate(size_t bytes, bool zero);
+  // a block of allocate(), whatever the policy is now
+  void release(void* block);
+
+  const char* placement_name(Placement p);
+  int numa_nodes(void);
+  // the kernel honors MADV_HUGEPAGE
+  bool huge_pages_supported(void);
+  }
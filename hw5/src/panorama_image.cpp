@@ -5,7 +5,9 @@
 #include <cassert>
 
 #include "image.h"
+#include "descriptor_pca.h"
 #include "matrix.h"
+#include "simd_kernels.h"
 
 #include <set>
 #include <thread>
@@ -35,15 +37,8 @@ Image both_images(const Image &a, const Image &b)
   assert(a.c == b.c);
   Image both(a.w + b.w, a.h > b.h ? a.h : b.h, a.c);
 
-  for (int k = 0; k < both.c; ++k)
-    for (int j = 0; j < a.h; ++j)
-      for (int i = 0; i < a.w; ++i)
-        both(i, j, k) = a(i, j, k);
-
-  for (int k = 0; k < both.c; ++k)
-    for (int j = 0; j < b.h; ++j)
-      for (int i = 0; i < b.w; ++i)
-        both(i + a.w, j, k) = b(i, j, k);
+  copy_pixels(both.view(0, 0, a.w, a.h), a.view());
+  copy_pixels(both.view(a.w, 0, b.w, b.h), b.view());
   return both;
 }
 
@@ -99,15 +94,34 @@ Image draw_inliers(const Image &a, const Image &b, const Matrix &H, const vector
   return lines;
 }
 
+// A basis only takes descriptors of the size it was learned on: DOG
+// descriptors are grayscale, other windows give other sizes
+static bool fits(const vector<Descriptor> &d, const DescriptorPCA &pca)
+{
+  if (d.empty() || (int)d[0].data.size() == pca.dim) return true;
+  fprintf(stderr, "The PCA basis takes %d-float descriptors, these have %zu (another detector or window)\n",
+          pca.dim, d[0].data.size());
+  return false;
+}
+
 // Find corners, match them, and draw them between two images.
 // const Image& a, b: images to match.
 // float sigma: gaussian for harris corner detector. Typical: 2
 // float thresh: threshold for corner/no corner. Typical: 1-5
 // int nms: window to perform nms on. Typical: 3
-Image find_and_draw_matches(const Image &a, const Image &b, float sigma, float thresh, int window, int nms, int corner_method)
+// Detector detector: HARRIS, FAST9, FAST9_HARRIS or DOG (see detect_features).
+// const DescriptorPCA* pca: if set, match the descriptors' projections.
+Image find_and_draw_matches(const Image &a, const Image &b, float sigma, float thresh, int window, int nms, int corner_method, Detector detector,
+                            const DescriptorPCA *pca)
 {
-  vector<Descriptor> ad = harris_corner_detector(a, sigma, thresh, window, nms, corner_method);
-  vector<Descriptor> bd = harris_corner_detector(b, sigma, thresh, window, nms, corner_method);
+  vector<Descriptor> ad = detect_features(a, detector, sigma, thresh, window, nms, corner_method);
+  vector<Descriptor> bd = detect_features(b, detector, sigma, thresh, window, nms, corner_method);
+  if (pca)
+  {
+    if (!fits(ad, *pca) || !fits(bd, *pca)) exit(1);
+    compress_descriptors(ad, *pca);
+    compress_descriptors(bd, *pca);
+  }
   vector<Match> m = match_descriptors(ad, bd);
 
   Image A = mark_corners(a, ad);
@@ -125,13 +139,7 @@ float l1_distance(const vector<float> &a, const vector<float> &b)
 {
   assert(a.size() == b.size() && "Arrays must have same size\n");
 
-  float l1;
-  l1 = 0.0;
-  for (int i = 0; i < (int)a.size(); i++)
-  {
-    l1 += fabs(a[i] - b[i]);
-  }
-  return l1;
+  return simd::kernels().l1_distance(a.data(), b.data(), (int)a.size());
 }
 
 // HW5 2.2a
@@ -172,6 +180,7 @@ vector<int> match_descriptors_a2b(const vector<Descriptor> &a, const vector<Desc
 //          one other descriptor in b.
 vector<Match> match_descriptors(const vector<Descriptor> &a, const vector<Descriptor> &b)
 {
+  TIME(1);
   if (a.size() == 0 || b.size() == 0)
     return {};
 
@@ -354,6 +363,7 @@ Matrix compute_homography_ba(const vector<Match> &matches)
 // returns: matrix representing most common homography between matches.
 Matrix RANSAC(vector<Match> m, float thresh, int k, int cutoff)
 {
+  TIME(1);
   if (m.size() < 4)
   {
     //printf("Need at least 4 points for RANSAC! %zu supplied\n",m.size());
@@ -392,6 +402,7 @@ Matrix RANSAC(vector<Match> m, float thresh, int k, int cutoff)
   return Hba;
 }
 
+// Crops the zero border of an image.
 Image trim_image(const Image &a)
 {
   int minx = a.w - 1;
@@ -401,26 +412,22 @@ Image trim_image(const Image &a)
 
   for (int q3 = 0; q3 < a.c; q3++)
     for (int q2 = 0; q2 < a.h; q2++)
+    {
+      const float *row = a.RowPtr(q2, q3);
       for (int q1 = 0; q1 < a.w; q1++)
-        if (a(q1, q2, q3))
+        if (row[q1])
         {
           minx = min(minx, q1);
           maxx = max(maxx, q1);
           miny = min(miny, q2);
           maxy = max(maxy, q2);
         }
+    }
 
   if (maxx < minx || maxy < miny)
     return a;
 
-  Image b(maxx - minx + 1, maxy - miny + 1, a.c);
-
-  for (int q3 = 0; q3 < a.c; q3++)
-    for (int q2 = miny; q2 <= maxy; q2++)
-      for (int q1 = minx; q1 <= maxx; q1++)
-        b(q1 - minx, q2 - miny, q3) = a(q1, q2, q3);
-
-  return b;
+  return Image(a.view(minx, miny, maxx - minx + 1, maxy - miny + 1));
 }
 
 // HW5 3.6
@@ -467,13 +474,7 @@ Image combine_images(const Image &a, const Image &b, const Matrix &Hba, float ab
   // printf("w = %d, h = %d, c = %d\n", w, h, a.c);
 
   // Paste image a into the new image offset by dx and dy.
-  for (int k = 0; k < a.c; ++k)
-    for (int j = 0; j < a.h; ++j)
-      for (int i = 0; i < a.w; ++i)
-      {
-        // TODO: fill in.
-        c(i - dx, j - dy, k) = a(i, j, k);
-      }
+  copy_pixels(c.view(-dx, -dy, a.w, a.h), a.view());
 
   // TODO: Blend in image b as well.
   // You should loop over some points in the new image (which? all?)
@@ -529,17 +530,29 @@ Image combine_images(const Image &a, const Image &b, const Matrix &Hba, float ab
 // float inlier_thresh: threshold for RANSAC inliers. Typical: 2-5
 // int iters: number of RANSAC iterations. Typical: 1,000-50,000
 // int cutoff: RANSAC inlier cutoff. Typical: 10-100
-Image panorama_image(const Image &a, const Image &b, float sigma, int corner_method, float thresh, int window, int nms, float inlier_thresh, int iters, int cutoff, float acoeff)
+// Detector detector: HARRIS, FAST9, FAST9_HARRIS or DOG (see detect_features).
+// const DescriptorPCA* pca: if set, match the descriptors' projections.
+Image panorama_image(const Image &a, const Image &b, float sigma, int corner_method, float thresh, int window, int nms, float inlier_thresh, int iters, int cutoff, float acoeff, Detector detector,
+                     const DescriptorPCA *pca)
 {
+  TIME(1);
   // Calculate corners and descriptors
   vector<Descriptor> ad;
   vector<Descriptor> bd;
 
   // doing it multithreading...
-  thread tha([&]() { ad = harris_corner_detector(a, sigma, thresh, window, nms, corner_method); });
-  thread thb([&]() { bd = harris_corner_detector(b, sigma, thresh, window, nms, corner_method); });
+  bool fit_a = true, fit_b = true;
+  auto detect = [&](const Image &im, vector<Descriptor> &d, bool &fit)
+  {
+    d = detect_features(im, detector, sigma, thresh, window, nms, corner_method);
+    if (pca && (fit = fits(d, *pca))) compress_descriptors(d, *pca);
+  };
+  thread tha([&]() { detect(a, ad, fit_a); });
+  thread thb([&]() { detect(b, bd, fit_b); });
   tha.join();
   thb.join();
+  // exit only once both threads are done
+  if (!fit_a || !fit_b) exit(1);
 
   // Find matches
   vector<Match> m = match_descriptors(ad, bd);
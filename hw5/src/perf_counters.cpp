@@ -0,0 +1,141 @@
+#include <cerrno>
+#include <cstring>
+
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace perf_counters
+  {
+
+  Sample Sample::operator-(const Sample& o) const
+    {
+    Sample res;
+    res.valid=valid&o.valid;
+    for(int c=0;c<COUNTERS;c++)if(res.has(Counter(c)))res.value[c]=value[c]-o.value[c];
+    return res;
+    }
+
+  Sample& Sample::operator+=(const Sample& o)
+    {
+    // an empty sample is the identity
+    valid=valid ? valid&o.valid : o.valid;
+    for(int c=0;c<COUNTERS;c++)value[c]+=o.value[c];
+    return *this;
+    }
+
+  double Sample::ipc(void) const
+    {
+    if(!has(CYCLES) || !has(INSTRUCTIONS) || !value[CYCLES])return 0;
+    return double(value[INSTRUCTIONS])/value[CYCLES];
+    }
+
+  const char* name(Counter c)
+    {
+    static const char* names[COUNTERS]={"cycles","instructions","llc_misses","branch_misses","dtlb_misses"};
+    return names[c];
+    }
+
+#ifdef __linux__
+
+  // The counter group of one thread, closed when the thread exits
+  struct Group
+    {
+    int leader=-1;
+    int slot[COUNTERS];      // position in the group read, -1 if not opened
+    int opened=0;
+    int fds[COUNTERS];
+    const char* reason=nullptr;
+
+    Group()
+      {
+      static const uint32_t type[COUNTERS]={PERF_TYPE_HARDWARE,PERF_TYPE_HARDWARE,PERF_TYPE_HARDWARE,PERF_TYPE_HARDWARE,
+                                            PERF_TYPE_HW_CACHE};
+      static const uint64_t config[COUNTERS]={PERF_COUNT_HW_CPU_CYCLES,PERF_COUNT_HW_INSTRUCTIONS,
+                                              PERF_COUNT_HW_CACHE_MISSES,PERF_COUNT_HW_BRANCH_MISSES,
+                                              PERF_COUNT_HW_CACHE_DTLB|PERF_COUNT_HW_CACHE_OP_READ<<8|
+                                              PERF_COUNT_HW_CACHE_RESULT_MISS<<16};
+      int error=0;
+      for(int c=0;c<COUNTERS;c++)
+        {
+        slot[c]=-1;
+        perf_event_attr attr;
+        memset(&attr,0,sizeof(attr));
+        attr.size=sizeof(attr);
+        attr.type=type[c];
+        attr.config=config[c];
+        attr.exclude_kernel=1;
+        attr.exclude_hv=1;
+        attr.read_format=PERF_FORMAT_GROUP|PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled=leader<0;
+        int fd=(int)syscall(SYS_perf_event_open,&attr,0,-1,leader,0);
+        if(fd<0)
+          {
+          if(!error)error=errno;
+          continue;
+          }
+        if(leader<0)leader=fd;
+        fds[opened]=fd;
+        slot[c]=opened++;
+        }
+      if(leader<0)
+        {
+        reason=error==ENOENT || error==EOPNOTSUPP ? "no PMU (a VM without virtual counters?)" :
+               error==EACCES || error==EPERM ? "not permitted (see /proc/sys/kernel/perf_event_paranoid)" :
+               error==ENOSYS ? "perf_event_open not supported" : "perf_event_open failed";
+        return;
+        }
+      ioctl(leader,PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+      }
+
+    ~Group()
+      {
+      for(int q1=0;q1<opened;q1++)close(fds[q1]);
+      }
+
+    Sample read_counts(void) const
+      {
+      Sample res;
+      if(leader<0)return res;
+      uint64_t buf[3+COUNTERS];
+      if(::read(leader,buf,sizeof(buf))<(ssize_t)(3*sizeof(uint64_t)) || buf[0]!=(uint64_t)opened)return res;
+      uint64_t enabled=buf[1],running=buf[2];
+      if(!running)return res;
+      for(int c=0;c<COUNTERS;c++)
+        {
+        if(slot[c]<0)continue;
+        uint64_t v=buf[3+slot[c]];
+        // the kernel multiplexed the group: extrapolate to the enabled time
+        if(running<enabled)v=uint64_t(double(v)*enabled/running);
+        res.value[c]=v;
+        res.valid|=1u<<c;
+        }
+      return res;
+      }
+    };
+
+  static Group& group(void)
+    {
+    static thread_local Group g;
+    return g;
+    }
+
+  bool available(void) { return group().leader>=0; }
+  const char* unavailable_reason(void) { return available() ? "" : group().reason; }
+  Sample read(void) { return group().read_counts(); }
+
+#else
+
+  bool available(void) { return false; }
+  const char* unavailable_reason(void) { return "perf_event_open is Linux only"; }
+  Sample read(void) { return Sample(); }
+
+#endif
+  }
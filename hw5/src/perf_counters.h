@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+// Hardware performance counters of the calling thread (Linux
+// perf_event_open): cycles, instructions, last level cache misses, branch
+// mispredictions and data TLB load misses, user space only.
+//
+// The counters are opened once per thread, as one group so they cover the
+// same instructions. Where they do not exist (other OS, a VM without a
+// virtual PMU, perf_event_paranoid too high, seccomp) available() is false
+// and every read is empty, callers print "-" instead of a number. A counter
+// the CPU lacks is left out of the valid mask while the others still count.
+
+namespace perf_counters
+  {
+
+  enum Counter { CYCLES, INSTRUCTIONS, LLC_MISSES, BRANCH_MISSES, DTLB_MISSES, COUNTERS };
+
+  struct Sample
+    {
+    uint64_t value[COUNTERS]={0,0,0,0,0};
+    uint32_t valid=0;     // bit per Counter
+
+    bool has(Counter c) const { return valid>>c&1; }
+    Sample operator-(const Sample& o) const;
+    Sample& operator+=(const Sample& o);
+    // instructions per cycle, 0 without both counters
+    double ipc(void) const;
+    };
+
+  const char* name(Counter c);
+
+  // Opens the counters of the calling thread on first use
+  bool available(void);
+  // Why available() is false
+  const char* unavailable_reason(void);
+  // Current totals of the calling thread, scaled when the kernel multiplexed
+  // the group; empty when unavailable
+  Sample read(void);
+  }
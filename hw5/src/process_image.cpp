@@ -4,6 +4,7 @@
 #include <cmath>
 
 #include "image.h"
+#include "simd_kernels.h"
 
 using namespace std;
 
@@ -13,20 +14,11 @@ using namespace std;
 Image rgb_to_grayscale(const Image &im)
 {
   assert(im.c == 3);         // only accept RGB images
-  Image gray(im.w, im.h, 1); // create a new grayscale image (note: 1 channel)
+  Image gray(im.w, im.h, 1, Image::UNINITIALIZED); // create a new grayscale image (note: 1 channel)
 
-  for (int i = 0; i < im.w; i++)
-  {
-    for (int j = 0; j < im.h; j++)
-    {
-      float r, g, b, y;
-      r = im.clamped_pixel(i, j, 0);
-      g = im.clamped_pixel(i, j, 1);
-      b = im.clamped_pixel(i, j, 2);
-      y = 0.299 * r + 0.587 * g + 0.114 * b;
-      gray.set_pixel(i, j, 0, y);
-    }
-  }
+  // y = 0.299 * r + 0.587 * g + 0.114 * b on the planar channels
+  int n = im.w * im.h;
+  simd::kernels().rgb_to_gray(gray.data.writable(), im.data, im.data + n, im.data + 2 * n, n);
 
   return gray;
 }
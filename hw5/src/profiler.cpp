@@ -0,0 +1,510 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "profiler.h"
+
+using namespace std;
+
+namespace profiler
+  {
+
+  atomic<bool> enabled(true);
+  thread_local Ring* ring=nullptr;
+
+  struct ScopeInfo
+    {
+    const char* name;
+    const char* file;
+    int line;
+    atomic<bool> counted;   // reads the hardware counters; written under registry_lock
+    };
+
+  // One entry per PROFILE_SCOPE site, so a fixed table: a scope reads its
+  // counted flag without the lock, and the table never moves
+  static const size_t MAX_SCOPES=4096;
+
+  // Registries, only touched the first time a thread or a scope shows up
+  static mutex registry_lock;
+  static vector<unique_ptr<Ring>> rings;
+  static vector<uint64_t> ring_start;   // events before this index were reset away
+  static vector<Ring*> free_rings;      // of threads that exited, for the next new ones
+  static ScopeInfo scopes[MAX_SCOPES];
+  static size_t scope_count=0;
+  static string counted_names;          // ",name,name," or empty for all scopes
+
+  static void counters_from_env(void);
+
+  static bool is_counted(const char* name)
+    {
+    return counted_names.empty() || counted_names.find(","+string(name)+",")!=string::npos;
+    }
+
+  // Timestamp counter to seconds: both clocks read at startup and at report time
+  static const uint64_t tsc0=ticks();
+  static const chrono::steady_clock::time_point clock0=chrono::steady_clock::now();
+
+  // Gives the ring of a thread back when the thread exits. Threads come and
+  // go (every panorama_image, every parallel_slices), so rings are reused
+  // rather than kept one per thread ever run; the events of the old thread
+  // stay in the report until the new one overwrites them.
+  struct RingOwner
+    {
+    Ring* r=nullptr;
+    ~RingOwner()
+      {
+      if(!r)return;
+      lock_guard<mutex> lock(registry_lock);
+      free_rings.push_back(r);
+      if(ring==r)ring=nullptr;
+      }
+    };
+
+  Ring* new_ring(void)
+    {
+    static thread_local RingOwner owner;
+    // the first scope of every thread comes here: a cold path to set up
+    // CSE576_PROFILE_COUNTERS without a static initializer
+    counters_from_env();
+    lock_guard<mutex> lock(registry_lock);
+    if(!free_rings.empty())
+      {
+      owner.r=free_rings.back();
+      free_rings.pop_back();
+      return owner.r;
+      }
+    rings.emplace_back(new Ring);
+    ring_start.push_back(0);
+    rings.back()->thread=(int)rings.size()-1;
+    owner.r=rings.back().get();
+    return owner.r;
+    }
+
+  uint32_t intern(const char* name, const char* file, int line)
+    {
+    lock_guard<mutex> lock(registry_lock);
+    if(scope_count==MAX_SCOPES)
+      {
+      fprintf(stderr,"profiler: more than %zu scopes\n",MAX_SCOPES);
+      abort();
+      }
+    const char* base=strrchr(file,'/');
+    ScopeInfo& s=scopes[scope_count];
+    s.name=name;
+    s.file=base ? base+1 : file;
+    s.line=line;
+    s.counted.store(is_counted(name),memory_order_relaxed);
+    return (uint32_t)scope_count++;
+    }
+
+  void reset(void)
+    {
+    lock_guard<mutex> lock(registry_lock);
+    for(size_t q1=0;q1<rings.size();q1++)ring_start[q1]=rings[q1]->head.load(memory_order_acquire);
+    }
+
+  static double ticks_per_us(void)
+    {
+    double us=chrono::duration<double,micro>(chrono::steady_clock::now()-clock0).count();
+    // too short a run for a precise ratio: extend it
+    while(us<10000)us=chrono::duration<double,micro>(chrono::steady_clock::now()-clock0).count();
+    return double(ticks()-tsc0)/us;
+    }
+
+  // A begin/end pair of one thread, with its memory and hardware counters
+  struct Span
+    {
+    uint32_t id;
+    int depth;
+    uint64_t begin,end;
+    uint64_t allocs=0,alloc_bytes=0,copies=0,copy_bytes=0;
+    int64_t peak=0;            // most bytes live at once above the level at begin
+    perf_counters::Sample counts;
+    };
+
+  // Pair up the events of a ring; ends whose begin was dropped are skipped,
+  // scopes still open are closed at the last event
+  static vector<Span> spans(size_t q1, uint64_t* dropped)
+    {
+    const Ring& r=*rings[q1];
+    uint64_t head=r.head.load(memory_order_acquire);
+    uint64_t first=max(ring_start[q1],head>RING_EVENTS ? head-RING_EVENTS : 0);
+    *dropped+=first-ring_start[q1];
+
+    vector<Span> res;
+    vector<size_t> open;
+    size_t closed=SIZE_MAX;    // span of the last END
+    uint64_t last=0;
+    for(uint64_t q2=first;q2<head;q2++)
+      {
+      const Event& e=r.events[q2&(RING_EVENTS-1)];
+      if(e.kind==BEGIN)
+        {
+        last=e.tsc;
+        open.push_back(res.size());
+        Span sp;
+        sp.id=e.id;
+        sp.depth=(int)open.size()-1;
+        sp.begin=sp.end=e.tsc;
+        res.push_back(sp);
+        }
+      else if(e.kind==END)
+        {
+        last=e.tsc;
+        closed=SIZE_MAX;
+        if(open.empty() || res[open.back()].id!=e.id)continue;
+        closed=open.back();
+        res[closed].end=e.tsc;
+        open.pop_back();
+        }
+      else if(closed!=SIZE_MAX)
+        {
+        Span& sp=res[closed];
+        if(e.kind==ALLOCS){ sp.allocs=e.id; sp.alloc_bytes=e.tsc; }
+        else if(e.kind==COPIES){ sp.copies=e.id; sp.copy_bytes=e.tsc; }
+        else if(e.kind==PEAK)sp.peak=(int64_t)e.tsc;
+        else if(e.id<perf_counters::COUNTERS)
+          {
+          sp.counts.value[e.id]=e.tsc;
+          sp.counts.valid|=1u<<e.id;
+          }
+        }
+      }
+    for(size_t o:open)res[o].end=last;
+    return res;
+    }
+
+  struct Node
+    {
+    uint32_t id=0;
+    uint64_t calls=0,ticks=0,child_ticks=0;
+    uint64_t allocs=0,alloc_bytes=0,copies=0,copy_bytes=0;
+    int64_t peak=0;            // largest peak of one call
+    uint64_t counted=0;        // calls with hardware counters
+    perf_counters::Sample counts;
+    map<uint32_t,int> children;
+    };
+
+  // Merge the spans of all threads into one call tree, node 0 is the root
+  static vector<Node> call_tree(uint64_t* dropped)
+    {
+    vector<Node> tree(1);
+    for(size_t q1=0;q1<rings.size();q1++)
+      {
+      vector<Span> sp=spans(q1,dropped);
+      // spans are in begin order: the parent of a span is the last open one a level up
+      vector<int> path;
+      for(const Span& s:sp)
+        {
+        path.resize(s.depth);
+        int parent=path.empty() ? 0 : path.back();
+        auto it=tree[parent].children.find(s.id);
+        int n;
+        if(it==tree[parent].children.end())
+          {
+          n=(int)tree.size();
+          tree[parent].children[s.id]=n;
+          tree.emplace_back();
+          tree[n].id=s.id;
+          }
+        else n=it->second;
+        Node& node=tree[n];
+        node.calls++;
+        node.ticks+=s.end-s.begin;
+        node.allocs+=s.allocs;
+        node.alloc_bytes+=s.alloc_bytes;
+        node.copies+=s.copies;
+        node.copy_bytes+=s.copy_bytes;
+        node.peak=max(node.peak,s.peak);
+        if(s.counts.valid)
+          {
+          node.counted++;
+          node.counts+=s.counts;
+          }
+        if(parent)tree[parent].child_ticks+=s.end-s.begin;
+        path.push_back(n);
+        }
+      }
+    return tree;
+    }
+
+  // Print the subtree of n, children by decreasing `key`
+  static void print_tree(FILE* out, const vector<Node>& tree, int n, int depth,
+                         const function<double(const Node&)>& key,
+                         const function<void(FILE*,const Node&)>& columns)
+    {
+    const Node& node=tree[n];
+    if(depth>=0)
+      {
+      const ScopeInfo& s=scopes[node.id];
+      columns(out,node);
+      fprintf(out,"  %*s%s (%s:%d)\n",2*depth,"",s.name,s.file,s.line);
+      }
+    vector<int> kids;
+    for(auto& e1:node.children)kids.push_back(e1.second);
+    sort(kids.begin(),kids.end(),[&](int a, int b){ return key(tree[a])>key(tree[b]); });
+    for(int k:kids)print_tree(out,tree,k,depth+1,key,columns);
+    }
+
+  void report(FILE* out)
+    {
+    double tpus=ticks_per_us();
+    lock_guard<mutex> lock(registry_lock);
+    uint64_t dropped=0;
+    vector<Node> tree=call_tree(&dropped);
+
+    double total=0;
+    for(auto& e1:tree[0].children)total+=tree[e1.second].ticks;
+    fprintf(out,"%10s %12s %12s %7s  %s\n","calls","total ms","self ms","share","scope");
+    print_tree(out,tree,0,-1,[](const Node& n){ return double(n.ticks); },[&](FILE* f, const Node& n)
+      {
+      fprintf(f,"%10llu %12.3lf %12.3lf %6.1lf%%",(unsigned long long)n.calls,n.ticks/tpus/1e3,
+              (n.ticks-n.child_ticks)/tpus/1e3,total>0 ? 100*n.ticks/total : 0.);
+      });
+    if(dropped)fprintf(out,"%llu events dropped (ring buffers wrapped)\n",(unsigned long long)dropped);
+    }
+
+  // Process wide counters, kept even for allocations outside any scope
+  static atomic<int64_t> live_bytes(0),peak_bytes(0);
+  static atomic<uint64_t> total_allocs(0),total_copies(0),total_copy_bytes(0);
+
+  atomic<bool> track_memory(getenv("CSE576_PROFILE_MEMORY")!=nullptr);
+  static thread_local MemoryCounters counters;
+  static thread_local Scope* memory_scope=nullptr;   // innermost tracked scope
+
+  void set_memory_tracking(bool on) { track_memory=on; }
+
+  void memory_alloc(size_t bytes)
+    {
+    int64_t live=live_bytes+=(int64_t)bytes;
+    int64_t peak=peak_bytes.load(memory_order_relaxed);
+    while(live>peak && !peak_bytes.compare_exchange_weak(peak,live,memory_order_relaxed));
+    total_allocs++;
+
+    counters.allocs++;
+    counters.alloc_bytes+=bytes;
+    counters.live+=(int64_t)bytes;
+    if(memory_scope)memory_scope->peak=max(memory_scope->peak,counters.live-memory_scope->start.live);
+    }
+
+  void memory_free(size_t bytes)
+    {
+    live_bytes-=(int64_t)bytes;
+    counters.live-=(int64_t)bytes;
+    }
+
+  void memory_copy(size_t bytes)
+    {
+    total_copies++;
+    total_copy_bytes+=bytes;
+    counters.copies++;
+    counters.copy_bytes+=bytes;
+    }
+
+  void Scope::begin_memory(void)
+    {
+    memory=true;
+    start=counters;
+    outer=memory_scope;
+    memory_scope=this;
+    }
+
+  // Log the counters of the scope after its END, hand the peak to the outer scope
+  void Scope::end_memory(void)
+    {
+    memory_scope=outer;
+    if(outer)outer->peak=max(outer->peak,start.live-outer->start.live+peak);
+    if(counters.allocs>start.allocs)record(counters.alloc_bytes-start.alloc_bytes,uint32_t(counters.allocs-start.allocs),ALLOCS);
+    if(counters.copies>start.copies)record(counters.copy_bytes-start.copy_bytes,uint32_t(counters.copies-start.copies),COPIES);
+    if(peak>0)record((uint64_t)peak,0,PEAK);
+    }
+
+  void memory_report(FILE* out)
+    {
+    lock_guard<mutex> lock(registry_lock);
+    uint64_t dropped=0;
+    vector<Node> tree=call_tree(&dropped);
+    const double MB=1<<20;
+
+    fprintf(out,"live %.2lf MB, peak %.2lf MB, %llu allocations, %llu copies (%.2lf MB)\n",live_bytes/MB,peak_bytes/MB,
+            (unsigned long long)total_allocs,(unsigned long long)total_copies,total_copy_bytes/MB);
+    fprintf(out,"%10s %10s %12s %12s %10s %12s  %s\n","calls","allocs","alloc MB","peak MB","copies","copy MB","scope");
+    print_tree(out,tree,0,-1,[](const Node& n){ return double(n.alloc_bytes); },[&](FILE* f, const Node& n)
+      {
+      fprintf(f,"%10llu %10llu %12.2lf %12.2lf %10llu %12.2lf",(unsigned long long)n.calls,(unsigned long long)n.allocs,
+              n.alloc_bytes/MB,n.peak/MB,(unsigned long long)n.copies,n.copy_bytes/MB);
+      });
+    if(dropped)fprintf(out,"%llu events dropped (ring buffers wrapped)\n",(unsigned long long)dropped);
+    }
+
+  atomic<bool> track_counters(false);
+
+  static bool apply_counter_tracking(bool on, const string& names)
+    {
+    if(on && !perf_counters::available())on=false;
+    lock_guard<mutex> lock(registry_lock);
+    counted_names=names.empty() ? "" : ","+names+",";
+    for(size_t q1=0;q1<scope_count;q1++)scopes[q1].counted.store(is_counted(scopes[q1].name),memory_order_relaxed);
+    track_counters=on;
+    return on;
+    }
+
+  // CSE576_PROFILE_COUNTERS, applied once before the first scope or the
+  // first call below, so an explicit setting always comes after it
+  static void counters_from_env(void)
+    {
+    static const bool applied=[]()
+      {
+      const char* env=getenv("CSE576_PROFILE_COUNTERS");
+      if(!env)return false;
+      string v=env;
+      bool ok=apply_counter_tracking(true,v=="1" || v=="all" ? "" : v);
+      if(!ok)fprintf(stderr,"profiler: no hardware counters: %s\n",perf_counters::unavailable_reason());
+      return ok;
+      }();
+    (void)applied;
+    }
+
+  bool set_counter_tracking(bool on, const string& names)
+    {
+    counters_from_env();
+    return apply_counter_tracking(on,names);
+    }
+
+  string counted_scopes(void)
+    {
+    counters_from_env();
+    lock_guard<mutex> lock(registry_lock);
+    return counted_names.empty() ? "" : counted_names.substr(1,counted_names.size()-2);
+    }
+
+  void Scope::begin_counters(void)
+    {
+    if(!scopes[id].counted.load(memory_order_relaxed))return;
+    counting=true;
+    counts=perf_counters::read();
+    }
+
+  // Log the counts of the scope (the destructor took the difference) after its END
+  void Scope::end_counters(void)
+    {
+    for(int c=0;c<perf_counters::COUNTERS;c++)
+      if(counts.has(perf_counters::Counter(c)))record(counts.value[c],c,COUNTER);
+    }
+
+  void counters_report(FILE* out)
+    {
+    lock_guard<mutex> lock(registry_lock);
+    uint64_t dropped=0;
+    vector<Node> tree=call_tree(&dropped);
+
+    using namespace perf_counters;
+    fprintf(out,"%10s %10s %12s %12s %6s %12s %12s %12s  %s\n","calls","counted","Mcycles","Minstr","IPC","LLC miss K",
+            "br miss K","dTLB miss K","scope");
+    print_tree(out,tree,0,-1,[](const Node& n){ return double(n.counts.value[CYCLES]); },[&](FILE* f, const Node& n)
+      {
+      auto col=[&](Counter c, double scale)
+        {
+        if(n.counts.has(c))fprintf(f," %12.3lf",n.counts.value[c]/scale);
+        else fprintf(f," %12s","-");
+        };
+      fprintf(f,"%10llu %10llu",(unsigned long long)n.calls,(unsigned long long)n.counted);
+      col(CYCLES,1e6);
+      col(INSTRUCTIONS,1e6);
+      if(n.counts.ipc()>0)fprintf(f," %6.2lf",n.counts.ipc());
+      else fprintf(f," %6s","-");
+      col(LLC_MISSES,1e3);
+      col(BRANCH_MISSES,1e3);
+      col(DTLB_MISSES,1e3);
+      });
+    if(dropped)fprintf(out,"%llu events dropped (ring buffers wrapped)\n",(unsigned long long)dropped);
+    }
+
+  static string json_escape(const char* s)
+    {
+    string res;
+    for(;*s;s++)
+      {
+      if(*s=='"' || *s=='\\')res+='\\';
+      res+=*s;
+      }
+    return res;
+    }
+
+  bool write_trace(const string& file)
+    {
+    double tpus=ticks_per_us();
+    lock_guard<mutex> lock(registry_lock);
+    FILE* fn=fopen(file.c_str(),"w");
+    if(!fn)
+      {
+      fprintf(stderr,"Cannot write trace \"%s\"\n",file.c_str());
+      return false;
+      }
+    fprintf(fn,"{\"traceEvents\":[");
+    bool first=true;
+    uint64_t dropped=0;
+    for(size_t q1=0;q1<rings.size();q1++)
+      for(const Span& s:spans(q1,&dropped))
+        {
+        const ScopeInfo& info=scopes[s.id];
+        fprintf(fn,"%s\n{\"name\":\"%s\",\"cat\":\"%s:%d\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3lf,\"dur\":%.3lf",
+                first ? "" : ",",json_escape(info.name).c_str(),json_escape(info.file).c_str(),info.line,
+                rings[q1]->thread,(s.begin-tsc0)/tpus,(s.end-s.begin)/tpus);
+        if(s.allocs || s.copies || s.counts.valid)
+          {
+          const char* sep="";
+          fprintf(fn,",\"args\":{");
+          if(s.allocs || s.copies)
+            {
+            fprintf(fn,"\"allocs\":%llu,\"alloc_bytes\":%llu,\"peak_bytes\":%lld,\"copies\":%llu",
+                    (unsigned long long)s.allocs,(unsigned long long)s.alloc_bytes,(long long)s.peak,
+                    (unsigned long long)s.copies);
+            sep=",";
+            }
+          if(s.counts.valid)
+            {
+            fprintf(fn,"%s\"ipc\":%.3lf",sep,s.counts.ipc());
+            for(int c=0;c<perf_counters::COUNTERS;c++)
+              if(s.counts.has(perf_counters::Counter(c)))
+                fprintf(fn,",\"%s\":%llu",perf_counters::name(perf_counters::Counter(c)),
+                        (unsigned long long)s.counts.value[c]);
+            }
+          fprintf(fn,"}");
+          }
+        fprintf(fn,"}");
+        first=false;
+        }
+    fprintf(fn,"\n]}\n");
+    return fclose(fn)==0;
+    }
+
+  // Report at exit when CSE576_PROFILE is set
+  struct ExitReport
+    {
+    ~ExitReport()
+      {
+      // later static destructors (Images of other files) must not log into freed rings
+      bool memory=track_memory || getenv("CSE576_PROFILE_MEMORY");
+      bool counters=track_counters || getenv("CSE576_PROFILE_COUNTERS");
+      track_memory=track_counters=enabled=false;
+      const char* env=getenv("CSE576_PROFILE");
+      if(!env)return;
+      report(stderr);
+      if(memory)memory_report(stderr);
+      if(counters)counters_report(stderr);
+      string file=env;
+      if(file.size()>5 && file.compare(file.size()-5,5,".json")==0)write_trace(file);
+      }
+    };
+  // defined after the registries, so destroyed before them
+  static ExitReport exit_report;
+  }
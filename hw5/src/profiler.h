@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "perf_counters.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Hierarchical scope profiler.
+//
+// TIME() (or PROFILE_SCOPE("name")) marks a scope. Every thread appends
+// begin/end events to its own ring buffer: a timestamp counter read and a
+// 16 byte store, no lock, no allocation, no string. The scope's name, file
+// and line are interned once, the first time the scope runs (a function
+// static), so an event only carries a 32 bit id.
+//
+// The events are aggregated on demand into a call tree (profiler::report)
+// or exported as Chrome/Perfetto trace JSON (profiler::write_trace). When
+// a ring wraps, the oldest events of that thread are dropped. The ring of a
+// thread that exits is reused by the next new thread, so the rings are as
+// many as threads ever ran at once.
+//
+// Recording is always on, the cost is a few ns per scope. With the
+// environment variable CSE576_PROFILE set, the call tree is printed to
+// stderr at exit, and when its value ends in ".json" the trace is written
+// there too.
+//
+// Memory accounting is opt-in (CSE576_PROFILE_MEMORY set, or
+// set_memory_tracking): Image and Matrix then count every allocation, free
+// and deep copy in per-thread counters, and each scope logs what changed
+// when it ends. memory_report() gives per scope the allocation count,
+// bytes allocated, peak live bytes and deep copies.
+//
+// Hardware counters are opt-in too (CSE576_PROFILE_COUNTERS=all, or a comma
+// separated list of scope names, or set_counter_tracking): the scopes then
+// read cycles, instructions, LLC, branch and dTLB misses at begin and end,
+// about a microsecond each, and counters_report() adds IPC to the call tree. Where
+// perf_event_open has no hardware counters tracking stays off.
+
+namespace profiler
+  {
+
+  // ALLOCS, COPIES, PEAK and COUNTER follow the END of the scope they describe
+  enum EventKind : uint32_t { BEGIN, END, ALLOCS, COPIES, PEAK, COUNTER };
+
+  struct Event
+    {
+    uint64_t tsc;     // timestamp, bytes for ALLOCS, COPIES and PEAK, count for COUNTER
+    uint32_t id;      // scope, count for ALLOCS and COPIES, perf_counters::Counter for COUNTER
+    uint32_t kind;
+    };
+
+  static const uint64_t RING_EVENTS = 1 << 16;   // per thread, power of 2
+
+  // Written only by its thread; head is published with release so a
+  // reader sees complete events
+  struct Ring
+    {
+    Event events[RING_EVENTS];
+    std::atomic<uint64_t> head{0};
+    int thread=0;
+    };
+
+  // Switched at run time while other threads record: read relaxed
+  extern std::atomic<bool> enabled;
+  extern std::atomic<bool> track_memory;
+  extern std::atomic<bool> track_counters;
+  extern thread_local Ring* ring;
+
+  Ring* new_ring(void);
+  uint32_t intern(const char* name, const char* file, int line);
+
+  inline uint64_t ticks(void)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+  inline void record(uint64_t tsc, uint32_t id, uint32_t kind)
+    {
+    Ring* r=ring ? ring : (ring=new_ring());
+    uint64_t h=r->head.load(std::memory_order_relaxed);
+    r->events[h&(RING_EVENTS-1)]={tsc,id,kind};
+    r->head.store(h+1,std::memory_order_release);
+    }
+
+  // Memory hooks of Image and Matrix
+  void memory_alloc(size_t bytes);
+  void memory_free(size_t bytes);
+  void memory_copy(size_t bytes);
+  inline void on_alloc(size_t bytes) { if(track_memory.load(std::memory_order_relaxed))memory_alloc(bytes); }
+  inline void on_free (size_t bytes) { if(track_memory.load(std::memory_order_relaxed))memory_free(bytes); }
+  inline void on_copy (size_t bytes) { if(track_memory.load(std::memory_order_relaxed))memory_copy(bytes); }
+  void set_memory_tracking(bool on);
+  // Count hardware events in the named scopes (comma separated), all scopes
+  // if empty. Returns false, and leaves tracking off, without counters.
+  bool set_counter_tracking(bool on, const std::string& scopes="");
+  // The scope list of the last set_counter_tracking, empty for all
+  std::string counted_scopes(void);
+
+  struct MemoryCounters
+    {
+    uint64_t allocs=0,alloc_bytes=0,copies=0,copy_bytes=0;
+    int64_t live=0;    // allocated minus freed by this thread
+    };
+
+  struct Scope
+    {
+    uint32_t id;
+    bool on;
+    bool memory=false;      // began with memory tracking on
+    Scope* outer=nullptr;   // enclosing tracked scope of the thread
+    MemoryCounters start;   // thread counters at begin
+    int64_t peak=0;         // most bytes live above start.live
+    bool counting=false;    // began with counter tracking on, for this scope
+    perf_counters::Sample counts;   // at begin
+
+    explicit Scope(uint32_t id) : id(id), on(enabled.load(std::memory_order_relaxed))
+      {
+      if(!on)return;
+      if(track_memory.load(std::memory_order_relaxed))begin_memory();
+      record(ticks(),id,BEGIN);
+      if(track_counters.load(std::memory_order_relaxed))begin_counters();
+      }
+    ~Scope()
+      {
+      if(!on)return;
+      if(counting)counts=perf_counters::read()-counts;
+      record(ticks(),id,END);
+      if(memory)end_memory();
+      if(counting)end_counters();
+      }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    void begin_memory(void);
+    void end_memory(void);
+    void begin_counters(void);
+    void end_counters(void);
+    };
+
+  // Call tree of all threads: calls, total and self time per scope path
+  void report(FILE* out=stderr);
+  // Call tree with allocations, bytes allocated, peak live bytes and deep
+  // copies per scope (inclusive of the scopes it calls)
+  void memory_report(FILE* out=stderr);
+  // Call tree with the hardware counters and IPC of the counted scopes
+  void counters_report(FILE* out=stderr);
+  // Chrome trace ("X" events, microseconds), one track per thread
+  bool write_trace(const std::string& file);
+  // Forget all events recorded so far
+  void reset(void);
+  }
+
+#define COMBINE1(X,Y) X##Y
+#define COMBINE(X,Y) COMBINE1(X,Y)
+
+#define PROFILE_SCOPE(name) \
+  static const uint32_t COMBINE(__prof_id,__LINE__)=profiler::intern(name,__FILE__,__LINE__); \
+  profiler::Scope COMBINE(__prof,__LINE__)(COMBINE(__prof_id,__LINE__))
+
+// Former printf timer; the arguments (print level, label) are ignored and
+// the scope is named after the function
+#define TIME(...) PROFILE_SCOPE(__FUNCTION__)
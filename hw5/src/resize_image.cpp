@@ -25,10 +25,11 @@ float Image::pixel_nearest(float x, float y, int c) const
 // returns the bilinearly interpolated pixel (x,y,c)
 float Image::pixel_bilinear(float x, float y, int c) const
   {
-    int x2 = ceil(x);
-    int x1 = floor(x);
-    int y1 = ceil(y);
-    int y2 = floor(y);
+    // floor and ceil by truncation: libm calls without SSE4.1 in the baseline build
+    int x1 = (int)x - (x < (int)x);
+    int x2 = x1 + (x1 != x);
+    int y2 = (int)y - (y < (int)y);
+    int y1 = y2 + (y2 != y);
 
     float dx1 = x - x1;
     float dx2 = x2 - x;
@@ -0,0 +1,90 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../simd_kernels.h"
+
+using namespace std;
+
+namespace simd
+  {
+
+  extern const Kernels kernels_baseline;
+#ifdef CSE576_SIMD_X86
+  extern const Kernels kernels_sse42;
+  extern const Kernels kernels_avx2;
+  extern const Kernels kernels_avx512;
+#endif
+
+  static const char* names[TIERS]={"baseline","sse4.2","avx2","avx512"};
+
+  const char* tier_name(Tier t) { return t>=0 && t<TIERS ? names[t] : "unknown"; }
+
+  Tier best_tier(void)
+    {
+#ifdef CSE576_SIMD_X86
+    // __builtin_cpu_supports also checks that the OS saves the wider registers
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512bw") &&
+       __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("fma"))return AVX512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))return AVX2;
+    if(__builtin_cpu_supports("sse4.2"))return SSE42;
+#endif
+    return BASELINE;
+    }
+
+  static const Kernels* table(Tier t)
+    {
+    switch(t)
+      {
+#ifdef CSE576_SIMD_X86
+      case AVX512: return &kernels_avx512;
+      case AVX2: return &kernels_avx2;
+      case SSE42: return &kernels_sse42;
+#endif
+      default: return &kernels_baseline;
+      }
+    }
+
+  static atomic<const Kernels*> current(nullptr);
+
+  Tier set_tier(Tier t)
+    {
+    Tier best=best_tier();
+    if(t<BASELINE)t=BASELINE;
+    if(t>best)
+      {
+      fprintf(stderr,"simd: %s not supported by this CPU, using %s\n",tier_name(t),tier_name(best));
+      t=best;
+      }
+    current=table(t);
+    return t;
+    }
+
+  // Best tier, or the one CSE576_SIMD names
+  static const Kernels* select(void)
+    {
+    Tier t=best_tier();
+    if(const char* env=getenv("CSE576_SIMD"))
+      {
+      int q1=0;
+      while(q1<TIERS && strcmp(env,names[q1]))q1++;
+      if(q1<TIERS)t=Tier(q1);
+      else fprintf(stderr,"simd: unknown CSE576_SIMD=\"%s\" (baseline, sse4.2, avx2 or avx512), using %s\n",env,tier_name(t));
+      }
+    set_tier(t);
+    return current;
+    }
+
+  const Kernels& kernels(void)
+    {
+    const Kernels* k=current.load(memory_order_acquire);
+    if(!k)
+      {
+      static const Kernels* selected=select();
+      k=selected;
+      }
+    return *k;
+    }
+  }
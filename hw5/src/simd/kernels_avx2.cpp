@@ -0,0 +1,9 @@
+// AVX2 tier, built with -mavx2 -mfma
+
+#define SIMD_NS avx2_kernels
+#define SIMD_TIER AVX2
+#define SIMD_NAME "avx2"
+#define SIMD_TABLE kernels_avx2
+#define SIMD_BYTES 32
+
+#include "kernels.inc"
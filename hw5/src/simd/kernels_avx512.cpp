@@ -0,0 +1,11 @@
+// AVX-512 tier, built with -mavx512f -mavx512vl -mavx512bw -mavx512dq -mfma
+
+#define SIMD_NS avx512_kernels
+#define SIMD_TIER AVX512
+#define SIMD_NAME "avx512"
+#define SIMD_TABLE kernels_avx512
+#define SIMD_BYTES 64
+// descriptors are short and unaligned: split zmm loads cost more than they gain
+#define SIMD_L1_BYTES 32
+
+#include "kernels.inc"
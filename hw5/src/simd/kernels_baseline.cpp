@@ -0,0 +1,9 @@
+// Baseline tier: the flags of the library (x86-64: SSE2)
+
+#define SIMD_NS baseline_kernels
+#define SIMD_TIER BASELINE
+#define SIMD_NAME "baseline"
+#define SIMD_TABLE kernels_baseline
+#define SIMD_BYTES 16
+
+#include "kernels.inc"
@@ -0,0 +1,9 @@
+// SSE4.2 tier, built with -msse4.2
+
+#define SIMD_NS sse42_kernels
+#define SIMD_TIER SSE42
+#define SIMD_NAME "sse4.2"
+#define SIMD_TABLE kernels_sse42
+#define SIMD_BYTES 16
+
+#include "kernels.inc"
@@ -0,0 +1,66 @@
+#pragma once
+
+// Runtime dispatched SIMD kernels.
+//
+// The library is compiled for the portable baseline of the target (x86-64:
+// SSE2). The hot inner loops are compiled a few more times, with the flags
+// of a newer instruction set each (simd/kernels_*.cpp, one source:
+// simd/kernels.inc), and the first call of simd::kernels() picks the best
+// tier the CPU and OS support via cpuid. CSE576_SIMD=baseline|sse4.2|avx2|
+// avx512 forces a tier (one the CPU lacks falls back to the best it has,
+// with a warning); set_tier() does the same from code.
+
+namespace simd
+  {
+
+  enum Tier { BASELINE, SSE42, AVX2, AVX512, TIERS };
+
+  // Tile edge of gemm_tile, the block size of Matrix multiplication
+  static const int GEMM_TILE = 40;
+
+  struct Kernels
+    {
+    Tier tier;
+    const char* name;
+
+    // y[i] += a*x[i], i<n
+    void (*axpy)(float* y, const float* x, float a, int n);
+    // sum |a[i]-b[i]|, i<n
+    float (*l1_distance)(const float* a, const float* b, int n);
+    // gray[i] = .299 r[i] + .587 g[i] + .114 b[i], i<n (planar channels)
+    void (*rgb_to_gray)(float* gray, const float* r, const float* g, const float* b, int n);
+    // out[q1*w+q2] = src[q1*stride+q2] - c, q1<h, q2<w: a patch of rows,
+    // packed and offset
+    void (*extract_patch)(float* out, const float* src, int stride, int w, int h, float c);
+    // 3x3 Sobel of the 8-bit rows a, b, c (above, at, below; padded, pixel
+    // i is at i+1) in int16 and the structure tensor gx^2, gy^2, gx*gy of
+    // it in int32, exact; stored as floats times scale, i<n
+    void (*sobel_tensor_u8)(float* xx, float* yy, float* xy, const unsigned char* a, const unsigned char* b,
+                            const unsigned char* c, int n, float scale);
+    // FAST-9 rejection test of the 8-bit pixels p[i], i<n, at threshold t
+    // (0..255): stores in xs the i for which two neighbouring compass points
+    // of the radius 3 circle (p[i-3*stride], p[i+3], p[i+3*stride], p[i-3])
+    // are both brighter than p[i]+t or both darker than p[i]-t, as every
+    // contiguous arc of 9 holds two; returns their count
+    int (*fast9_candidates)(int* xs, const unsigned char* p, int stride, int n, int t);
+    // 3x3x3 extrema of the difference of Gaussian levels a, b, c (finer,
+    // at, coarser; rows stride floats apart): stores in xs the i<n for which
+    // b[i] is greater than thresh and not less than its 26 neighbours, or
+    // less than -thresh and not greater than any (ties, as of a feature
+    // centered between pixels, keep both); returns their count
+    int (*dog_extrema)(int* xs, const float* a, const float* b, const float* c, int stride, int n, float thresh);
+    // C[q1][q2] += sum over q3<m of At[q3][q1]*B[q3][q2], q1<ax, q2<by;
+    // all three GEMM_TILE x GEMM_TILE row major, At is the transposed A block
+    void (*gemm_tile)(double* C, const double* At, const double* B, int m, int ax, int by);
+    // x[i] = exp(x[i]), i<n, as simd_math's expf (same bound)
+    void (*exp_inplace)(float* x, int n);
+    };
+
+  // The selected kernel table
+  const Kernels& kernels(void);
+  // Highest tier the CPU supports
+  Tier best_tier(void);
+  // Select a tier (at most best_tier()), returns the tier in use
+  Tier set_tier(Tier t);
+  const char* tier_name(Tier t);
+  }
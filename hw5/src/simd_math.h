@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "simd_kernels.h"
+
+// Vectorized exp, tanh and sigmoid for double and float arrays.
+//
+// exp(x) = 2^n * p(r) with n = round(x/ln2) and r = x - n*ln2 (|r| <= ln2/2,
+// Cody-Waite reduction), p the Taylor polynomial of e^r with TERMS terms.
+// The truncation error is bounded by exp_error_bound(TERMS) relative to the
+// result; tanh and sigmoid are built on exp and inherit it as an absolute bound.
+// The number of terms is the accuracy knob, defaults below (override with -D):
+//   double: 13 terms, bound 1.7e-16 (at the rounding level)
+//   float:   7 terms, bound 1.2e-7
+// Inputs are clamped to [-708, 709] (double) and [-87, 88] (float): results
+// saturate instead of overflowing to inf or flushing to 0. NaN propagates.
+//
+// hw5 is built for the portable baseline (see simd_kernels.h), where the
+// __AVX2__ paths below are compiled out: exp_inplace of floats, the one
+// hw5 uses, goes through the run time dispatched simd::Kernels::exp_inplace
+// instead; the double, tanh and sigmoid array functions run scalar.
+#ifndef SIMD_MATH_EXP_TERMS
+#define SIMD_MATH_EXP_TERMS 13
+#endif
+#ifndef SIMD_MATH_EXPF_TERMS
+#define SIMD_MATH_EXPF_TERMS 7
+#endif
+
+namespace simd_math {
+
+static const double EXP_COEF[16] = {
+    1., 1., 1. / 2, 1. / 6, 1. / 24, 1. / 120, 1. / 720, 1. / 5040, 1. / 40320, 1. / 362880, 1. / 3628800,
+    1. / 39916800, 1. / 479001600, 1. / 6227020800., 1. / 87178291200., 1. / 1307674368000.};
+
+static const double LOG2E = 1.44269504088896340736;
+static const double LN2_HI = 6.93147180369123816490e-01;
+static const double LN2_LO = 1.90821492927058770002e-10;
+static const float LN2_HI_F = 0.693359375f;
+static const float LN2_LO_F = -2.12194440e-4f;
+static const double EXP_MIN = -708., EXP_MAX = 709.;
+static const float EXPF_MIN = -87.f, EXPF_MAX = 88.f;
+
+// Largest relative error of the polynomial with `terms` terms on |r| <= ln2/2
+inline double exp_error_bound(int terms) {
+  double b = 1;
+  for (int k = 1; k <= terms; k++) b *= 0.34657359027997264 / k;
+  return b;
+}
+
+template <int TERMS>
+inline double exp_scalar(double x) {
+  static_assert(TERMS >= 2 && TERMS <= 16, "1 < TERMS <= 16");
+  x = x < EXP_MIN ? EXP_MIN : x;
+  x = x > EXP_MAX ? EXP_MAX : x;
+  double n = std::floor(x * LOG2E + 0.5);
+  double r = (x - n * LN2_HI) - n * LN2_LO;
+  double p = EXP_COEF[TERMS - 1];
+  for (int k = TERMS - 2; k >= 0; k--) p = p * r + EXP_COEF[k];
+  if (std::isnan(x)) return x;
+  uint64_t bits = uint64_t(int64_t(n) + 1023) << 52;
+  double scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+template <int TERMS>
+inline float expf_scalar(float x) {
+  static_assert(TERMS >= 2 && TERMS <= 16, "1 < TERMS <= 16");
+  x = x < EXPF_MIN ? EXPF_MIN : x;
+  x = x > EXPF_MAX ? EXPF_MAX : x;
+  float n = std::floor(x * float(LOG2E) + 0.5f);
+  float r = (x - n * LN2_HI_F) - n * LN2_LO_F;
+  float p = float(EXP_COEF[TERMS - 1]);
+  for (int k = TERMS - 2; k >= 0; k--) p = p * r + float(EXP_COEF[k]);
+  if (std::isnan(x)) return x;
+  uint32_t bits = uint32_t(int32_t(n) + 127) << 23;
+  float scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+#if defined(__AVX2__)
+inline __m256d fmadd(__m256d a, __m256d b, __m256d c) {
+#if defined(__FMA__)
+  return _mm256_fmadd_pd(a, b, c);
+#else
+  return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+#endif
+}
+
+inline __m256 fmadd(__m256 a, __m256 b, __m256 c) {
+#if defined(__FMA__)
+  return _mm256_fmadd_ps(a, b, c);
+#else
+  return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+template <int TERMS>
+inline __m256d exp_pd(__m256d x) {
+  // max/min return the second operand for NaN, so NaN passes through
+  x = _mm256_max_pd(_mm256_set1_pd(EXP_MIN), x);
+  x = _mm256_min_pd(_mm256_set1_pd(EXP_MAX), x);
+  __m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256d r = fmadd(n, _mm256_set1_pd(-LN2_HI), x);
+  r = fmadd(n, _mm256_set1_pd(-LN2_LO), r);
+  __m256d p = _mm256_set1_pd(EXP_COEF[TERMS - 1]);
+  for (int k = TERMS - 2; k >= 0; k--) p = fmadd(p, r, _mm256_set1_pd(EXP_COEF[k]));
+  // 2^n: n sits in the low mantissa bits after adding 1.5*2^52
+  __m256i e = _mm256_castpd_si256(_mm256_add_pd(n, _mm256_set1_pd(6755399441055744.0)));
+  e = _mm256_slli_epi64(_mm256_add_epi64(e, _mm256_set1_epi64x(1023)), 52);
+  return _mm256_mul_pd(p, _mm256_castsi256_pd(e));
+}
+
+template <int TERMS>
+inline __m256 exp_ps(__m256 x) {
+  x = _mm256_max_ps(_mm256_set1_ps(EXPF_MIN), x);
+  x = _mm256_min_ps(_mm256_set1_ps(EXPF_MAX), x);
+  __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(float(LOG2E))), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 r = fmadd(n, _mm256_set1_ps(-LN2_HI_F), x);
+  r = fmadd(n, _mm256_set1_ps(-LN2_LO_F), r);
+  __m256 p = _mm256_set1_ps(float(EXP_COEF[TERMS - 1]));
+  for (int k = TERMS - 2; k >= 0; k--) p = fmadd(p, r, _mm256_set1_ps(float(EXP_COEF[k])));
+  __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+#endif
+
+}  // namespace simd_math
+
+inline double fast_exp(double x) { return simd_math::exp_scalar<SIMD_MATH_EXP_TERMS>(x); }
+inline float fast_exp(float x) { return simd_math::expf_scalar<SIMD_MATH_EXPF_TERMS>(x); }
+
+inline double fast_tanh(double x) {
+  double t = fast_exp(-2 * std::fabs(x));
+  return std::copysign((1 - t) / (1 + t), x);
+}
+inline float fast_tanh(float x) {
+  float t = fast_exp(-2 * std::fabs(x));
+  return std::copysign((1 - t) / (1 + t), x);
+}
+
+inline double fast_sigmoid(double x) { return 1 / (1 + fast_exp(-x)); }
+inline float fast_sigmoid(float x) { return 1 / (1 + fast_exp(-x)); }
+
+// x[i] = exp(x[i])
+inline void exp_inplace(double *x, long n) {
+  long i = 0;
+#if defined(__AVX2__)
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(x + i, simd_math::exp_pd<SIMD_MATH_EXP_TERMS>(_mm256_loadu_pd(x + i)));
+#endif
+  for (; i < n; i++) x[i] = fast_exp(x[i]);
+}
+
+inline void exp_inplace(float *x, long n) { simd::kernels().exp_inplace(x, (int) n); }
+
+// x[i] = tanh(x[i]) = sign(x) (1 - e^-2|x|) / (1 + e^-2|x|)
+inline void tanh_inplace(double *x, long n) {
+  long i = 0;
+#if defined(__AVX2__)
+  const __m256d sign = _mm256_set1_pd(-0.), one = _mm256_set1_pd(1.), m2 = _mm256_set1_pd(-2.);
+  for (; i + 4 <= n; i += 4) {
+    __m256d v = _mm256_loadu_pd(x + i);
+    __m256d t = simd_math::exp_pd<SIMD_MATH_EXP_TERMS>(_mm256_mul_pd(m2, _mm256_andnot_pd(sign, v)));
+    __m256d y = _mm256_div_pd(_mm256_sub_pd(one, t), _mm256_add_pd(one, t));
+    _mm256_storeu_pd(x + i, _mm256_or_pd(y, _mm256_and_pd(sign, v)));
+  }
+#endif
+  for (; i < n; i++) x[i] = fast_tanh(x[i]);
+}
+
+inline void tanh_inplace(float *x, long n) {
+  long i = 0;
+#if defined(__AVX2__)
+  const __m256 sign = _mm256_set1_ps(-0.f), one = _mm256_set1_ps(1.f), m2 = _mm256_set1_ps(-2.f);
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(x + i);
+    __m256 t = simd_math::exp_ps<SIMD_MATH_EXPF_TERMS>(_mm256_mul_ps(m2, _mm256_andnot_ps(sign, v)));
+    __m256 y = _mm256_div_ps(_mm256_sub_ps(one, t), _mm256_add_ps(one, t));
+    _mm256_storeu_ps(x + i, _mm256_or_ps(y, _mm256_and_ps(sign, v)));
+  }
+#endif
+  for (; i < n; i++) x[i] = fast_tanh(x[i]);
+}
+
+// x[i] = 1 / (1 + exp(-x[i]))
+inline void sigmoid_inplace(double *x, long n) {
+  long i = 0;
+#if defined(__AVX2__)
+  const __m256d sign = _mm256_set1_pd(-0.), one = _mm256_set1_pd(1.);
+  for (; i + 4 <= n; i += 4) {
+    __m256d t = simd_math::exp_pd<SIMD_MATH_EXP_TERMS>(_mm256_xor_pd(sign, _mm256_loadu_pd(x + i)));
+    _mm256_storeu_pd(x + i, _mm256_div_pd(one, _mm256_add_pd(one, t)));
+  }
+#endif
+  for (; i < n; i++) x[i] = fast_sigmoid(x[i]);
+}
+
+inline void sigmoid_inplace(float *x, long n) {
+  long i = 0;
+#if defined(__AVX2__)
+  const __m256 sign = _mm256_set1_ps(-0.f), one = _mm256_set1_ps(1.f);
+  for (; i + 8 <= n; i += 8) {
+    __m256 t = simd_math::exp_ps<SIMD_MATH_EXPF_TERMS>(_mm256_xor_ps(sign, _mm256_loadu_ps(x + i)));
+    _mm256_storeu_ps(x + i, _mm256_div_ps(one, _mm256_add_ps(one, t)));
+  }
+#endif
+  for (; i < n; i++) x[i] = fast_sigmoid(x[i]);
+}
@@ -0,0 +1,152 @@
+#include "../descriptor_pca.h"
+#include "../image.h"
+#include "../matrix.h"
+#include "../utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Learn the PCA basis of the panorama descriptors, and report what
+// matching the compressed descriptors loses.
+//
+// USAGE: ./descriptor-pca learn  [file] [k]    first k components (default 32) of the FAST-9,
+//                                              window 7 descriptors of every pano/ set but rainier
+//        ./descriptor-pca report [file] [set]  match recall per dimension on the pairs of
+//                                              neighbouring images of pano/set (default rainier)
+// file defaults to data/descriptor_pca.bin. Run from hw5/.
+
+static const int WINDOW=7;
+static const int PER_IMAGE=1000;     // descriptors an image adds to the corpus at most
+
+static bool exists(const string& file)
+  {
+  FILE* fn=fopen(file.c_str(),"rb");
+  if(fn)fclose(fn);
+  return fn!=nullptr;
+  }
+
+// pano/set/0.jpg, 1.jpg, ... as far as they go
+static vector<string> set_images(const string& set)
+  {
+  vector<string> files;
+  for(int q1=0;exists("pano/"+set+"/"+to_string(q1)+".jpg");q1++)files.push_back("pano/"+set+"/"+to_string(q1)+".jpg");
+  return files;
+  }
+
+static vector<Descriptor> describe(const Image& im)
+  {
+  return detect_features(im,FAST9,2,0,WINDOW,3,0);
+  }
+
+static int learn(const string& file, int k)
+  {
+  vector<Descriptor> corpus;
+  for(string set:{"columbia","cse","field","helens","loop","sun","wall"})
+    for(const string& f:set_images(set))
+      {
+      vector<Descriptor> d=describe(load_image(f));
+      size_t step=max<size_t>(1,d.size()/PER_IMAGE);
+      for(size_t q1=0;q1<d.size();q1+=step)corpus.push_back(move(d[q1]));
+      printf("%s: %zu descriptors, %zu in all\n",f.c_str(),d.size(),corpus.size());
+      }
+  if(corpus.size()<2){ printf("no descriptors found, run from hw5/\n"); return 1; }
+
+  DescriptorPCA all=learn_descriptor_pca(descriptor_matrix(corpus),(int)corpus[0].data.size());
+  DescriptorPCA pca=all.first(k);
+  double total=0,kept=0;
+  for(double v:all.variance)total+=v;
+  printf("%d of %d dimensions, variance kept:",pca.k,pca.dim);
+  for(int q1=0;q1<pca.k;q1++)
+    {
+    kept+=pca.variance[q1];
+    if(q1+1==4 || (q1+1)%8==0 || q1+1==pca.k)printf(" %d: %.1f%%",q1+1,100*kept/total);
+    }
+  printf("\n");
+  if(!save_descriptor_pca(pca,file))return 1;
+  printf("saved %s\n",file.c_str());
+  return 0;
+  }
+
+static double seconds(chrono::steady_clock::time_point t0)
+  {
+  return chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+  }
+
+// The matches as (index in a, index in b) pairs
+static set<pair<int,int>> match_pairs(const vector<Match>& m, const vector<Descriptor>& a, const vector<Descriptor>& b)
+  {
+  set<pair<int,int>> res;
+  for(const Match& e1:m)res.insert({int(e1.a-a.data()),int(e1.b-b.data())});
+  return res;
+  }
+
+// For every pair, the RANSAC inliers of the full descriptors' matches are
+// the true correspondences; recall is the share of them the compressed
+// descriptors match to the same descriptor, precision the share of the
+// compressed matches that agree with the homography (within the inlier
+// distance).
+static int report(const string& file, const string& set)
+  {
+  DescriptorPCA pca=load_descriptor_pca(file);
+  if(pca.empty())return 1;
+  vector<string> files=set_images(set);
+  if(files.size()<2){ printf("no image pairs in pano/%s\n",set.c_str()); return 1; }
+
+  vector<int> dims;
+  for(int k:{4,8,12,16,24,32,48,64})if(k<pca.k)dims.push_back(k);
+  dims.push_back(pca.k);
+  dims.push_back(0);   // uncompressed
+  vector<double> recalled(dims.size()),agree(dims.size()),matched(dims.size()),time(dims.size());
+  double truth=0;
+
+  vector<Descriptor> prev=describe(load_image(files[0]));
+  for(size_t q1=1;q1<files.size();q1++)
+    {
+    vector<Descriptor> cur=describe(load_image(files[q1]));
+    vector<Match> m=match_descriptors(prev,cur);
+    Matrix H=RANSAC(m,5,10000,50);
+    std::set<pair<int,int>> correct=match_pairs(model_inliers(H,m,5),prev,cur);
+    truth+=correct.size();
+    for(size_t q2=0;q2<dims.size();q2++)
+      {
+      vector<Descriptor> a=prev,b=cur;
+      if(dims[q2])
+        {
+        DescriptorPCA p=pca.first(dims[q2]);
+        compress_descriptors(a,p);
+        compress_descriptors(b,p);
+        }
+      auto t0=chrono::steady_clock::now();
+      vector<Match> mk=match_descriptors(a,b);
+      time[q2]+=seconds(t0);
+      matched[q2]+=mk.size();
+      agree[q2]+=model_inliers(H,mk,5).size();
+      for(const pair<int,int>& e1:match_pairs(mk,a,b))recalled[q2]+=correct.count(e1);
+      }
+    prev=move(cur);
+    }
+
+  printf("pano/%s, %zu pairs, %.0f true correspondences (inliers of the %d-dim matches)\n",
+         set.c_str(),files.size()-1,truth,pca.dim);
+  printf("%6s %10s %10s %9s %11s %10s %9s\n","dims","matches","recalled","recall %","precision %","match ms","speedup");
+  for(size_t q2=0;q2<dims.size();q2++)
+    printf("%6d %10.0f %10.0f %9.1f %11.1f %10.1f %9.2f\n",dims[q2] ? dims[q2] : pca.dim,matched[q2],recalled[q2],
+           100*recalled[q2]/max(truth,1.),100*agree[q2]/max(matched[q2],1.),1e3*time[q2],time.back()/time[q2]);
+  return 0;
+  }
+
+int main(int argc, char **argv)
+  {
+  string mode=argc>1 ? argv[1] : "";
+  string file=argc>2 ? argv[2] : "data/descriptor_pca.bin";
+  if(mode=="learn")return learn(file,argc>3 ? atoi(argv[3]) : 32);
+  if(mode=="report")return report(file,argc>3 ? argv[3] : "rainier");
+  printf("USAGE: ./descriptor-pca learn [file] [k]\n       ./descriptor-pca report [file] [set]\n");
+  return 0;
+  }
@@ -49,13 +49,16 @@ void load_images(image_map& im, const string& indir, const string& outdir, int n
   for(auto&e1:th)e1->join();th.clear();
   }
 
+// corner detector of every panorama, set by the second argument
+static Detector detector=HARRIS;
+
 void create_panorama(image_map& im, const string& out, const string& aname, const string& bname,
                      float sigma, int corner_method, float thresh, int window, int nms, float inlier_thresh, int iters, int cutoff, float acoeff)
   {
   printf("Combining %s and %s into %s...\n",aname.c_str(),bname.c_str(),out.c_str());
   assert(im[aname].size()!=0 && "Image A invalid\n");
   assert(im[bname].size()!=0 && "Image B invalid\n");
-  im[out]=panorama_image(im[aname],im[bname],sigma,corner_method,thresh,window,nms,inlier_thresh,iters,cutoff,acoeff);
+  im[out]=panorama_image(im[aname],im[bname],sigma,corner_method,thresh,window,nms,inlier_thresh,iters,cutoff,acoeff,detector);
   save_png(im[out],im.outdir+out);
   printf("%s finished computing\n",out.c_str());
   }
@@ -305,10 +308,19 @@ int main(int argc, char **argv)
   
   if(argc<=1)
     {
-    printf("USAGE: ./make-panorama [name]=rainier/columbia/helens/field/sun/wall...\n");
+    printf("USAGE: ./make-panorama [name]=rainier/columbia/helens/field/sun/wall... [detector]=harris/fast/fast-harris/dog\n");
     return 0;
     }
   
+  if(argc>2)
+    {
+    string d=argv[2];
+    if(d=="fast")detector=FAST9;
+    else if(d=="fast-harris")detector=FAST9_HARRIS;
+    else if(d=="dog")detector=DOG;
+    else if(d!="harris"){ printf("unknown detector %s\n",argv[2]); return 1; }
+    }
+  
   if(string(argv[1])=="columbia")do_columbia_peak();
   if(string(argv[1])=="rainier")do_rainier();
   if(string(argv[1])=="field")do_field();
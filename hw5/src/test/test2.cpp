@@ -92,7 +92,7 @@ void test_gaussian_filter()
   {
   Image f = make_gaussian_filter(7);
   
-  for(int i = 0; i < f.w * f.h * f.c; i++)f.data[i] *= 100;
+  for(int i = 0; i < f.w * f.h * f.c; i++)f.data.writable()[i] *= 100;
   
   Image gt = load_image("data/gaussian_filter_7.png");
   TEST(same_image(f, gt));
@@ -162,12 +162,12 @@ void test_sobel()
   
   for(int i = 0; i < gt_mag.w*gt_mag.h; ++i){
       if(within_eps(gt_mag.data[i], 0)){
-          gt_theta.data[i] = 0;
-          theta.data[i] = 0;
+          gt_theta.data.writable()[i] = 0;
+          theta.data.writable()[i] = 0;
       }
       if(within_eps(gt_theta.data[i], 0) || within_eps(gt_theta.data[i], 1)){
-          gt_theta.data[i] = 0;
-          theta.data[i] = 0;
+          gt_theta.data.writable()[i] = 0;
+          theta.data.writable()[i] = 0;
       }
   }
   
@@ -1,8 +1,15 @@
 #include "../image.h"
 #include "../utils.h"
 #include "../matrix.h"
+#include "../buffer_pool.h"
+#include "../memory_policy.h"
+#include "../perf_counters.h"
+#include "../simd_kernels.h"
+#include "../descriptor_pca.h"
+#include "../simd_math.h"
 
 #include <string>
+#include <thread>
 
 using namespace std;
 
@@ -30,10 +37,546 @@ void test_cornerness()
   }
 
 
+void profiled_leaf(int n)
+  {
+  PROFILE_SCOPE("leaf");
+  volatile float x=0;
+  for(int q1=0;q1<n;q1++)x=x+1;
+  }
+
+void test_profiler()
+  {
+  profiler::reset();
+  thread th([]()
+    {
+      {
+      PROFILE_SCOPE("outer");
+      for(int q1=0;q1<1000;q1++)profiled_leaf(10);
+      }
+    for(int q1=0;q1<100000;q1++)profiled_leaf(10); // wraps the ring
+    PROFILE_SCOPE("outer");
+    profiled_leaf(10);
+    });
+  th.join();
+  
+  // the ring of a thread that exited goes to the next one
+  profiler::Ring* rings[2]={nullptr,nullptr};
+  for(int q1=0;q1<2;q1++)thread([&](){ profiled_leaf(1); rings[q1]=profiler::ring; }).join();
+  TEST(rings[0] && rings[0]==rings[1]);
+  
+  FILE* f=tmpfile();
+  profiler::report(f);
+  string rep(size_t(ftell(f)),'\0');
+  rewind(f);
+  rep.resize(fread(&rep[0],1,rep.size(),f));
+  fclose(f);
+  TEST(rep.find("outer")!=string::npos);
+  TEST(rep.find("  leaf")!=string::npos);
+  TEST(rep.find("events dropped")!=string::npos);
+  
+  TEST(profiler::write_trace("output/test_trace.json"));
+  FILE* t=fopen("output/test_trace.json","r");
+  char head[32]={0};
+  if(t){ if(!fread(head,1,16,t))head[0]=0; fclose(t); }
+  TEST(string(head).find("{\"traceEvents\":[")==0);
+  remove("output/test_trace.json");
+  }
+
+string report_line(void (*report)(FILE*), const string& scope)
+  {
+  FILE* f=tmpfile();
+  report(f);
+  string rep(size_t(ftell(f)),'\0');
+  rewind(f);
+  rep.resize(fread(&rep[0],1,rep.size(),f));
+  fclose(f);
+  size_t p=rep.find(" "+scope+" (");
+  if(p==string::npos)return "";
+  size_t b=rep.rfind('\n',p);
+  return rep.substr(b==string::npos ? 0 : b+1,p-(b==string::npos ? 0 : b+1));
+  }
+
+void test_memory_tracking()
+  {
+  profiler::reset();
+  bool tracking=profiler::track_memory;
+  profiler::set_memory_tracking(true);
+    {
+    PROFILE_SCOPE("memory_scope");
+    Image a(100,100,3);
+    Image b=a;                         // shared
+    b(0,0,0)=1;                        // deep copy on write
+    Image c=move(b);                   // no allocation
+    Matrix m(10,10);
+    }
+  profiler::set_memory_tracking(tracking);
+  
+  unsigned long long calls,allocs,copies;
+  double alloc_mb,peak_mb,copy_mb;
+  string line=report_line(profiler::memory_report,"memory_scope");
+  TEST(sscanf(line.c_str(),"%llu %llu %lf %lf %llu %lf",&calls,&allocs,&alloc_mb,&peak_mb,&copies,&copy_mb)==6);
+  TEST(calls==1 && allocs==3 && copies==1);
+  TEST(within_eps(alloc_mb,(2*120000+800)/1048576.) && within_eps(peak_mb,alloc_mb) && within_eps(copy_mb,120000/1048576.));
+  }
+
+void test_copy_on_write()
+  {
+  Image a(4,3,2);
+  a(1,1,1)=5;
+  Image b=a;
+  TEST(b.data.shared() && b.data.get()==a.data.get());
+  TEST(b.data.writable()!=a.data.get() && !a.data.shared());   // asking for write access detaches
+  b=a;
+  const Image& cb=b;
+  TEST(cb(1,1,1)==5 && b.data.shared());       // reads do not copy
+  b(1,1,1)=7;
+  TEST(!a.data.shared() && !b.data.shared() && a(1,1,1)==5 && b(1,1,1)==7);
+  Image c;
+  c=a;
+  a.clear();
+  TEST(c(1,1,1)==5 && a(1,1,1)==0 && a.w==4 && !c.data.shared());
+  
+  // copies made, written and dropped concurrently
+  Image src(64,64,3);
+  for(int q1=0;q1<src.size();q1++)src.data.writable()[q1]=(float)q1;
+  const Image& shared_src=src;    // the threads only read the original
+  vector<int> ok(4,1);
+  vector<thread> th;
+  for(int t=0;t<4;t++)th.emplace_back([&,t]()
+    {
+    for(int q1=0;q1<1000;q1++)
+      {
+      Image local=shared_src;
+      const Image& read=local;
+      if(read(q1%64,7,1)!=shared_src(q1%64,7,1))ok[t]=0;
+      local(q1%64,7,1)=-1;
+      if(shared_src(q1%64,7,1)<0 || local(q1%64,7,1)!=-1)ok[t]=0;
+      }
+    });
+  for(auto& e1:th)e1.join();
+  TEST(ok==vector<int>(4,1) && !src.data.shared());
+  }
+
+void test_image_view()
+  {
+  Image a(5,4,2);
+  for(int q1=0;q1<a.size();q1++)a.data.writable()[q1]=(float)q1+1;
+  ConstImageView v=((const Image&)a).view(1,2,3,2);
+  TEST(v(0,0,0)==a(1,2,0) && v(2,1,1)==a(3,3,1) && v.row(1,1)==&a(1,3,1) && !v.contiguous());
+  TEST(v.sub(1,1,2,1)(1,0,1)==a(3,3,1));
+  
+  // crop
+  Image crop(v);
+  TEST(crop.w==3 && crop.h==2 && crop.c==2 && crop(2,1,1)==a(3,3,1) && crop(0,0,0)==a(1,2,0));
+  
+  // paste, only the rectangle changes
+  Image canvas(7,6,2);
+  copy_pixels(canvas.view(2,1,5,4),a.view());
+  int same=1;
+  for(int ch=0;ch<2;ch++)for(int y=0;y<6;y++)for(int x=0;x<7;x++)
+    {
+    bool inside=x>=2 && y>=1 && y<5;
+    if(canvas(x,y,ch)!=(inside ? a(x-2,y-1,ch) : 0.f))same=0;
+    }
+  TEST(same);
+  
+  // side by side, and trimming the zero border of the paste
+  Image b(2,6,2);
+  for(int q1=0;q1<b.size();q1++)b.data.writable()[q1]=-(float)q1;
+  Image both=both_images(a,b);
+  TEST(both.w==7 && both.h==6 && both(4,3,1)==a(4,3,1) && both(5,5,0)==b(0,5,0) && both(0,5,1)==0);
+  TEST(same_image(trim_image(canvas),a));
+  }
+
+void test_buffer_pool()
+  {
+  size_t capacity=buffer_pool::capacity();
+  buffer_pool::set_capacity(64<<20);
+  buffer_pool::trim();
+  buffer_pool::reset_stats();
+  
+  TEST(buffer_pool::size_class(100)==100 && buffer_pool::size_class(1<<20)==1<<20);
+  TEST(buffer_pool::size_class((1<<20)+1)==(1<<20)+(1<<17));
+  
+  const float* first;
+    {
+    Image a(300,200,3);
+    a(5,5,1)=3;
+    first=a.data.get();
+    }
+  Image b(300,200,3);    // the same block again, zeroed
+  buffer_pool::Stats s=buffer_pool::stats();
+  TEST(s.hits==1 && s.misses==1 && b.data.get()==first && b(5,5,1)==0);
+  Image c(300,200,3,Image::UNINITIALIZED);
+  Image small(10,10,3);  // below MIN_BYTES, not pooled
+  TEST(buffer_pool::stats().misses==2 && buffer_pool::stats().hits==1);
+  
+  // over the capacity blocks are freed
+  buffer_pool::set_capacity(1<<20);   // one block of the class
+  b=Image();
+  c=Image();
+  s=buffer_pool::stats();
+  TEST(s.dropped==1 && s.cached_blocks==1);
+  
+  // concurrent pipelines recycle each other's blocks
+  buffer_pool::set_capacity(64<<20);
+  vector<int> ok(4,1);
+  vector<thread> th;
+  for(int t=0;t<4;t++)th.emplace_back([&,t]()
+    {
+    for(int q1=0;q1<200;q1++)
+      {
+      Image im(128+t,128,2);
+      if(im(q1%128,3,1)!=0)ok[t]=0;
+      im(q1%128,3,1)=1;
+      }
+    });
+  for(auto& e1:th)e1.join();
+  s=buffer_pool::stats();
+  TEST(ok==vector<int>(4,1) && s.hits>=700);
+  
+  buffer_pool::set_capacity(capacity);
+  }
+
+void test_memory_policy()
+  {
+  TEST(memory_policy::numa_nodes()>=1);
+  memory_policy::Policy old=memory_policy::policy(),p;
+  p.huge_pages=true;
+  memory_policy::set_policy(p);
+  size_t bytes=5*memory_policy::LARGE_BYTES/2;
+  char* a=(char*)memory_policy::allocate(bytes,false);
+  char* b=(char*)memory_policy::allocate(bytes,false);
+  size_t offset=(uintptr_t)a%(2<<20);
+  TEST(offset<(64<<10) && offset%16==0 && offset!=(uintptr_t)b%(2<<20));
+  bool zero=true;
+  for(size_t q1=0;q1<bytes;q1+=999)zero&=a[q1]==0;
+  a[bytes-1]=1;
+  TEST(zero);
+  memory_policy::release(a);
+  memory_policy::release(b);
+  void* small=memory_policy::allocate(100,true);
+  TEST(small && ((char*)small)[99]==0 && (uintptr_t)small%16==0);
+  memory_policy::release(small);
+  
+  // Image and Matrix draw their large blocks from the policy
+  p.placement=memory_policy::INTERLEAVE;
+  memory_policy::set_policy(p);
+  buffer_pool::trim();
+  Image im(1024,1024,1);
+  Matrix m(1024,512);
+  TEST(im(1023,1023,0)==0 && m(1023,511)==0 && (uintptr_t)m.data%(2<<20)<(64<<10));
+  memory_policy::set_policy(old);
+  }
+
+void test_perf_counters()
+  {
+  if(!perf_counters::available())
+    {
+    // without counters: nothing is counted and tracking stays off
+    TEST(perf_counters::read().valid==0);
+    TEST(!profiler::set_counter_tracking(true) && !profiler::track_counters);
+    return;
+    }
+  profiler::reset();
+  bool tracking=profiler::track_counters;
+  string scopes=profiler::counted_scopes();
+  TEST(profiler::set_counter_tracking(true,"counted_scope"));
+  volatile float x=0;
+    {
+    PROFILE_SCOPE("counted_scope");
+    for(int q1=0;q1<100000;q1++)x+=1;
+    }
+    {
+    PROFILE_SCOPE("uncounted_scope");
+    for(int q1=0;q1<100000;q1++)x+=1;
+    }
+  profiler::set_counter_tracking(tracking,scopes);
+  
+  unsigned long long calls,counted;
+  double mcycles,minstr;
+  string line=report_line(profiler::counters_report,"counted_scope");
+  TEST(sscanf(line.c_str(),"%llu %llu %lf %lf",&calls,&counted,&mcycles,&minstr)==4);
+  TEST(calls==1 && counted==1 && minstr>=0.1);   // at least one instruction per iteration
+  line=report_line(profiler::counters_report,"uncounted_scope");
+  TEST(sscanf(line.c_str(),"%llu %llu",&calls,&counted)==2 && calls==1 && counted==0);
+  }
+
+// Every tier the CPU has gives the results of the baseline kernels
+void test_integer_harris()
+  {
+  // on a frame that is exactly 8-bit the two paths agree to float rounding
+  Gray8 g=to_gray8(load_image("data/dogbw.png"));
+  Image gf(g.w,g.h,1);
+  for(size_t q1=0;q1<g.data.size();q1++)gf.data.writable()[q1]=g.data[q1]/255.f;
+  Image Si=structure_matrix(g,2),Sf=structure_matrix(gf,2);
+  float err=0,top=0;
+  for(int q1=0;q1<Sf.size();q1++)
+    {
+    err=max(err,fabsf(Si.data.get()[q1]-Sf.data.get()[q1]));
+    top=max(top,fabsf(Sf.data.get()[q1]));
+    }
+  TEST(Si.w==Sf.w && Si.h==Sf.h && Si.c==3 && err<=1e-5f*top);
+  
+  // on the panorama inputs rounding the gray levels to 8 bits moves few corners
+  for(string file:{"pano/rainier/Rainier1.png","pano/rainier/Rainier2.png"})
+    {
+    Image im=load_image(file);
+    vector<Descriptor> df=harris_corner_detector(im,2,0.4f,5,3,0);
+    Image nms=nms_image(cornerness_response(structure_matrix(to_gray8(im),2),0),3);
+    vector<Descriptor> di=detect_corners(im,nms,0.4f,5);
+    size_t found=0;
+    for(const Descriptor& a:df)
+      for(const Descriptor& b:di)
+        if(fabs(a.p.x-b.p.x)<=1 && fabs(a.p.y-b.p.y)<=1){ found++; break; }
+    TEST(df.size()>50 && found>=0.95*df.size() && di.size()<=1.05*df.size());
+    }
+  }
+
+void test_fast_corners()
+  {
+  // a bright square: corners only at its four corners, none along the edges
+  Gray8 sq(64,48);
+  for(int y=10;y<30;y++)for(int x=20;x<44;x++)sq.row(y)[x]=200;
+  vector<Point> c=fast9_corners(sq,FAST_THRESHOLD,3,false);
+  bool near=!c.empty();
+  for(const Point& p:c)near&=(fabs(p.x-20)<=3 || fabs(p.x-43)<=3) && (fabs(p.y-10)<=3 || fabs(p.y-29)<=3);
+  TEST(near);
+  
+  // the segment test against the plain definition, every pixel
+  Gray8 g=to_gray8(load_image("pano/rainier/Rainier1.png"));
+  static const int C[16][2]={{0,-3},{1,-3},{2,-2},{3,-1},{3,0},{3,1},{2,2},{1,3},
+                             {0,3},{-1,3},{-2,2},{-3,1},{-3,0},{-3,-1},{-2,-2},{-1,-3}};
+  const int t=FAST_THRESHOLD;
+  vector<Point> ref;
+  for(int y=3;y<g.h-3;y++)for(int x=3;x<g.w-3;x++)
+    {
+    int v=g.row(y)[x];
+    bool corner=false;
+    for(int q1=0;q1<16 && !corner;q1++)
+      {
+      bool bright=true,dark=true;
+      for(int q2=q1;q2<q1+9;q2++)
+        {
+        int u=g.row(y+C[q2%16][1])[x+C[q2%16][0]];
+        bright&=u>v+t;
+        dark&=u<v-t;
+        }
+      corner=bright || dark;
+      }
+    if(corner)ref.push_back(Point(x,y));
+    }
+  vector<Point> all=fast9_corners(g,t,0,false);
+  bool same=all.size()==ref.size();
+  for(size_t q1=0;same && q1<all.size();q1++)same=all[q1].x==ref[q1].x && all[q1].y==ref[q1].y;
+  TEST(same);
+  
+  // NMS keeps a subset, by either score
+  for(bool harris:{false,true})
+    {
+    vector<Point> kept=fast9_corners(g,t,3,harris);
+    size_t found=0;
+    for(const Point& p:kept)
+      for(const Point& q:all)
+        if(p.x==q.x && p.y==q.y){ found++; break; }
+    TEST(!kept.empty() && kept.size()<all.size()/2 && found==kept.size());
+    }
+  
+  // the FAST detectors feed the same descriptors
+  Image im=load_image("pano/rainier/Rainier1.png");
+  vector<Descriptor> d=detect_features(im,FAST9,2,0.4f,5,3,0);
+  vector<Point> p=fast9_corners(to_gray8(im),FAST_THRESHOLD,3,false);
+  TEST(d.size()==p.size() && !d.empty() && d[0].data.size()==5*5*3u && d[0].p.x==p[0].x && d[0].p.y==p[0].y);
+  TEST(detect_features(im,HARRIS,2,0.4f,5,3,0).size()==harris_corner_detector(im,2,0.4f,5,3,0).size());
+  }
+
+void test_dog_detector()
+  {
+  // two Gaussian blobs: a keypoint at each, the wider one at the larger scale
+  Image blobs(160,96,1);
+  const float cx[2]={40,110},cy[2]={48,48},bs[2]={3,9};
+  for(int y=0;y<blobs.h;y++)for(int x=0;x<blobs.w;x++)
+    for(int q1=0;q1<2;q1++)
+      blobs(x,y,0)+=expf(-((x-cx[q1])*(x-cx[q1])+(y-cy[q1])*(y-cy[q1]))/(2*bs[q1]*bs[q1]));
+  vector<Descriptor> d=dog_detector(blobs,DOG_THRESHOLD,7);
+  float scale[2]={0,0};
+  for(const Descriptor& e:d)
+    for(int q1=0;q1<2;q1++)
+      if(fabs(e.p.x-cx[q1])<=2 && fabs(e.p.y-cy[q1])<=2)scale[q1]=max(scale[q1],e.scale);
+  TEST(scale[0]>=bs[0]/2 && scale[0]<=2*bs[0] && scale[1]>=bs[1]/2 && scale[1]<=2*bs[1]);
+  TEST(!d.empty() && d[0].data.size()==7*7u);
+  
+  // an image and itself at half size: most matches agree with the scaling
+  Image a=load_image("pano/rainier/Rainier1.png");
+  Image b=bilinear_resize(a,a.w/2,a.h/2);
+  vector<Descriptor> ad=dog_detector(a,DOG_THRESHOLD,7),bd=dog_detector(b,DOG_THRESHOLD,7);
+  vector<Match> m=match_descriptors(ad,bd);
+  size_t good=0;
+  for(const Match& e:m)good+=fabs(e.a->p.x/2-e.b->p.x)<=3 && fabs(e.a->p.y/2-e.b->p.y)<=3;
+  TEST(m.size()>50 && good>=0.6*m.size());
+  TEST(detect_features(a,DOG,2,0.4f,7,3,0).size()==ad.size());
+  }
+
+void test_describe_points()
+  {
+  // against describe_index's definition: rows of the window, clamped at the
+  // border, minus the center; corners, edges and the inside
+  Image im=load_image("data/dog.jpg");
+  vector<Point> p={Point(0,0),Point(im.w-1,im.h-1),Point(2,40),Point(100,1),Point(im.w-3,77),Point(200,150),Point(60,90)};
+  for(int w:{5,7,6})
+    {
+    const int r=w/2,n=2*r+1;
+    vector<float> block(p.size()*descriptor_size(im,w));
+    describe_points(block.data(),im,p,w);
+    vector<Descriptor> d=describe_corners(im,p,w);
+    bool ok=block.size()==p.size()*n*n*im.c && d.size()==p.size();
+    for(size_t q1=0;ok && q1<p.size();q1++)
+      {
+      const float* b=&block[q1*n*n*im.c];
+      ok=d[q1].p.x==p[q1].x && d[q1].p.y==p[q1].y && d[q1].data==vector<float>(b,b+n*n*im.c) &&
+         d[q1].data==describe_index(im,(int)p[q1].x,(int)p[q1].y,w).data;
+      int x=(int)p[q1].x,y=(int)p[q1].y;
+      for(int c=0;c<im.c;c++)for(int dy=-r;dy<=r;dy++)for(int dx=-r;dx<=r;dx++)
+        ok&=b[(c*n+dy+r)*n+dx+r]==im.clamped_pixel(x+dx,y+dy,c)-im.clamped_pixel(x,y,c);
+      }
+    TEST(ok);
+    }
+  }
+
+void test_descriptor_pca()
+  {
+  // eigenpairs of a symmetric matrix: A v = lambda v, descending
+  Matrix R=random_matrix(12,12),A=R+R.transpose(),values;
+  Matrix V=symmetric_eigen(A,values);
+  Matrix AV=A*V;
+  bool ok=V.rows==12 && V.cols==12 && values.rows*values.cols==12;
+  for(int q1=0;ok && q1<12;q1++)
+    {
+    if(q1)ok=values(q1-1)>=values(q1);
+    for(int q2=0;q2<12;q2++)ok&=fabs(AV(q2,q1)-values(q1)*V(q2,q1))<1e-6;
+    }
+  TEST(ok);
+  
+  vector<Descriptor> d=detect_features(load_image("data/dog.jpg"),FAST9,2,0,5,3,0);
+  DescriptorPCA pca=learn_descriptor_pca(descriptor_matrix(d),8);
+  TEST(pca.dim==75 && pca.k==8 && pca.variance[0]>=pca.variance[7] && pca.variance[7]>0);
+  
+  // the projection is (x - mean) * basis
+  Matrix X=descriptor_matrix(d),Y=project_descriptors(X,pca);
+  double err=0;
+  for(int q1=0;q1<X.rows;q1++)for(int q2=0;q2<pca.k;q2++)
+    {
+    double y=0;
+    for(int q3=0;q3<pca.dim;q3++)y+=(X(q1,q3)-pca.mean(0,q3))*pca.basis(q3,q2);
+    err=max(err,fabs(y-Y(q1,q2)));
+    }
+  TEST(Y.rows==(int)d.size() && Y.cols==8 && err<1e-4);
+  
+  // the file keeps the basis to float precision, and load picks the first k
+  TEST(save_descriptor_pca(pca,"output/descriptor_pca.bin"));
+  DescriptorPCA back=load_descriptor_pca("output/descriptor_pca.bin",4);
+  err=0;
+  for(int q1=0;q1<pca.dim;q1++)for(int q2=0;q2<4;q2++)err=max(err,fabs(back.basis(q1,q2)-pca.basis(q1,q2)));
+  TEST(back.dim==75 && back.k==4 && err<1e-6);
+  
+  vector<Descriptor> c=d;
+  compress_descriptors(c,back);
+  TEST(c.size()==d.size() && c[0].data.size()==4u && c[0].p.x==d[0].p.x);
+  }
+
+void test_simd_dispatch()
+  {
+  Image im=load_image("data/dog.jpg");
+  Image box=make_box_filter(7);
+  Matrix A=random_matrix(97,83),B=random_matrix(83,101);
+  vector<float> da(147),db(147);
+  for(int q1=0;q1<147;q1++){ da[q1]=(float)q1/147; db[q1]=(float)(q1%13)/13; }
+  
+  simd::Tier prev=simd::kernels().tier;
+  TEST(simd::set_tier(simd::BASELINE)==simd::BASELINE);
+  Image conv=convolve_image(im,box,false);
+  Image gray=rgb_to_grayscale(im);
+  Matrix P=A*B;
+  float l1=l1_distance(da,db);
+  Gray8 g8=to_gray8(im);
+  Image S8=structure_matrix(g8,2);
+  vector<Point> f8=fast9_corners(g8,FAST_THRESHOLD,0,false);
+  // the extrema of fixed DoG levels (the convolutions round differently with FMA)
+  Image L[4];
+  for(int q1=0;q1<4;q1++)L[q1]=smooth_image(gray,1.6f*powf(2.f,q1/3.f));
+  Image D[3]={L[1]-L[0],L[2]-L[1],L[3]-L[2]};
+  auto extrema=[&]()
+    {
+    vector<int> xs(gray.w),all;
+    for(int y=1;y<gray.h-1;y++)
+      {
+      size_t row=size_t(y)*gray.w+1;
+      int n=simd::kernels().dog_extrema(xs.data(),D[0].data.get()+row,D[1].data.get()+row,D[2].data.get()+row,
+                                        gray.w,gray.w-2,.005f);
+      for(int q1=0;q1<n;q1++)all.push_back(int(row)+xs[q1]);
+      }
+    return all;
+    };
+  vector<int> dog=extrema();
+  vector<Point> pts=fast9_corners(g8,FAST_THRESHOLD,0,false);
+  vector<float> desc(pts.size()*descriptor_size(im,7)),desc2(desc.size());
+  describe_points(desc.data(),im,pts,7);
+  // exp within its bound of the true one on [-87,88], saturated past it, NaN kept
+  auto exp_ok=[]()
+    {
+    vector<float> x;
+    for(int q1=-1000;q1<=1000;q1++)x.push_back(q1*.087f);
+    x.push_back(-200.f);
+    x.push_back(200.f);
+    x.push_back(NAN);
+    vector<float> y=x;
+    exp_inplace(y.data(),(long)y.size());
+    bool ok=isnan(y.back()) && y[y.size()-3]==fast_exp(-87.f) && y[y.size()-2]==fast_exp(88.f);
+    for(size_t q1=0;q1+3<x.size();q1++)ok&=fabs(y[q1]-exp((double)x[q1]))<=3e-7*exp((double)x[q1]);
+    return ok;
+    };
+  TEST(exp_ok());
+  
+  for(int t=simd::SSE42;t<=simd::best_tier();t++)
+    {
+    TEST(simd::set_tier(simd::Tier(t))==t && simd::kernels().tier==t);
+    TEST(same_image(convolve_image(im,box,false),conv));
+    TEST(same_image(rgb_to_grayscale(im),gray));
+    double err=0;
+    Matrix Q=A*B;
+    for(int q1=0;q1<P.rows;q1++)for(int q2=0;q2<P.cols;q2++)err=max(err,fabs(P(q1,q2)-Q(q1,q2)));
+    TEST(err<1e-9);
+    TEST(within_eps(l1_distance(da,db),l1));
+    TEST(same_image(structure_matrix(g8,2),S8));
+    vector<Point> f=fast9_corners(g8,FAST_THRESHOLD,0,false);
+    bool same=f.size()==f8.size();
+    for(size_t q1=0;same && q1<f.size();q1++)same=f[q1].x==f8[q1].x && f[q1].y==f8[q1].y;
+    TEST(same);
+    TEST(extrema()==dog && !dog.empty());
+    describe_points(desc2.data(),im,pts,7);
+    TEST(desc2==desc && !desc.empty());
+    TEST(exp_ok());
+    }
+  simd::set_tier(prev);
+  }
+
 void run_tests()
   {
   test_structure();
   test_cornerness();
+  test_profiler();
+  test_memory_tracking();
+  test_copy_on_write();
+  test_image_view();
+  test_buffer_pool();
+  test_memory_policy();
+  test_integer_harris();
+  test_fast_corners();
+  test_dog_detector();
+  test_describe_points();
+  test_descriptor_pca();
+  test_perf_counters();
+  test_simd_dispatch();
   
   printf("%d tests, %d passed, %d failed\n", tests_total, tests_total-tests_fail, tests_fail);
   }
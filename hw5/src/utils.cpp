@@ -49,6 +49,6 @@ Image Image::get_channel(int ch) const
   {
   assert(ch<c && ch>=0);
   Image im(w,h,1);
-  memcpy(im.data,&pixel(0,0,ch),sizeof(float)*im.size());
+  memcpy(im.data.writable(),&pixel(0,0,ch),sizeof(float)*im.size());
   return im;
   }